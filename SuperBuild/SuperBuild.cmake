@@ -34,6 +34,9 @@ set(USE_OPENJPEG "OFF" CACHE STRING "Build with JPEG2000 support using OpenJPEG.
 set_property(CACHE USE_OPENJPEG PROPERTY STRINGS  "OFF;GitHub;System;Custom")
 option(USE_JPEGLS "Build with JPEG-LS support using CharLS" OFF)
 option(USE_JNIFTI "Build with JNIFTI support" ON)
+option(USE_OPENMP "Build with OpenMP to read DICOM headers, convert 4D files and compress images in parallel" OFF)
+option(USE_LIBDEFLATE "Build with libdeflate as an internal gz compressor (--gz-backend libdeflate)" OFF)
+option(USE_ISAL "Build with ISA-L igzip as an internal gz compressor (--gz-backend isal)" OFF)
 
 option(BATCH_VERSION "Build dcm2niibatch for multiple conversions" OFF)
 
@@ -164,6 +167,9 @@ ExternalProject_Add(console
         -DUSE_JASPER:BOOL=${USE_JASPER}
         -DUSE_JPEGLS:BOOL=${USE_JPEGLS}
         -DUSE_JNIFTI:BOOL=${USE_JNIFTI}
+        -DUSE_OPENMP:BOOL=${USE_OPENMP}
+        -DUSE_LIBDEFLATE:BOOL=${USE_LIBDEFLATE}
+        -DUSE_ISAL:BOOL=${USE_ISAL}
         # ZLIB
         -DZLIB_IMPLEMENTATION:STRING=${ZLIB_IMPLEMENTATION}
         -DZLIB_ROOT:PATH=${ZLIB_ROOT}
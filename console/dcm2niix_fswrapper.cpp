@@ -216,6 +216,21 @@ int dcm2niix_fswrapper::dcm2NiiOneSeries(const char *dcmfile, bool convert) {
 	return nii_loadDirCore(tdcmOpts.indir, &tdcmOpts);
 }
 
+/*
+ * interface to nii_loadDirCore() to convert all series in tdcmOpts.indir,
+ * streaming each finished series to callback rather than collecting them in MRIFSSTRUCT vector.
+ */
+int dcm2niix_fswrapper::dcm2NiiAllSeries(MRIFSSERIES_CALLBACK callback, void *user, bool convert) {
+	tdcmOpts.numSeries = 0;
+	if (!convert)
+		tdcmOpts.isDumpNotConvert = true;  // retrieve dicom info only
+
+	nii_setMrifsSeriesCallback(callback, user);
+	int ret = nii_loadDirCore(tdcmOpts.indir, &tdcmOpts);
+	nii_setMrifsSeriesCallback(NULL, NULL);
+	return ret;
+}
+
 /*
  * interface to singleDICOM() to to convert only the single image provided.
  */
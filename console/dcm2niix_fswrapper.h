@@ -25,6 +25,11 @@ class dcm2niix_fswrapper {
 	// and convert dicom files with the same series as given file.
 	static int dcm2NiiOneSeries(const char *dcmfile, bool convert=true);
 
+	// interface to nii_loadDirCore() to convert every series in the input directory,
+	// each series is handed to callback as soon as it is converted (callback owns it),
+	// so only one series is held in memory at a time.
+	static int dcm2NiiAllSeries(MRIFSSERIES_CALLBACK callback, void *user, bool convert=true);
+
         // interface to singleDICOM() to convert only the single image provided
         static int dcm2NiiSingleFile(const char* dcmfile);
 
@@ -1,4 +1,5 @@
 #include "jpg_0XC3.h"
+#include "nii_dicom.h" // nii_fopen()
 #include "print.h"
 #include <stdbool.h> //requires VS 2015 or later
 #include <stdint.h>
@@ -112,7 +113,7 @@ unsigned char *decode_JPEG_SOF_0XC3(const char *fn, int skipBytes, bool verbose,
 		return NULL;             \
 	} while (0)
 	unsigned char *lImgRA8 = NULL;
-	FILE *reader = fopen(fn, "rb");
+	FILE *reader = nii_fopen(fn, "rb");
 	int lSuccess = fseek(reader, 0, SEEK_END);
 	long lRawSz = ftell(reader) - skipBytes;
 	if ((diskBytes > 0) && (diskBytes < lRawSz)) // only if diskBytes is known and does not exceed length of file
@@ -30,6 +30,17 @@ double get_wall_time() {
 }
 #endif
 
+#ifdef myEnableLibdeflate
+#define kGzHelpLibdeflate "/libdeflate"
+#else
+#define kGzHelpLibdeflate ""
+#endif
+#ifdef myEnableISAL
+#define kGzHelpISAL "/isal"
+#else
+#define kGzHelpISAL ""
+#endif
+
 const char *removePath(const char *path) { // "/usr/path/filename.exe" -> "filename.exe"
 	const char *pDelimeter = strrchr(path, '\\');
 	if (pDelimeter)
@@ -106,15 +117,27 @@ void showHelp(const char *argv[], struct TDCMopts opts) {
 		printf("  -z : gz compress images (y/n/3, default %c)  [y=pigz(MISSING!), n=no, 3=no,3D]\n", gzCh);
 #else
 #ifdef myDisableMiniZ
-	printf("  -z : gz compress images (y/i/n/3, default %c) [y=pigz, i=internal:zlib, n=no, 3=no,3D]\n", gzCh);
+	printf("  -z : gz compress images (y/i/a/n/3, default %c) [y=pigz, i=internal:zlib, a=internal:adaptive level, n=no, 3=no,3D]\n", gzCh);
 #else
-	printf("  -z : gz compress images (y/i/n/3, default %c) [y=pigz, i=internal:miniz, n=no, 3=no,3D]\n", gzCh);
+	printf("  -z : gz compress images (y/i/a/n/3, default %c) [y=pigz, i=internal:miniz, a=internal:adaptive level, n=no, 3=no,3D]\n", gzCh);
 #endif
 #endif
 	printf("  --big-endian : byte order (y/n/o, default o) [y=big-end, n=little-end, o=optimal/native]\n");
+#ifndef myDisableZLib
+	printf("  --gz-backend : internal compressor for '-z i' (zlib" kGzHelpLibdeflate kGzHelpISAL ", default %s)\n", nii_gzBackendName(opts.gzBackend));
+	printf("  --gz-target-mbps : choose each image's gz level by sampling, strongest level compressing at least this many MB/s (0 = off, default %d, '-z a' uses %d)\n", opts.gzTargetMBps, kGzTargetMBpsDefault);
+	printf("  --gz-target-ratio : choose each image's gz level by sampling, weakest level shrinking the data at least this many times (0 = off, default %g)\n", opts.gzTargetRatio);
+#endif
 	printf("  --progress : report progress (y/n, default n)\n");
 	printf("  --ignore_trigger_times : disregard values in 0018,1060 and 0020,9153\n");
+#ifndef myDisableOpenJPEG
+	printf("  --j2k-reduce : decode JPEG2000 at 1/2^n resolution for quick-look conversions (0..5, default 0)\n");
+#endif
+	printf("  --stats : report per stage and per series timing, bytes and compression (n/json/filename, default n) [json=stderr, filename=JSON file]\n");
 	printf("  --terse : omit filename post-fixes (can cause overwrites)\n");
+#ifdef _OPENMP
+	printf("  --threads : threads per stage: header readers (one converts 4D files), slice decoders, gz writer (e.g. 4,2,1; 0 = all threads, writer 0 = compress inline, default 0,0 with a writer if there is more than one thread)\n");
+#endif
 	printf("  --version : report version\n");
 	printf("  --xml : Slicer format features\n");
 	printf(" Defaults stored in Windows registry\n");
@@ -132,16 +155,31 @@ void showHelp(const char *argv[], struct TDCMopts opts) {
 		printf("  -z : gz compress images (y/o/n/3, default %c)  [y=pigz(MISSING!), o=optimal(requires pigz), n=no, 3=no,3D]\n", gzCh);
 #else
 #ifdef myDisableMiniZ
-	printf("  -z : gz compress images (y/o/i/n/3, default %c) [y=pigz, o=optimal pigz, i=internal:zlib, n=no, 3=no,3D]\n", gzCh);
+	printf("  -z : gz compress images (y/o/i/a/n/3, default %c) [y=pigz, o=optimal pigz, i=internal:zlib, a=internal:adaptive level, n=no, 3=no,3D]\n", gzCh);
 #else
-	printf("  -z : gz compress images (y/o/i/n/3, default %c) [y=pigz, o=optimal pigz, i=internal:miniz, n=no, 3=no,3D]\n", gzCh);
+	printf("  -z : gz compress images (y/o/i/a/n/3, default %c) [y=pigz, o=optimal pigz, i=internal:miniz, a=internal:adaptive level, n=no, 3=no,3D]\n", gzCh);
 #endif
 #endif
 	printf("  --big-endian : byte order (y/n/o, default o) [y=big-end, n=little-end, o=optimal/native]\n");
+#ifndef myDisableZLib
+	printf("  --gz-backend : internal compressor for '-z i' (zlib" kGzHelpLibdeflate kGzHelpISAL ", default %s)\n", nii_gzBackendName(opts.gzBackend));
+	printf("  --gz-target-mbps : choose each image's gz level by sampling, strongest level compressing at least this many MB/s (0 = off, default %d, '-z a' uses %d)\n", opts.gzTargetMBps, kGzTargetMBpsDefault);
+	printf("  --gz-target-ratio : choose each image's gz level by sampling, weakest level shrinking the data at least this many times (0 = off, default %g)\n", opts.gzTargetRatio);
+#endif
 	printf("  --progress : Slicer format progress information (y/n, default n)\n");
 	printf("  --ignore_trigger_times : disregard values in 0018,1060 and 0020,9153\n");
+#ifndef myDisableOpenJPEG
+	printf("  --j2k-reduce : decode JPEG2000 at 1/2^n resolution for quick-look conversions (0..5, default 0)\n");
+#endif
+	printf("  --stats : report per stage and per series timing, bytes and compression (n/json/filename, default n) [json=stderr, filename=JSON file]\n");
 	printf("  --terse : omit filename post-fixes (can cause overwrites)\n");
+#ifdef _OPENMP
+	printf("  --threads : threads per stage: header readers (one converts 4D files), slice decoders, gz writer (e.g. 4,2,1; 0 = all threads, writer 0 = compress inline, default 0,0 with a writer if there is more than one thread)\n");
+#endif
 	printf("  --version : report version\n");
+#ifdef myEnableWatchDir
+	printf("  --watch : keep running, convert each series in in_folder once complete or idle for this many seconds (0 = off, default %d)\n", opts.watchSec);
+#endif
 	printf("  --xml : Slicer format features\n");
 	printf(" Defaults file : %s\n", opts.optsname);
 	printf(" Examples :\n");
@@ -155,7 +193,7 @@ void showHelp(const char *argv[], struct TDCMopts opts) {
 } // showHelp()
 
 int invalidParam(int i, const char *argv[]) {
-	if (strchr("yYnNoOhHiIjlLJBb01234", argv[i][0]))
+	if (strchr("yYnNoOhHiIaAjlLJBb01234", argv[i][0]))
 		return 0;
 
 	// if (argv[i][0] != '-') return 0;
@@ -271,6 +309,51 @@ int main(int argc, const char *argv[]) {
 			} else if (!strcmp(argv[i], "--ignore_trigger_times")) {
 				opts.isIgnoreTriggerTimes = true;
 				printf("ignore_trigger_times may have unintended consequences (issue 499)\n");
+#ifndef myDisableZLib
+			} else if ((!strcmp(argv[i], "--gz-backend")) && ((i + 1) < argc)) {
+				i++;
+				opts.gzBackend = nii_gzBackend(argv[i]);
+			} else if ((!strcmp(argv[i], "--gz-target-mbps")) && ((i + 1) < argc)) {
+				i++;
+				opts.gzTargetMBps = abs((int)strtol(argv[i], NULL, 10));
+			} else if ((!strcmp(argv[i], "--gz-target-ratio")) && ((i + 1) < argc)) {
+				i++;
+				opts.gzTargetRatio = fabs(atof(argv[i]));
+#endif
+			} else if ((!strcmp(argv[i], "--j2k-reduce")) && ((i + 1) < argc)) {
+				i++;
+#ifndef myDisableOpenJPEG
+				opts.j2kReduce = abs((int)strtol(argv[i], NULL, 10));
+				if (opts.j2kReduce > 5)
+					opts.j2kReduce = 5; // DICOM JPEG2000 images rarely have more than 5 decomposition levels
+#else
+				printf("Warning: compiled without OpenJPEG, '--j2k-reduce' ignored\n");
+#endif
+#ifdef myEnableWatchDir
+			} else if ((!strcmp(argv[i], "--watch")) && ((i + 1) < argc)) {
+				i++;
+				opts.watchSec = abs((int)strtol(argv[i], NULL, 10));
+#endif
+			} else if ((!strcmp(argv[i], "--threads")) && ((i + 1) < argc)) {
+				i++;
+#ifdef _OPENMP
+				int threads[3] = {opts.threadsRead, opts.threadsDecode, opts.threadsWrite};
+				int n = sscanf(argv[i], "%d,%d,%d", &threads[0], &threads[1], &threads[2]);
+				if (n > 0)
+					opts.threadsRead = abs(threads[0]);
+				if (n > 1)
+					opts.threadsDecode = abs(threads[1]);
+				if (n > 2)
+					opts.threadsWrite = (threads[2] != 0) ? 1 : 0;
+#else
+				printf("Warning: compiled without OpenMP, '--threads' ignored\n");
+#endif
+			} else if ((!strcmp(argv[i], "--stats")) && ((i + 1) < argc)) {
+				i++;
+				if ((argv[i][0] == 'n') || (argv[i][0] == 'N') || (argv[i][0] == '0'))
+					strcpy(opts.statsname, "");
+				else
+					snprintf(opts.statsname, kOptsStr, "%s", argv[i]);
 			} else if (!strcmp(argv[i], "--terse")) {
 				opts.isAddNamePostFixes = false;
 			} else if (!strcmp(argv[i], "--version")) {
@@ -538,6 +621,13 @@ int main(int argc, const char *argv[]) {
 					opts.isGz = true;
 #ifndef myDisableZLib
 					strcpy(opts.pigzname, ""); // force use of internal compression instead of pigz
+#endif
+#ifndef myDisableZLib
+				} else if ((argv[i][0] == 'a') || (argv[i][0] == 'A')) {
+					opts.isGz = true;
+					strcpy(opts.pigzname, ""); // internal compression, level chosen per image
+					if (opts.gzTargetMBps < 1)
+						opts.gzTargetMBps = kGzTargetMBpsDefault;
 #endif
 				} else if ((argv[i][0] == 'n') || (argv[i][0] == 'N') || (argv[i][0] == '0'))
 					opts.isGz = false;
@@ -611,9 +701,12 @@ int main(int argc, const char *argv[]) {
 	for (i = (lastCommandArg + 1); i < argc; i++) {
 		strcpy(opts.indir, argv[i]); // [argc-1]
 		int ret = nii_loadDir(&opts);
-		if (ret != EXIT_SUCCESS)
+		if (ret != EXIT_SUCCESS) {
+			nii_saveStats(&opts);
 			return ret;
+		}
 	}
+	nii_saveStats(&opts);
 
 	if (opts.onlySearchDirForDICOM == 0) {
 #if !defined(_WIN64) && !defined(_WIN32)
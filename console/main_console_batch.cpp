@@ -11,16 +11,24 @@
 #endif
 #else
 #include <unistd.h> //access()
+#define myEnableBatchJobs // entries can run concurrently in child processes
+#include <sys/resource.h> // wait4()
+#include <sys/wait.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
 #endif
 #include "nii_dicom.h"
 #include "nii_dicom_batch.h"
+#include <chrono>
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <set>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
-#include <time.h> // clock_t, clock, CLOCKS_PER_SEC
+#include <vector>
 #include <yaml-cpp/yaml.h>
 
 const char *removePath(const char *path) { // "/usr/path/filename.exe" -> "filename.exe"
@@ -33,16 +41,193 @@ const char *removePath(const char *path) { // "/usr/path/filename.exe" -> "filen
 	return path;
 } // removePath()
 
+struct TBatchEntry {
+	std::string indir, outdir, filename, key;
+	const char *status;
+	int exitCode;
+	double seconds, peakRssMB;
+	std::chrono::steady_clock::time_point start;
+#ifdef myEnableBatchJobs
+	pid_t pid;
+#endif
+};
+
+static double wallSeconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+} // wallSeconds()
+
 int rmainbatch(TDCMopts opts) {
-	clock_t start = clock();
-	nii_loadDir(&opts);
-	printf("Conversion required %f seconds.\n", ((float)(clock() - start)) / CLOCKS_PER_SEC);
-	return EXIT_SUCCESS;
+	// each entry receives its own copy of opts, so settings can not leak between entries
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int ret = nii_loadDir(&opts);
+	printf("Conversion required %f seconds.\n", wallSeconds(start));
+	return ret;
 } // rmainbatch()
 
+static void batchFinished(struct TBatchEntry *e, int exitCode, FILE *resumeFile) {
+	e->exitCode = exitCode;
+	e->seconds = wallSeconds(e->start);
+	e->status = (exitCode == EXIT_SUCCESS) ? "converted" : "failed";
+	if ((exitCode != EXIT_SUCCESS) || (resumeFile == NULL))
+		return;
+	fprintf(resumeFile, "%s\n", e->key.c_str()); // flush at once: the state must survive a crash
+	fflush(resumeFile);
+} // batchFinished()
+
+#ifdef myEnableBatchJobs
+static double childRssMB(pid_t pid) { // current resident memory of a running child, 0 if unknown
+#if defined(__linux) || defined(__linux__)
+	char fname[64];
+	snprintf(fname, sizeof(fname), "/proc/%d/statm", (int)pid);
+	FILE *fp = fopen(fname, "r");
+	if (fp == NULL)
+		return 0.0;
+	long pages = 0, resident = 0;
+	if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+	return (double)resident * (double)sysconf(_SC_PAGESIZE) / 1048576.0;
+#else
+	return 0.0;
+#endif
+} // childRssMB()
+
+static bool batchReap(std::vector<TBatchEntry> &entries, bool isBlocking, FILE *resumeFile) {
+	// collect one finished child, returns false if none has finished
+	int status = 0;
+	struct rusage usage;
+	pid_t pid = wait4(-1, &status, isBlocking ? 0 : WNOHANG, &usage);
+	if (pid <= 0)
+		return false;
+	for (size_t i = 0; i < entries.size(); i++) {
+		struct TBatchEntry *e = &entries[i];
+		if (e->pid != pid)
+			continue;
+		e->pid = 0;
+		int exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+		batchFinished(e, exitCode, resumeFile);
+		if (WIFSIGNALED(status)) {
+			e->status = "crashed";
+			printf("Error: conversion of %s terminated by signal %d\n", e->indir.c_str(), WTERMSIG(status));
+		}
+#ifdef __APPLE__
+		e->peakRssMB = (double)usage.ru_maxrss / 1048576.0; // bytes
+#else
+		e->peakRssMB = (double)usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+		break;
+	}
+	return true;
+} // batchReap()
+
+static void batchRunJobs(std::vector<TBatchEntry> &entries, TDCMopts opts, int nJobs, double maxRssMB, FILE *resumeFile) {
+	// run up to nJobs entries at once, only starting another while running children use less than maxRssMB
+#ifdef _OPENMP
+	int nThreads = omp_get_max_threads() / nJobs; // children share the thread budget (OMP_NUM_THREADS or CPU count)
+	if (nThreads < 1)
+		nThreads = 1;
+#endif
+	int nRunning = 0;
+	size_t next = 0;
+	while ((next < entries.size()) || (nRunning > 0)) {
+		while ((next < entries.size()) && (entries[next].status != NULL))
+			next++; // skip entries completed by a previous run
+		bool isLaunch = (next < entries.size()) && (nRunning < nJobs);
+		if ((isLaunch) && (nRunning > 0) && (maxRssMB > 0.0)) {
+			double rss = 0.0;
+			for (size_t i = 0; i < entries.size(); i++)
+				if (entries[i].pid > 0)
+					rss += childRssMB(entries[i].pid);
+			isLaunch = (rss < maxRssMB);
+		}
+		if (isLaunch) {
+			struct TBatchEntry *e = &entries[next];
+			strcpy(opts.indir, e->indir.c_str());
+			strcpy(opts.outdir, e->outdir.c_str());
+			strcpy(opts.filename, e->filename.c_str());
+			fflush(stdout); // do not let children inherit buffered output
+			e->start = std::chrono::steady_clock::now();
+			pid_t pid = fork();
+			if (pid == 0) {
+#ifdef _OPENMP
+				omp_set_num_threads(nThreads);
+#endif
+				int ret = rmainbatch(opts);
+				fflush(stdout); // _exit() does not flush stdio buffers
+				fflush(stderr);
+				_exit(ret);
+			}
+			if (pid < 0) {
+				printf("Error: unable to start conversion of %s\n", e->indir.c_str());
+				batchFinished(e, EXIT_FAILURE, NULL);
+			} else {
+				e->pid = pid;
+				nRunning++;
+			}
+			next++;
+			continue;
+		}
+		if (nRunning < 1)
+			break;
+		bool isMemoryBound = (next < entries.size()) && (nRunning < nJobs);
+		if (batchReap(entries, !isMemoryBound, resumeFile))
+			nRunning--;
+		else
+			usleep(100000); // wait for memory use to drop or a child to finish
+	}
+} // batchRunJobs()
+#endif // myEnableBatchJobs
+
+static void jsonBatchStr(FILE *fp, const char *label, const std::string &str) {
+	fprintf(fp, "\"%s\": \"", label);
+	for (size_t i = 0; i < str.size(); i++) {
+		unsigned char c = (unsigned char)str[i];
+		if ((c == '"') || (c == '\\'))
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fprintf(fp, "\", ");
+} // jsonBatchStr()
+
+static int saveBatchSummary(const char *fname, std::vector<TBatchEntry> &entries, int nJobs, double seconds) {
+	FILE *fp = fopen(fname, "w");
+	if (fp == NULL) {
+		printf("Error: unable to write summary %s\n", fname);
+		return EXIT_FAILURE;
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"ConversionSoftwareVersion\": \"%s\",\n", kDCMdate);
+	fprintf(fp, "\t\"Jobs\": %d,\n", nJobs);
+	fprintf(fp, "\t\"WallSeconds\": %g,\n", seconds);
+	fprintf(fp, "\t\"Entries\": [");
+	for (size_t i = 0; i < entries.size(); i++) {
+		struct TBatchEntry *e = &entries[i];
+		fprintf(fp, "%s\n\t\t{", (i > 0) ? "," : "");
+		jsonBatchStr(fp, "InDir", e->indir);
+		jsonBatchStr(fp, "OutDir", e->outdir);
+		jsonBatchStr(fp, "Filename", e->filename);
+		fprintf(fp, "\"Status\": \"%s\", \"ExitCode\": %d, \"WallSeconds\": %g, \"PeakRSSMB\": %g}", e->status ? e->status : "not run", e->exitCode, e->seconds, e->peakRssMB);
+	}
+	fprintf(fp, "\n\t]\n");
+	fprintf(fp, "}\n");
+	fclose(fp);
+	return EXIT_SUCCESS;
+} // saveBatchSummary()
+
 void showHelp(const char *argv[]) {
 	const char *cstr = removePath(argv[0]);
-	printf("Usage: %s <batch_config.yml>\n", cstr);
+	printf("Usage: %s [options] <batch_config.yml>\n", cstr);
+	printf("\n");
+	printf("Options :\n");
+#ifdef myEnableBatchJobs
+	printf(" --jobs <n>         : number of entries converted concurrently, each with 1/n of the threads (default 1)\n");
+	printf(" --max-rss <MB>     : do not start another entry while running entries use this much memory (default 0: no limit)\n");
+#endif
+	printf(" --summary <file>   : write JSON report of status and wall time for each entry\n");
+	printf(" --resume <file>    : record completed entries in file and skip them on the next run\n");
 	printf("\n");
 	printf("The configuration file must be in yaml format as shown below\n");
 	printf("\n");
@@ -85,23 +270,43 @@ int main(int argc, const char *argv[]) {
 #define kOS "Windows"
 #endif
 	printf("dcm2niibatch using Chris Rorden's dcm2niiX version %s (%llu-bit %s)\n", kDCMvers, (unsigned long long)sizeof(size_t) * 8, kOS);
-	if (argc != 2) {
-		if (argc < 2)
-			printf(" Please provide location of config file\n");
-		else
+	int nJobs = 1;
+	double maxRssMB = 0.0;
+	const char *configName = NULL;
+	const char *summaryName = NULL;
+	const char *resumeName = NULL;
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "--jobs") == 0) && (i < (argc - 1)))
+			nJobs = atoi(argv[++i]);
+		else if ((strcmp(argv[i], "--max-rss") == 0) && (i < (argc - 1)))
+			maxRssMB = atof(argv[++i]);
+		else if ((strcmp(argv[i], "--summary") == 0) && (i < (argc - 1)))
+			summaryName = argv[++i];
+		else if ((strcmp(argv[i], "--resume") == 0) && (i < (argc - 1)))
+			resumeName = argv[++i];
+		else if ((argv[i][0] == '-') || (configName != NULL)) {
 			printf(" Do not include additional inputs with a config file\n");
-		printf("\n");
-		showHelp(argv);
-		return EXIT_FAILURE;
+			printf("\n");
+			showHelp(argv);
+			return EXIT_FAILURE;
+		} else
+			configName = argv[i];
 	}
-	if (access(argv[1], F_OK) == -1) {
+	if ((configName == NULL) || (access(configName, F_OK) == -1)) {
 		printf(" Please provide location of config file\n");
 		printf("\n");
 		showHelp(argv);
 		return EXIT_FAILURE;
 	}
+#ifndef myEnableBatchJobs
+	if (nJobs > 1)
+		printf("Warning: --jobs not supported on this platform, entries will be converted in sequence\n");
+	nJobs = 1;
+#endif
+	if (nJobs < 1)
+		nJobs = 1;
 	// Process it all via a yaml file
-	std::string yaml_file = argv[1];
+	std::string yaml_file = configName;
 	std::cout << "yaml_path: " << yaml_file << std::endl;
 	YAML::Node config = YAML::LoadFile(yaml_file);
 	struct TDCMopts opts;
@@ -117,14 +322,70 @@ int main(int argc, const char *argv[]) {
 		strcpy(opts.pigzname, "”); //do NOT use pigz: force internal compressor
 		//in general, pigz is faster unless you have a very slow network, in which case the internal compressor is better
 	}*/
+	std::vector<TBatchEntry> entries;
 	for (auto i : config["Files"]) {
-		std::string indir = i["in_dir"].as<std::string>();
-		strcpy(opts.indir, indir.c_str());
-		std::string outdir = i["out_dir"].as<std::string>();
-		strcpy(opts.outdir, outdir.c_str());
-		std::string filename = i["filename"].as<std::string>();
-		strcpy(opts.filename, filename.c_str());
-		rmainbatch(opts);
+		struct TBatchEntry e;
+		e.indir = i["in_dir"].as<std::string>();
+		e.outdir = i["out_dir"].as<std::string>();
+		e.filename = i["filename"].as<std::string>();
+		if ((e.indir.size() >= kOptsStr) || (e.outdir.size() >= kOptsStr) || (e.filename.size() >= kOptsStr)) {
+			printf("Error: path too long in %s\n", yaml_file.c_str());
+			return EXIT_FAILURE;
+		}
+		e.key = e.indir + "\t" + e.outdir + "\t" + e.filename;
+		e.status = NULL;
+		e.exitCode = EXIT_SUCCESS;
+		e.seconds = 0.0;
+		e.peakRssMB = 0.0;
+#ifdef myEnableBatchJobs
+		e.pid = 0;
+#endif
+		entries.push_back(e);
 	}
-	return EXIT_SUCCESS;
+	// resume: entries listed in the state file were completed by an earlier run
+	FILE *resumeFile = NULL;
+	if (resumeName != NULL) {
+		std::set<std::string> done;
+		std::ifstream state(resumeName);
+		std::string line;
+		while (std::getline(state, line))
+			done.insert(line);
+		int nSkip = 0;
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (done.count(entries[i].key) < 1)
+				continue;
+			entries[i].status = "skipped";
+			nSkip++;
+		}
+		if (nSkip > 0)
+			printf("Skipping %d of %d entries completed previously (%s)\n", nSkip, (int)entries.size(), resumeName);
+		resumeFile = fopen(resumeName, "a");
+		if (resumeFile == NULL)
+			printf("Warning: unable to update %s\n", resumeName);
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#ifdef myEnableBatchJobs
+	if (nJobs > 1)
+		batchRunJobs(entries, opts, nJobs, maxRssMB, resumeFile);
+	else
+#endif
+		for (size_t i = 0; i < entries.size(); i++) {
+			struct TBatchEntry *e = &entries[i];
+			if (e->status != NULL)
+				continue;
+			strcpy(opts.indir, e->indir.c_str());
+			strcpy(opts.outdir, e->outdir.c_str());
+			strcpy(opts.filename, e->filename.c_str());
+			e->start = std::chrono::steady_clock::now();
+			batchFinished(e, rmainbatch(opts), resumeFile);
+		}
+	if (resumeFile != NULL)
+		fclose(resumeFile);
+	int ret = EXIT_SUCCESS;
+	for (size_t i = 0; i < entries.size(); i++)
+		if (entries[i].exitCode != EXIT_SUCCESS)
+			ret = EXIT_FAILURE;
+	if (summaryName != NULL)
+		saveBatchSummary(summaryName, entries, nJobs, wallSeconds(start));
+	return ret;
 } // main()
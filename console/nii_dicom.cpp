@@ -19,6 +19,10 @@
 #else
 #include <unistd.h>
 #endif
+#if !defined(_WIN64) && !defined(_WIN32)
+#define myEnableMmap // gather uncompressed slices straight from a memory map of the file
+#include <sys/mman.h>
+#endif
 // #include <time.h> //clock()
 #ifndef USING_R
 #include "nifti1.h"
@@ -46,6 +50,147 @@
 #define isnan ISNAN
 #endif
 
+#ifdef myEnableByteSource
+// registry of DICOM objects that live in memory (or behind a user read callback) rather than on disk:
+//  nii_fopen() returns a stdio stream for these so header parsing and all pixel decoders work unchanged
+static struct TByteSource *byteSources = NULL;
+static int nByteSources = 0;
+
+int compareByteSource(const void *a, const void *b) {
+	return strcmp(((struct TByteSource *)a)->name, ((struct TByteSource *)b)->name);
+} // compareByteSource()
+
+void nii_clearByteSources(void) {
+	if (byteSources != NULL)
+		free(byteSources);
+	byteSources = NULL;
+	nByteSources = 0;
+} // nii_clearByteSources()
+
+int nii_setByteSources(struct TByteSource *sources, int nSources) {
+	nii_clearByteSources();
+	if (nSources < 1)
+		return EXIT_SUCCESS;
+	for (int i = 0; i < nSources; i++) {
+		if ((sources[i].name == NULL) || (strlen(sources[i].name) < 1) || ((sources[i].buffer == NULL) && (sources[i].readFunc == NULL))) {
+			printError("Byte source %d requires a name and either a buffer or a read function\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	byteSources = (struct TByteSource *)malloc(nSources * sizeof(struct TByteSource));
+	memcpy(byteSources, sources, nSources * sizeof(struct TByteSource));
+	qsort(byteSources, nSources, sizeof(struct TByteSource), compareByteSource); // names are looked up with bsearch
+	for (int i = 1; i < nSources; i++) {
+		if (strcmp(byteSources[i - 1].name, byteSources[i].name) == 0) {
+			printError("Byte source name is not unique: %s\n", byteSources[i].name);
+			nii_clearByteSources();
+			return EXIT_FAILURE;
+		}
+	}
+	nByteSources = nSources;
+	return EXIT_SUCCESS;
+} // nii_setByteSources()
+
+struct TByteSourceFile {
+	struct TByteSource *src;
+	uint64_t pos;
+};
+
+#ifdef __GLIBC__
+typedef off64_t TCookieOff;
+#else
+typedef off_t TCookieOff;
+#endif
+
+size_t byteSourceReadCore(struct TByteSourceFile *f, char *buf, size_t size) {
+	if (f->pos >= f->src->bytes)
+		return 0;
+	size_t n = size;
+	if ((uint64_t)n > (f->src->bytes - f->pos))
+		n = (size_t)(f->src->bytes - f->pos);
+	if (f->src->buffer != NULL)
+		memcpy(buf, f->src->buffer + f->pos, n);
+	else
+		n = f->src->readFunc(f->src->user, f->pos, buf, n);
+	f->pos += n;
+	return n;
+} // byteSourceReadCore()
+
+int byteSourceSeekCore(struct TByteSourceFile *f, int64_t *offset, int whence) {
+	int64_t pos = *offset;
+	if (whence == SEEK_CUR)
+		pos += (int64_t)f->pos;
+	else if (whence == SEEK_END)
+		pos += (int64_t)f->src->bytes;
+	if (pos < 0)
+		return -1;
+	f->pos = (uint64_t)pos;
+	*offset = pos;
+	return 0;
+} // byteSourceSeekCore()
+
+int byteSourceClose(void *cookie) {
+	free(cookie);
+	return 0;
+} // byteSourceClose()
+
+#ifdef __APPLE__
+int byteSourceRead(void *cookie, char *buf, int size) {
+	return (int)byteSourceReadCore((struct TByteSourceFile *)cookie, buf, (size_t)size);
+}
+
+fpos_t byteSourceSeek(void *cookie, fpos_t offset, int whence) {
+	int64_t pos = offset;
+	if (byteSourceSeekCore((struct TByteSourceFile *)cookie, &pos, whence) != 0)
+		return -1;
+	return pos;
+}
+#else
+ssize_t byteSourceRead(void *cookie, char *buf, size_t size) {
+	return (ssize_t)byteSourceReadCore((struct TByteSourceFile *)cookie, buf, size);
+}
+
+int byteSourceSeek(void *cookie, TCookieOff *offset, int whence) {
+	int64_t pos = *offset;
+	if (byteSourceSeekCore((struct TByteSourceFile *)cookie, &pos, whence) != 0)
+		return -1;
+	*offset = pos;
+	return 0;
+}
+#endif
+#endif // myEnableByteSource
+
+FILE *nii_fopen(const char *fname, const char *mode) {
+#ifdef myEnableByteSource
+	if ((nByteSources > 0) && (fname != NULL)) {
+		struct TByteSource key;
+		key.name = fname;
+		struct TByteSource *src = (struct TByteSource *)bsearch(&key, byteSources, nByteSources, sizeof(struct TByteSource), compareByteSource);
+		if (src != NULL) {
+			if (mode[0] != 'r')
+				return NULL; // byte sources are read only
+			struct TByteSourceFile *f = (struct TByteSourceFile *)malloc(sizeof(struct TByteSourceFile));
+			f->src = src;
+			f->pos = 0;
+#ifdef __APPLE__
+			FILE *fp = funopen(f, byteSourceRead, NULL, byteSourceSeek, byteSourceClose);
+#else
+			cookie_io_functions_t io = {byteSourceRead, NULL, byteSourceSeek, byteSourceClose};
+			FILE *fp = fopencookie(f, "r", io);
+#endif
+			if (fp == NULL) {
+				free(f);
+				return NULL;
+			}
+			if (src->buffer != NULL)
+				setvbuf(fp, NULL, _IONBF, 0); // memory is already random access: avoid copying through a stdio buffer
+			return fp;
+		}
+	}
+#endif
+	return fopen(fname, mode);
+} // nii_fopen()
+
 #ifndef myDisableClassicJPEG
 #ifdef myTurboJPEG
 #include <turbojpeg.h>
@@ -63,14 +208,18 @@
 ERROR : YOU CAN NOT COMPILE WITH myEnableJasper AND NOT myDisableOpenJPEG OPTIONS SET SIMULTANEOUSLY
 #endif
 
-		unsigned char *
-		imagetoimg(opj_image_t *image) {
+#if defined(OPJ_VERSION_MAJOR) && ((OPJ_VERSION_MAJOR > 2) || ((OPJ_VERSION_MAJOR == 2) && (OPJ_VERSION_MINOR >= 3)))
+#define myOpenJPEGthreads // opj_codec_set_threads(), opj_get_num_cpus(), opj_image_data_free()
+#endif
+
+// copy decoded component planes to the image in its final type, releasing each plane once copied (OpenJPEG >= 2.3)
+// n.b. Analyze rgb-24 are PLANAR e.g. RRR..RGGG..GBBB..B not RGBRGBRGB...RGB
+bool imagetoimg(opj_image_t *image, unsigned char *img, struct nifti_1_header hdr) {
 	int numcmpts = image->numcomps;
 	int sgnd = image->comps[0].sgnd;
 	int width = image->comps[0].w;
 	int height = image->comps[0].h;
 	int bpp = (image->comps[0].prec + 7) >> 3; // e.g. 12 bits requires 2 bytes
-	int imgbytes = bpp * width * height * numcmpts;
 	bool isOK = true;
 	if (numcmpts > 1) {
 		for (int comp = 1; comp < numcmpts; comp++) { // check RGB data
@@ -96,155 +245,145 @@ ERROR : YOU CAN NOT COMPILE WITH myEnableJasper AND NOT myDisableOpenJPEG OPTION
 		isOK = false; // currently we only handle 1 and 2 byte data
 	if (!isOK) {
 		printMessage("jpeg decode failure w*h %d*%d bpp %d sgnd %d components %d OpenJPEG=%s\n", width, height, bpp, sgnd, numcmpts, opj_version());
-		return NULL;
+		return false;
 	}
 #ifdef MY_DEBUG
 	printMessage("w*h %d*%d bpp %d sgnd %d components %d OpenJPEG=%s\n", width, height, bpp, sgnd, numcmpts, opj_version());
 #endif
-	// extract the data
-	if ((bpp < 1) || (bpp > 2) || (width < 1) || (height < 1) || (imgbytes < 1)) {
+	if ((bpp < 1) || (bpp > 2) || (width < 1) || (height < 1)) {
 		printError("Catastrophic decompression error\n");
-		return NULL;
+		return false;
 	}
-	unsigned char *img = (unsigned char *)malloc(imgbytes);
-	uint16_t *img16ui = (uint16_t *)img; // unsigned 16-bit
-	int16_t *img16i = (int16_t *)img;	 // signed 16-bit
-	if (sgnd)
-		bpp = -bpp;
-	if (bpp == -1) {
-		free(img);
+	if ((width != hdr.dim[1]) || (height != hdr.dim[2]) || ((size_t)bpp * numcmpts * 8 != (size_t)hdr.bitpix)) {
+		printError("JPEG2000 image %d*%d*%d bytes does not match DICOM header %d*%d*%d bits\n", width, height, bpp * numcmpts, hdr.dim[1], hdr.dim[2], hdr.bitpix);
+		return false;
+	}
+	if ((sgnd) && (bpp == 1)) {
 		printError("Signed 8-bit DICOM?\n");
-		return NULL;
+		return false;
 	}
-	// n.b. Analyze rgb-24 are PLANAR e.g. RRR..RGGG..GBBB..B not RGBRGBRGB...RGB
-	int pix = 0; // output pixel
+	size_t nPix = (size_t)width * (size_t)height;
 	for (int cmptno = 0; cmptno < numcmpts; ++cmptno) {
-		int cpix = 0; // component pixel
-		int *v = image->comps[cmptno].data;
-		for (int y = 0; y < height; ++y) {
-			for (int x = 0; x < width; ++x) {
-				switch (bpp) {
-				case 1:
-					img[pix] = (unsigned char)v[cpix];
-					break;
-				case 2:
-					img16ui[pix] = (uint16_t)v[cpix];
-					break;
-				case -2:
-					img16i[pix] = (int16_t)v[cpix];
-					break;
-				}
-				pix++;
-				cpix++;
-			} // for x
-		} // for y
+		const int *v = image->comps[cmptno].data;
+		if (bpp == 1) {
+			unsigned char *o = img + (cmptno * nPix);
+			for (size_t i = 0; i < nPix; i++)
+				o[i] = (unsigned char)v[i];
+		} else if (sgnd) {
+			int16_t *o = (int16_t *)img + (cmptno * nPix);
+			for (size_t i = 0; i < nPix; i++)
+				o[i] = (int16_t)v[i];
+		} else {
+			uint16_t *o = (uint16_t *)img + (cmptno * nPix);
+			for (size_t i = 0; i < nPix; i++)
+				o[i] = (uint16_t)v[i];
+		}
+#ifdef myOpenJPEGthreads
+		opj_image_data_free(image->comps[cmptno].data);
+		image->comps[cmptno].data = NULL; // opj_image_destroy() skips released planes
+#endif
 	} // for each component
-	return img;
+	return true;
 } // imagetoimg()
 
-typedef struct bufinfo {
-	unsigned char *buf;
-	unsigned char *cur;
-	size_t len;
-} BufInfo;
-
-static void my_stream_free(void *p_user_data) { // do nothing
-												// BufInfo d = (BufInfo) p_user_data;
-												// free(d.buf);
-} // my_stream_free()
-
-static OPJ_UINT32 opj_read_from_buffer(void *p_buffer, OPJ_UINT32 p_nb_bytes, BufInfo *p_file) {
-	OPJ_UINT32 l_nb_read;
-	if (p_file->cur + p_nb_bytes < p_file->buf + p_file->len) {
-		l_nb_read = p_nb_bytes;
-	} else {
-		l_nb_read = (OPJ_UINT32)(p_file->buf + p_file->len - p_file->cur);
-	}
-	memcpy(p_buffer, p_file->cur, l_nb_read);
-	p_file->cur += l_nb_read;
+// OpenJPEG reads the codestream directly from the DICOM file: no copy of the compressed data is held in memory
+typedef struct j2kfileinfo {
+	FILE *fp;
+	long start; // offset of codestream in file
+	OPJ_UINT64 len, pos;
+} J2KFileInfo;
+
+static void opj_free_from_file(void *p_user_data) { // do nothing: caller closes file
+} // opj_free_from_file()
+
+static OPJ_SIZE_T opj_read_from_file(void *p_buffer, OPJ_SIZE_T p_nb_bytes, void *p_user_data) {
+	J2KFileInfo *p_file = (J2KFileInfo *)p_user_data;
+	if (p_file->pos >= p_file->len)
+		return (OPJ_SIZE_T)-1;
+	if (p_nb_bytes > p_file->len - p_file->pos)
+		p_nb_bytes = (OPJ_SIZE_T)(p_file->len - p_file->pos);
+	OPJ_SIZE_T l_nb_read = fread(p_buffer, 1, p_nb_bytes, p_file->fp);
+	p_file->pos += l_nb_read;
+	return l_nb_read ? l_nb_read : ((OPJ_SIZE_T)-1);
+} // opj_read_from_file()
 
-	return l_nb_read ? l_nb_read : ((OPJ_UINT32)-1);
-} // opj_read_from_buffer()
-
-static OPJ_UINT32 opj_write_from_buffer(void *p_buffer, OPJ_UINT32 p_nb_bytes, BufInfo *p_file) {
-	memcpy(p_file->cur, p_buffer, p_nb_bytes);
-	p_file->cur += p_nb_bytes;
-	p_file->len += p_nb_bytes;
-	return p_nb_bytes;
-} // opj_write_from_buffer()
-
-static OPJ_SIZE_T opj_skip_from_buffer(OPJ_SIZE_T p_nb_bytes, BufInfo *p_file) {
-	if (p_file->cur + p_nb_bytes < p_file->buf + p_file->len) {
-		p_file->cur += p_nb_bytes;
+// fix for https://github.com/neurolabusc/dcm_qa/issues/5
+static OPJ_BOOL opj_seek_from_file(OPJ_OFF_T p_nb_bytes, void *p_user_data) {
+	J2KFileInfo *p_file = (J2KFileInfo *)p_user_data;
+	bool isOK = (p_nb_bytes >= 0) && ((OPJ_UINT64)p_nb_bytes < p_file->len);
+	p_file->pos = isOK ? (OPJ_UINT64)p_nb_bytes : p_file->len;
+	fseek(p_file->fp, p_file->start + (long)p_file->pos, SEEK_SET);
+	return isOK ? OPJ_TRUE : OPJ_FALSE;
+} // opj_seek_from_file()
+
+static OPJ_OFF_T opj_skip_from_file(OPJ_OFF_T p_nb_bytes, void *p_user_data) {
+	J2KFileInfo *p_file = (J2KFileInfo *)p_user_data;
+	OPJ_OFF_T l_pos = (OPJ_OFF_T)p_file->pos + p_nb_bytes;
+	if ((l_pos >= 0) && ((OPJ_UINT64)l_pos < p_file->len)) {
+		opj_seek_from_file(l_pos, p_user_data);
 		return p_nb_bytes;
 	}
-	p_file->cur = p_file->buf + p_file->len;
-	return (OPJ_SIZE_T)-1;
-} // opj_skip_from_buffer()
+	opj_seek_from_file((OPJ_OFF_T)p_file->len, p_user_data);
+	return (OPJ_OFF_T)-1;
+} // opj_skip_from_file()
 
-// fix for https://github.com/neurolabusc/dcm_qa/issues/5
-static OPJ_BOOL opj_seek_from_buffer(OPJ_SIZE_T p_nb_bytes, BufInfo *p_file) {
-	// printf("opj_seek_from_buffer %d + %d -> %d + %d\n", p_file->cur , p_nb_bytes, p_file->buf, p_file->len);
-	if (p_nb_bytes < p_file->len) {
-		p_file->cur = p_file->buf + p_nb_bytes;
-		return OPJ_TRUE;
-	}
-	p_file->cur = p_file->buf + p_file->len;
-	return OPJ_FALSE;
-} // opj_seek_from_buffer()
-
-opj_stream_t *opj_stream_create_buffer_stream(BufInfo *p_file, OPJ_UINT32 p_size, OPJ_BOOL p_is_read_stream) {
-	opj_stream_t *l_stream;
-	if (!p_file)
-		return NULL;
-	l_stream = opj_stream_create(p_size, p_is_read_stream);
+opj_stream_t *opj_stream_create_file_stream(J2KFileInfo *p_file) {
+	opj_stream_t *l_stream = opj_stream_create(OPJ_J2K_STREAM_CHUNK_SIZE, OPJ_TRUE);
 	if (!l_stream)
 		return NULL;
-	opj_stream_set_user_data(l_stream, p_file, my_stream_free);
+	opj_stream_set_user_data(l_stream, p_file, opj_free_from_file);
 	opj_stream_set_user_data_length(l_stream, p_file->len);
-	opj_stream_set_read_function(l_stream, (opj_stream_read_fn)opj_read_from_buffer);
-	opj_stream_set_write_function(l_stream, (opj_stream_write_fn)opj_write_from_buffer);
-	opj_stream_set_skip_function(l_stream, (opj_stream_skip_fn)opj_skip_from_buffer);
-	opj_stream_set_seek_function(l_stream, (opj_stream_seek_fn)opj_seek_from_buffer);
+	opj_stream_set_read_function(l_stream, opj_read_from_file);
+	opj_stream_set_skip_function(l_stream, opj_skip_from_file);
+	opj_stream_set_seek_function(l_stream, opj_seek_from_file);
 	return l_stream;
-} // opj_stream_create_buffer_stream()
+} // opj_stream_create_file_stream()
 
 unsigned char *nii_loadImgCoreOpenJPEG(char *imgname, struct nifti_1_header hdr, struct TDICOMdata dcm, int compressFlag) {
 	// OpenJPEG library is not well documented and has changed between versions
 	// Since the JPEG is embedded in a DICOM we need to skip bytes at the start of the file
 	//  In theory we might also want to strip data that exists AFTER the image, see gdcmJPEG2000Codec.c
+	// dcm.j2kReduce > 0 decodes a lower resolution level: readDICOMx() has already reduced the header dimensions
 	unsigned char *ret = NULL;
 	opj_dparameters_t params;
 	opj_codec_t *codec;
 	opj_image_t *jpx;
 	opj_stream_t *stream;
-	FILE *reader = fopen(imgname, "rb");
+	FILE *reader = nii_fopen(imgname, "rb");
+	if (reader == NULL)
+		return NULL;
 	fseek(reader, 0, SEEK_END);
 	long size = ftell(reader) - dcm.imageStart;
-	if (size <= 8)
-		return NULL;
+	unsigned char sig[4];
 	fseek(reader, dcm.imageStart, SEEK_SET);
-	unsigned char *data = (unsigned char *)malloc(size);
-	size_t sz = fread(data, 1, size, reader);
-	fclose(reader);
-	if (sz < size)
+	if ((size <= 8) || (fread(sig, 1, 4, reader) != 4)) {
+		fclose(reader);
 		return NULL;
+	}
 	OPJ_CODEC_FORMAT format = OPJ_CODEC_JP2;
 	// DICOM JPEG2k is SUPPOSED to start with codestream, but some vendors include a header
-	if (data[0] == 0xFF && data[1] == 0x4F && data[2] == 0xFF && data[3] == 0x51)
+	if (sig[0] == 0xFF && sig[1] == 0x4F && sig[2] == 0xFF && sig[3] == 0x51)
 		format = OPJ_CODEC_J2K;
 	opj_set_default_decoder_parameters(&params);
-	BufInfo dx;
-	dx.buf = data;
-	dx.cur = data;
-	dx.len = size;
-	stream = opj_stream_create_buffer_stream(&dx, (OPJ_UINT32)size, true);
-	if (stream == NULL)
+	params.cp_reduce = dcm.j2kReduce;
+	J2KFileInfo fx;
+	fx.fp = reader;
+	fx.start = dcm.imageStart;
+	fx.len = size;
+	fx.pos = 0;
+	fseek(reader, dcm.imageStart, SEEK_SET);
+	stream = opj_stream_create_file_stream(&fx);
+	if (stream == NULL) {
+		fclose(reader);
 		return NULL;
+	}
 	codec = opj_create_decompress(format);
 	// setup the decoder decoding parameters using user parameters
 	if (!opj_setup_decoder(codec, &params))
 		goto cleanup2;
+#ifdef myOpenJPEGthreads
+	opj_codec_set_threads(codec, (dcm.j2kThreads > 0) ? dcm.j2kThreads : opj_get_num_cpus()); // tiles and code-blocks decoded in parallel
+#endif
 	// Read the main header of the codestream and if necessary the JP2 boxes
 	if (!opj_read_header(stream, codec, &jpx)) {
 		printError("OpenJPEG failed to read the header %s (offset %d)\n", imgname, dcm.imageStart);
@@ -260,15 +399,21 @@ unsigned char *nii_loadImgCoreOpenJPEG(char *imgname, struct nifti_1_header hdr,
 	// Get the decoded image
 	if (!(opj_decode(codec, stream, jpx) && opj_end_decompress(codec, stream))) {
 		printError("OpenJPEG j2k_to_image failed to decode %s\n", imgname);
+		if (dcm.j2kReduce > 0)
+			printError("Reduce factor %d may exceed the resolution levels of this image\n", dcm.j2kReduce);
 		goto cleanup1;
 	}
-	ret = imagetoimg(jpx);
+	ret = (unsigned char *)malloc((hdr.bitpix / 8) * (size_t)hdr.dim[1] * (size_t)hdr.dim[2]);
+	if (!imagetoimg(jpx, ret, hdr)) {
+		free(ret);
+		ret = NULL;
+	}
 cleanup1:
 	opj_image_destroy(jpx);
 cleanup2:
-	free(dx.buf);
 	opj_stream_destroy(stream);
 	opj_destroy_codec(codec);
+	fclose(reader);
 	return ret;
 }
 #endif // myDisableOpenJPEG
@@ -762,6 +907,7 @@ struct TDICOMdata clear_dicom_data() {
 		d.orient[i] = 0.0f;
 	strcpy(d.patientName, "");
 	strcpy(d.deidentificationMethod, "");
+	d.deID_CS_n = 0; // ECAT and PAR/REC headers never set this
 	strcpy(d.patientID, "");
 	strcpy(d.accessionNumber, "");
 	strcpy(d.imageType, "");
@@ -927,6 +1073,8 @@ struct TDICOMdata clear_dicom_data() {
 	d.isNonParallelSlices = false;
 	d.isCoilVaries = false;
 	d.compressionScheme = 0; // none
+	d.j2kReduce = 0; // full resolution
+	d.j2kThreads = 0; // all CPUs
 	d.isExplicitVR = true;
 	d.isLittleEndian = true; // DICOM initially always little endian
 	d.converted2NII = 0;
@@ -1052,10 +1200,65 @@ uint32_t mz_crc32X(unsigned char *ptr, size_t buf_len) {
 	return ~crcu32;
 }
 
+// Header parsing scratch memory: each thread keeps a small bump arena for the short-lived strings
+// decoded from individual tags, plus a reusable buffer for header segments, so readDICOMx does not
+// call malloc/free for every tag and every file. Arena blocks must be released in reverse order;
+// requests that do not fit in the arena fall back to the heap.
+#define kScratchArenaBytes 65536
+#define kScratchHeaderBytes 1000001
+struct TScratch {
+	unsigned char *arena, *header;
+	size_t arenaUsed;
+	~TScratch() {
+		free(arena);
+		free(header);
+	}
+};
+static thread_local struct TScratch scratch;
+
+static char *scratchAlloc(size_t bytes) {
+	if (!scratch.arena)
+		scratch.arena = (unsigned char *)malloc(kScratchArenaBytes);
+	size_t need = (bytes + 7) & ~(size_t)7; // keep 8-byte alignment
+	if ((scratch.arena) && (need <= (kScratchArenaBytes - scratch.arenaUsed))) {
+		char *ret = (char *)scratch.arena + scratch.arenaUsed;
+		scratch.arenaUsed += need;
+		return ret;
+	}
+	return (char *)malloc(bytes);
+} // scratchAlloc()
+
+static void scratchFree(void *ptr) { // releases ptr and any arena block allocated after it
+	uintptr_t p = (uintptr_t)ptr;
+	uintptr_t a = (uintptr_t)scratch.arena;
+	if ((scratch.arena) && (p >= a) && (p < (a + kScratchArenaBytes))) {
+		scratch.arenaUsed = (size_t)(p - a);
+		return;
+	}
+	free(ptr);
+} // scratchFree()
+
+static void scratchReset() { // start of a new file: nothing allocated from the arena is still live
+	scratch.arenaUsed = 0;
+} // scratchReset()
+
+static unsigned char *scratchHeader(size_t bytes) { // reusable per-thread buffer for header segments
+	if (bytes > kScratchHeaderBytes)
+		return (unsigned char *)malloc(bytes); // e.g. myLoadWholeFileToReadHeader: do not retain
+	if (!scratch.header)
+		scratch.header = (unsigned char *)malloc(kScratchHeaderBytes);
+	return scratch.header;
+} // scratchHeader()
+
+static void scratchHeaderFree(unsigned char *buffer) {
+	if (buffer != scratch.header)
+		free(buffer);
+} // scratchHeaderFree()
+
 void dcmStr(int lLength, unsigned char lBuffer[], char *lOut, bool isStrLarge = false) {
 	if (lLength < 1)
 		return;
-	char *cString = (char *)malloc(sizeof(char) * (lLength + 1));
+	char *cString = scratchAlloc(lLength + 1);
 	cString[lLength] = 0;
 	memcpy(cString, (char *)&lBuffer[0], lLength);
 // memcpy(cString, test, lLength);
@@ -1127,7 +1330,7 @@ void dcmStr(int lLength, unsigned char lBuffer[], char *lOut, bool isStrLarge =
 	}
 	memcpy(lOut, cString, len - 1);
 	lOut[len - 1] = 0;
-	free(cString);
+	scratchFree(cString);
 } // dcmStr()
 
 #ifdef MY_OLD
@@ -1252,22 +1455,18 @@ uint32_t dcmAttributeTag(unsigned char lBuffer[], bool littleEndian) {
 } // dcmInt()
 
 int dcmStrInt(const int lByteLength, const unsigned char lBuffer[]) { // read int stored as a string
-	char *cString = (char *)malloc(sizeof(char) * (lByteLength + 1));
+	char *cString = scratchAlloc(lByteLength + 1);
 	cString[lByteLength] = 0;
 	memcpy(cString, (const unsigned char *)(&lBuffer[0]), lByteLength);
 	int ret = atoi(cString);
-	free(cString);
+	scratchFree(cString);
 	return ret;
 } // dcmStrInt()
 
 int dcmStrManufacturer(const int lByteLength, unsigned char lBuffer[]) { // read float stored as a string
 	if (lByteLength < 2)
 		return kMANUFACTURER_UNKNOWN;
-	// #ifdef _MSC_VER
-	char *cString = (char *)malloc(sizeof(char) * (lByteLength + 1));
-	// #else
-	//	char cString[lByteLength + 1];
-	// #endif
+	char *cString = scratchAlloc(lByteLength + 1);
 	int ret = kMANUFACTURER_UNKNOWN;
 	cString[lByteLength] = 0;
 	memcpy(cString, (char *)&lBuffer[0], lByteLength);
@@ -1300,9 +1499,7 @@ int dcmStrManufacturer(const int lByteLength, unsigned char lBuffer[]) { // read
 
 	// if (ret == kMANUFACTURER_UNKNOWN) //reduce verbosity: single warning for series : Unable to determine manufacturer (0008,0070)
 	//	printWarning("Unknown manufacturer %s\n", cString);
-	// #ifdef _MSC_VER
-	free(cString);
-	// #endif
+	scratchFree(cString);
 	return ret;
 } // dcmStrManufacturer
 
@@ -1322,13 +1519,13 @@ float csaMultiFloat(unsigned char buff[], int nItems, float Floats[], int *Items
 		if (!littleEndianPlatform())
 			nifti_swap_4bytes(1, &itemCSA.xx2_Len);
 		if (itemCSA.xx2_Len > 0) {
-			char *cString = (char *)malloc(sizeof(char) * (itemCSA.xx2_Len));
+			char *cString = scratchAlloc(itemCSA.xx2_Len);
 			memcpy(cString, &buff[lPos], itemCSA.xx2_Len); // TPX memcpy(&cString, &buff[lPos], sizeof(cString));
 			lPos += ((itemCSA.xx2_Len + 3) / 4) * 4;
 			// printMessage(" %d item length %d = %s\n",lI, itemCSA.xx2_Len, cString);
 			Floats[lI] = (float)atof(cString);
 			*ItemsOK = lI; // some sequences have store empty items
-			free(cString);
+			scratchFree(cString);
 		}
 	} // for each item
 	return Floats[1];
@@ -1344,7 +1541,7 @@ int csaICEdims(unsigned char buff[]) {
 	int coilNumber = -1;
 	if (itemCSA.xx2_Len > 0) {
 		lPos += sizeof(itemCSA);
-		char *cString = (char *)malloc(sizeof(char) * (itemCSA.xx2_Len));
+		char *cString = scratchAlloc(itemCSA.xx2_Len);
 		memcpy(cString, &buff[lPos], itemCSA.xx2_Len); // TPX memcpy(&cString, &buff[lPos], sizeof(cString));
 		lPos += ((itemCSA.xx2_Len + 3) / 4) * 4;
 		char c = cString[0];
@@ -1353,7 +1550,7 @@ int csaICEdims(unsigned char buff[]) {
 			char *end;
 			coilNumber = (int)strtol(cString, &end, 10);
 		}
-		free(cString);
+		scratchFree(cString);
 	}
 	return coilNumber;
 } // csaICEdims()
@@ -1371,13 +1568,14 @@ bool csaIsPhaseMap(unsigned char buff[], int nItems) {
 		if (!littleEndianPlatform())
 			nifti_swap_4bytes(1, &itemCSA.xx2_Len);
 		if (itemCSA.xx2_Len > 0) {
-			char *cString = (char *)malloc(sizeof(char) * (itemCSA.xx2_Len + 1));
+			char *cString = scratchAlloc(itemCSA.xx2_Len + 1);
 			memcpy(cString, &buff[lPos], sizeof(itemCSA.xx2_Len)); // TPX memcpy(&cString, &buff[lPos], sizeof(cString));
 			lPos += ((itemCSA.xx2_Len + 3) / 4) * 4;
 			// printMessage(" %d item length %d = %s\n",lI, itemCSA.xx2_Len, cString);
-			if (strcmp(cString, "CC:ComplexAdd") == 0)
+			bool isMatch = (strcmp(cString, "CC:ComplexAdd") == 0);
+			scratchFree(cString);
+			if (isMatch)
 				return true;
-			free(cString);
 		}
 	} // for each item
 	return false;
@@ -1533,13 +1731,13 @@ int readCSAImageHeader(unsigned char *buff, int lLength, struct TCSAdata *CSA, i
 				if (itemsOK > kMaxEPI3D) {
 					printError("Please increase kMaxEPI3D and recompile\n");
 				} else {
-					float *sliceTimes = (float *)malloc(sizeof(float) * (tagCSA.nitems + 1));
+					float *sliceTimes = (float *)scratchAlloc(sizeof(float) * (tagCSA.nitems + 1));
 					csaMultiFloat(&buff[lPos], tagCSA.nitems, sliceTimes, &itemsOK);
 					for (int z = 0; z < kMaxEPI3D; z++)
 						CSA->sliceTiming[z] = -1.0;
 					for (int z = 0; z < itemsOK; z++)
 						CSA->sliceTiming[z] = sliceTimes[z + 1];
-					free(sliceTimes);
+					scratchFree(sliceTimes);
 					checkSliceTimes(CSA, itemsOK, isVerbose, is3DAcq);
 				}
 			} else if (strcmp(tagCSA.name, "ProtocolSliceNumber") == 0)
@@ -1585,10 +1783,10 @@ void dcmMultiFloat(int lByteLength, char lBuffer[], int lnFloats, float *lFloats
 	// warning: lFloats indexed from 1! will fill lFloats[1]..[nFloats]
 	if ((lnFloats < 1) || (lByteLength < 1))
 		return;
-	char *cString = (char *)malloc(sizeof(char) * (lByteLength + 1));
+	char *cString = scratchAlloc(lByteLength + 1);
 	memcpy(cString, (char *)&lBuffer[0], lByteLength);
 	cString[lByteLength] = 0; // null terminate
-	char *temp = (char *)malloc(lByteLength + 1);
+	char *temp = scratchAlloc(lByteLength + 1);
 	int f = 0, lStart = 0;
 	bool isOK = false;
 	for (int i = 0; i <= lByteLength; i++) {
@@ -1606,25 +1804,25 @@ void dcmMultiFloat(int lByteLength, char lBuffer[], int lnFloats, float *lFloats
 			lStart = i + 1;
 		} // if isOK
 	} // for i to length
-	free(temp);
-	free(cString);
+	scratchFree(temp);
+	scratchFree(cString);
 } // dcmMultiFloat()
 
 double dcmStrDouble(const int lByteLength, const unsigned char lBuffer[]) { // read float stored as a string
-	char *cString = (char *)malloc(sizeof(char) * (lByteLength + 1));
+	char *cString = scratchAlloc(lByteLength + 1);
 	memcpy(cString, (char *)&lBuffer[0], lByteLength);
 	cString[lByteLength] = 0; // null terminate
 	double ret = (double)atof(cString);
-	free(cString);
+	scratchFree(cString);
 	return ret;
 } // dcmStrDouble()
 
 float dcmStrFloat(const int lByteLength, const unsigned char lBuffer[]) { // read float stored as a string
-	char *cString = (char *)malloc(sizeof(char) * (lByteLength + 1));
+	char *cString = scratchAlloc(lByteLength + 1);
 	memcpy(cString, (char *)&lBuffer[0], lByteLength);
 	cString[lByteLength] = 0; // null terminate
 	float ret = (float)atof(cString);
-	free(cString);
+	scratchFree(cString);
 	return ret;
 } // dcmStrFloat()
 
@@ -1763,7 +1961,7 @@ void cleanStr(char *lOut) {
 	size_t lLength = strlen(lOut);
 	if (lLength < 1)
 		return;
-	char *cString = (char *)malloc(sizeof(char) * (lLength + 1));
+	char *cString = scratchAlloc(lLength + 1);
 	cString[lLength] = 0;
 	memcpy(cString, (char *)&lOut[0], lLength);
 	for (int i = 0; i < (int)lLength; i++)
@@ -1837,7 +2035,7 @@ void cleanStr(char *lOut) {
 	}
 	memcpy(lOut, cString, len - 1);
 	lOut[len - 1] = 0;
-	free(cString);
+	scratchFree(cString);
 } // cleanStr()
 
 int isSameFloatGE(float a, float b) {
@@ -1846,6 +2044,51 @@ int isSameFloatGE(float a, float b) {
 	return (fabs(a - b) <= 0.0001);
 }
 
+float parStrToFloat(char *str, char **endptr) {
+	// drop-in for strtof() when reading the PAR slice table, most values are short decimals like "-12.345"
+	// a mantissa below 2^24 divided by an exactly representable power of ten is correctly rounded,
+	// so this matches strtof(); exponents, long mantissas and anything unusual are passed to strtof()
+#if FLT_EVAL_METHOD == 0
+	static const float kPow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+	char *c = str;
+	while ((*c == ' ') || (*c == '\t'))
+		c++;
+	bool isNeg = (*c == '-');
+	if ((*c == '-') || (*c == '+'))
+		c++;
+	uint32_t mantissa = 0;
+	int nDigits = 0;
+	int nFrac = 0;
+	while ((*c >= '0') && (*c <= '9')) {
+		mantissa = (mantissa * 10) + (*c - '0');
+		if (mantissa > 16777216)
+			return strtof(str, endptr);
+		nDigits++;
+		c++;
+	}
+	if (*c == '.') {
+		c++;
+		while ((*c >= '0') && (*c <= '9')) {
+			mantissa = (mantissa * 10) + (*c - '0');
+			nFrac++;
+			if ((mantissa > 16777216) || (nFrac > 10))
+				return strtof(str, endptr);
+			nDigits++;
+			c++;
+		}
+	}
+	if ((nDigits < 1) || (isalpha((unsigned char)*c)) || (*c == '.')) // e.g. exponent, "nan", "0x1p3"
+		return strtof(str, endptr);
+	float ret = (float)mantissa;
+	if (nFrac > 0)
+		ret = ret / kPow10[nFrac];
+	*endptr = c;
+	return isNeg ? -ret : ret;
+#else
+	return strtof(str, endptr);
+#endif
+} // parStrToFloat()
+
 struct TDICOMdata nii_readParRec(char *parname, int isVerbose, struct TDTI4D *dti4D, bool isReadPhase) {
 	struct TDICOMdata d = clear_dicom_data();
 	dti4D->sliceOrder[0] = -1;
@@ -2171,7 +2414,7 @@ struct TDICOMdata nii_readParRec(char *parname, int isVerbose, struct TDTI4D *dt
 			return d;
 		}
 		for (int i = 0; i <= nCols; i++)
-			cols[i] = strtof(p, &p); // p+1 skip comma, read a float
+			cols[i] = parStrToFloat(p, &p); // p+1 skip comma, read a float
 		// printMessage("xDim %dv%d yDim %dv%d bits %dv%d\n", d.xyzDim[1],(int)cols[kXdim], d.xyzDim[2], (int)cols[kYdim], d.bitsAllocated, (int)cols[kBitsPerVoxel]);
 		if ((int)cols[kSlice] == 0) {	 // line does not contain attributes
 			p = fgets(buff, LINESZ, fp); // get next line
@@ -2923,7 +3166,8 @@ unsigned char *nii_flipZ(unsigned char *bImg, struct nifti_1_header *h) {
 	return nii_flipImgZ(bImg, h);
 } // nii_flipZ()
 
-unsigned char *nii_flipY(unsigned char *bImg, struct nifti_1_header *h) {
+void nii_flipYhdr(struct nifti_1_header *h) {
+	// update spatial transform for reversed row order, the voxels are left untouched
 	mat33 s;
 	mat44 Q44;
 	LOAD_MAT33(s, h->srow_x[0], h->srow_x[1], h->srow_x[2], h->srow_y[0], h->srow_y[1], h->srow_y[2],
@@ -2940,42 +3184,77 @@ unsigned char *nii_flipY(unsigned char *bImg, struct nifti_1_header *h) {
 			   s.m[1][0], s.m[1][1], s.m[1][2], v.v[1],
 			   s.m[2][0], s.m[2][1], s.m[2][2], v.v[2]);
 	setQSForm(h, Q44, true);
+} // nii_flipYhdr()
+
+unsigned char *nii_flipY(unsigned char *bImg, struct nifti_1_header *h) {
+	nii_flipYhdr(h);
 	// printMessage("nii_flipImgY dims %dx%d %d \n",h->dim[1],h->dim[2], h->bitpix/8);
 	return nii_flipImgY(bImg, h);
 } // nii_flipY()
 
-void conv1bit16bit(unsigned char *img, struct nifti_1_header hdr) { // issue572
-	printWarning("Support for images that allocate 1 bits is experimental\n");
-	int nVox = (int)nii_ImgBytes(hdr) / (hdr.bitpix / 8);
-	for (int i = (nVox - 1); i >= 0; i--) {
-		int ibyte = i >> 3; // byte to sample
-		int ibit = (i % 8); // bit 0..7
-		// if (highBit > 0)
-		//	ibit = 7 - ibit;
-		int val = img[ibyte] >> ibit;
-		img[i] = (val & 1);
-	}
-} // conv1bit16bit()
-
-void conv12bit16bit(unsigned char *img, struct nifti_1_header hdr) {
-	// convert 12-bit allocated data to 16-bit
+void unpack1bit(unsigned char *dst, const unsigned char *src, size_t nVox) { // issue572
+	// one byte per voxel, least significant bit first
+	//  whole bytes are expanded with fixed shifts and no branches so the compiler can vectorize
+	size_t nByte = nVox >> 3;
+	for (size_t b = 0; b < nByte; b++) {
+		unsigned char v = src[b];
+		unsigned char *o = dst + (b << 3);
+		for (int j = 0; j < 8; j++)
+			o[j] = (v >> j) & 1;
+	}
+	for (size_t i = nByte << 3; i < nVox; i++)
+		dst[i] = (src[i >> 3] >> (i & 7)) & 1;
+} // unpack1bit()
+
+void unpack12bit(unsigned char *dst, const unsigned char *src, size_t nVox) {
+	// convert 12-bit allocated data to 16-bit little-endian, each 3 input bytes hold 2 voxels
 	//  works for MR-MONO2-12-angio-an1 from http://www.barre.nom.fr/medical/samples/
 	//  looks wrong: this sample toggles between big and little endian stores
-	int nVox = (int)nii_ImgBytes(hdr) / (hdr.bitpix / 8);
-	for (int i = (nVox - 1); i >= 0; i--) {
-		int i16 = i * 2;
-		int i12 = floor(i * 1.5);
-		uint16_t val;
-		if ((i % 2) != 1) {
-			val = img[i12 + 1] + (img[i12 + 0] << 8);
-			val = val >> 4;
-		} else {
-			val = img[i12 + 0] + (img[i12 + 1] << 8);
-		}
-		img[i16 + 0] = val & 0xFF;
-		img[i16 + 1] = (val >> 8) & 0xFF;
+	size_t nPair = nVox >> 1;
+	for (size_t p = 0; p < nPair; p++) {
+		const unsigned char *s3 = src + (p * 3);
+		unsigned char *o = dst + (p << 2);
+		uint16_t lo = (uint16_t)(((s3[0] << 8) | s3[1]) >> 4);
+		o[0] = lo & 0xFF;
+		o[1] = (lo >> 8) & 0xFF;
+		o[2] = s3[1];
+		o[3] = s3[2];
+	}
+	if (nVox & 1) { // final unpaired voxel uses only 2 bytes
+		const unsigned char *s3 = src + (nPair * 3);
+		uint16_t lo = (uint16_t)(((s3[0] << 8) | s3[1]) >> 4);
+		dst[nPair << 2] = lo & 0xFF;
+		dst[(nPair << 2) + 1] = (lo >> 8) & 0xFF;
+	}
+} // unpack12bit()
+
+size_t freadUnpack(unsigned char *dst, size_t nVox, size_t imgszRead, int bitsAllocated, FILE *file) {
+	// read packed 1-bit or 12-bit data in small chunks, unpacking each straight into its final place
+	//  returns packed bytes read
+	const size_t kChunk = 3 * 8 * 8192; // whole bytes of 1-bit voxels, whole 3-byte pairs of 12-bit voxels
+	unsigned char *buf = (unsigned char *)malloc(kChunk);
+	size_t bytesRead = 0;
+	size_t voxOut = 0;
+	while (bytesRead < imgszRead) {
+		size_t n = imgszRead - bytesRead;
+		if (n > kChunk)
+			n = kChunk;
+		size_t got = fread(buf, 1, n, file);
+		bytesRead += got;
+		size_t nv = (bitsAllocated == 1) ? (got << 3) : ((got * 2) / 3);
+		if (nv > (nVox - voxOut))
+			nv = nVox - voxOut;
+		if (bitsAllocated == 1)
+			unpack1bit(dst + voxOut, buf, nv);
+		else
+			unpack12bit(dst + (voxOut * 2), buf, nv);
+		voxOut += nv;
+		if (got < n)
+			break;
 	}
-} // conv12bit16bit()
+	free(buf);
+	return bytesRead;
+} // freadUnpack()
 
 unsigned char *nii_loadImgCore(char *imgname, struct nifti_1_header hdr, int bitsAllocated, int imageStart32) {
 	size_t imgsz = nii_ImgBytes(hdr);
@@ -2985,7 +3264,7 @@ unsigned char *nii_loadImgCore(char *imgname, struct nifti_1_header hdr, int bit
 		imgszRead = (imgsz + 7) >> 3;
 	if (bitsAllocated == 12)
 		imgszRead = round(imgsz * 0.75);
-	FILE *file = fopen(imgname, "rb");
+	FILE *file = nii_fopen(imgname, "rb");
 	if (!file) {
 		printError("Unable to open '%s'\n", imgname);
 		return NULL;
@@ -3011,16 +3290,18 @@ unsigned char *nii_loadImgCore(char *imgname, struct nifti_1_header hdr, int bit
 	// int i = 0;
 	// while (bImg[i] == 0) i++;
 	// printMessage("%d %d<\n",i,bImg[i]);
-	size_t sz = fread(bImg, 1, imgszRead, file);
+	size_t sz;
+	if ((bitsAllocated == 1) || (bitsAllocated == 12)) {
+		if (bitsAllocated == 1)
+			printWarning("Support for images that allocate 1 bits is experimental\n");
+		sz = freadUnpack(bImg, imgsz / (hdr.bitpix / 8), imgszRead, bitsAllocated, file);
+	} else
+		sz = fread(bImg, 1, imgszRead, file);
 	fclose(file);
 	if (sz < imgszRead) {
 		printError("Only loaded %zu of %zu bytes for %s\n", sz, imgszRead, imgname);
 		return NULL;
 	}
-	if (bitsAllocated == 1)
-		conv1bit16bit(bImg, hdr);
-	if (bitsAllocated == 12)
-		conv12bit16bit(bImg, hdr);
 	return bImg;
 } // nii_loadImgCore()
 
@@ -3212,6 +3493,83 @@ unsigned char *nii_reorderSlicesX(unsigned char *bImg, struct nifti_1_header *hd
 	return bImg;
 }
 
+unsigned char *nii_loadImgCoreSliceOrder(char *imgname, struct nifti_1_header hdr, size_t imageStart, struct TDTI4D *dti4D) {
+	// uncompressed image where slices are stored in any order (e.g. PAR/REC): equivalent to nii_loadImgCore()
+	//  followed by nii_reorderSlicesX(), but each slice is copied once, straight to its final position,
+	//  so peak memory is a single copy of the image rather than two
+	int dim3to7 = 1;
+	for (int i = 3; i < 8; i++)
+		if (hdr.dim[i] > 1)
+			dim3to7 = dim3to7 * hdr.dim[i];
+	bool isReorder = (dim3to7 > 1) && (dim3to7 <= kMaxSlice2D);
+	size_t imgsz = nii_ImgBytes(hdr);
+	size_t sliceBytes = imgsz / dim3to7;
+	FILE *file = nii_fopen(imgname, "rb");
+	if (!file) {
+		printError("Unable to open '%s'\n", imgname);
+		return NULL;
+	}
+#ifdef _MSC_VER
+	_fseeki64(file, 0, SEEK_END);
+	size_t fileLen = _ftelli64(file);
+#else
+	fseeko(file, 0, SEEK_END);
+	size_t fileLen = ftello(file);
+#endif
+	if (fileLen < (imgsz + imageStart)) {
+		printMessage("FileSize < (ImageSize+HeaderSize): %zu < (%zu+%zu) \n", fileLen, imgsz, imageStart);
+		printWarning("File not large enough to store image data: %s\n", imgname);
+		fclose(file);
+		return NULL;
+	}
+	unsigned char *bImg = (unsigned char *)malloc(imgsz);
+	int *fromSlices = (int *)malloc(dim3to7 * sizeof(int));
+	for (int i = 0; i < dim3to7; i++) { // for each slice of output
+		int fromSlice = i;
+		if (isReorder) {
+			fromSlice = dti4D->sliceOrder[i];
+			if ((fromSlice < 0) || (fromSlice >= dim3to7)) {
+				printError("Re-ordered slice out-of-volume %d\n", fromSlice);
+				fromSlice = i;
+			}
+		}
+		fromSlices[i] = fromSlice;
+	}
+#ifdef myEnableMmap
+	int fd = fileno(file); // -1 for in-memory byte sources
+	if (fd >= 0) {
+		size_t mapBytes = imageStart + imgsz;
+		unsigned char *map = (unsigned char *)mmap(NULL, mapBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			for (int i = 0; i < dim3to7; i++)
+				memcpy(&bImg[i * sliceBytes], &map[imageStart + (fromSlices[i] * sliceBytes)], sliceBytes);
+			munmap(map, mapBytes);
+			free(fromSlices);
+			fclose(file);
+			return bImg;
+		}
+	}
+#endif // myEnableMmap
+	for (int i = 0; i < dim3to7; i++) {
+		size_t pos = imageStart + (fromSlices[i] * sliceBytes);
+#ifdef _MSC_VER
+		_fseeki64(file, pos, SEEK_SET);
+#else
+		fseeko(file, pos, SEEK_SET);
+#endif
+		size_t sz = fread(&bImg[i * sliceBytes], 1, sliceBytes, file);
+		if (sz < sliceBytes) {
+			printError("Only loaded %zu of %zu bytes for %s\n", sz, sliceBytes, imgname);
+			free(bImg);
+			bImg = NULL;
+			break;
+		}
+	}
+	free(fromSlices);
+	fclose(file);
+	return bImg;
+} // nii_loadImgCoreSliceOrder()
+
 unsigned char *nii_byteswap(unsigned char *img, struct nifti_1_header *hdr) {
 	if (hdr->bitpix < 9)
 		return img;
@@ -3391,7 +3749,7 @@ TJPEG *decode_JPEG_SOF_0XC3_stack(const char *fn, int skipBytes, int isVerbose,
 	free(lOffsetRA); \
 	return NULL;
 	TJPEG *lOffsetRA = (TJPEG *)malloc(frames * sizeof(TJPEG));
-	FILE *reader = fopen(fn, "rb");
+	FILE *reader = nii_fopen(fn, "rb");
 	fseek(reader, 0, SEEK_END);
 	long lRawSz = ftell(reader) - skipBytes;
 	if (lRawSz <= 8) {
@@ -3506,7 +3864,7 @@ unsigned char *nii_loadImgJPEG50(char *imgname, struct TDICOMdata dcm) {
 		return NULL;
 	}
 	// load compressed data
-	FILE *f = fopen(imgname, "rb");
+	FILE *f = nii_fopen(imgname, "rb");
 	size_t _jpegSize = dcm.imageBytes;
 	if (_jpegSize < 8) {
 		printError("File too small\n");
@@ -3555,7 +3913,7 @@ unsigned char *nii_loadImgJPEG50(char *imgname, struct TDICOMdata dcm) {
 		return NULL;
 	}
 	// load compressed data
-	FILE *f = fopen(imgname, "rb");
+	FILE *f = nii_fopen(imgname, "rb");
 	size_t size = dcm.imageBytes;
 	char *buf = (char *)malloc(size);
 	fseek(f, dcm.imageStart, SEEK_SET);
@@ -3604,7 +3962,7 @@ unsigned char *nii_loadImgPMSCT_RLE1(char *imgname, struct nifti_1_header hdr, s
 		printError("PMSCT_RLE1 should be 16-bits per sample (please report on Github and use pmsct_rgb1).\n");
 		return NULL;
 	}
-	FILE *file = fopen(imgname, "rb");
+	FILE *file = nii_fopen(imgname, "rb");
 	if (!file) {
 		printError("Unable to open %s\n", imgname);
 		return NULL;
@@ -3686,7 +4044,7 @@ unsigned char *nii_loadImgRLE(char *imgname, struct nifti_1_header hdr, struct T
 		printError("%d is not enough bytes for RLE compression '%s'\n", dcm.imageBytes, imgname);
 		return NULL;
 	}
-	FILE *file = fopen(imgname, "rb");
+	FILE *file = nii_fopen(imgname, "rb");
 	if (!file) {
 		printError("Unable to open %s\n", imgname);
 		return NULL;
@@ -3786,59 +4144,109 @@ unsigned char *nii_loadImgRLE(char *imgname, struct nifti_1_header hdr, struct T
 #endif
 #include "charls/publictypes.h"
 
-unsigned char *nii_loadImgJPEGLS(char *imgname, struct nifti_1_header hdr, struct TDICOMdata dcm) {
+// JPEG-LS decoder context: each thread keeps its compressed-fragment buffer between frames and files,
+// so a series is decoded without allocating a staging buffer for every image.
+struct TJPEGLScontext {
+	unsigned char *cImg;
+	size_t cBytes;
+	~TJPEGLScontext() {
+		free(cImg);
+	}
+};
+static thread_local struct TJPEGLScontext jlsContext;
+
+// decode the fragment at imageStart straight into bImg (imgsz bytes)
+bool nii_decodeJPEGLS(char *imgname, long imageStart, long imageBytes, unsigned char *bImg, size_t imgsz) {
 	// load compressed data
-	FILE *file = fopen(imgname, "rb");
+	FILE *file = nii_fopen(imgname, "rb");
 	if (!file) {
 		printError("Unable to open %s\n", imgname);
-		return NULL;
+		return false;
 	}
 	fseek(file, 0, SEEK_END);
 	long fileLen = ftell(file);
-	if ((fileLen < 1) || (dcm.imageBytes < 1) || (fileLen < (dcm.imageBytes + dcm.imageStart))) {
+	if ((fileLen < 1) || (imageBytes < 1) || (fileLen < (imageBytes + imageStart))) {
 		printMessage("File not large enough to store JPEG-LS data: %s\n", imgname);
 		fclose(file);
-		return NULL;
+		return false;
 	}
-	fseek(file, (long)dcm.imageStart, SEEK_SET);
-	unsigned char *cImg = (unsigned char *)malloc(dcm.imageBytes); // compressed input
-	size_t sz = fread(cImg, 1, dcm.imageBytes, file);
+	if (jlsContext.cBytes < (size_t)imageBytes) {
+		free(jlsContext.cImg);
+		jlsContext.cImg = (unsigned char *)malloc(imageBytes);
+		jlsContext.cBytes = (jlsContext.cImg) ? imageBytes : 0;
+		if (!jlsContext.cImg) {
+			fclose(file);
+			return false;
+		}
+	}
+	unsigned char *cImg = jlsContext.cImg; // compressed input
+	fseek(file, imageStart, SEEK_SET);
+	size_t sz = fread(cImg, 1, imageBytes, file);
 	fclose(file);
-	if (sz < (size_t)dcm.imageBytes) {
-		printError("Only loaded %zu of %d bytes for %s\n", sz, dcm.imageBytes, imgname);
-		free(cImg);
-		return NULL;
+	if (sz < (size_t)imageBytes) {
+		printError("Only loaded %zu of %ld bytes for %s\n", sz, imageBytes, imgname);
+		return false;
 	}
-	// create buffer for uncompressed data
-	size_t imgsz = nii_ImgBytes(hdr);
-	unsigned char *bImg = (unsigned char *)malloc(imgsz); // binary output
 	JlsParameters params = {};
 #ifdef myEnableJPEGLS1
-	if (JpegLsReadHeader(cImg, dcm.imageBytes, &params) != OK) {
+	if (JpegLsReadHeader(cImg, imageBytes, &params) != OK) {
 #else
 	using namespace charls;
-	if (JpegLsReadHeader(cImg, dcm.imageBytes, &params, nullptr) != ApiResult::OK) {
+	if (JpegLsReadHeader(cImg, imageBytes, &params, nullptr) != ApiResult::OK) {
 #endif
 		printMessage("CharLS failed to read header.\n");
-		return NULL;
+		return false;
 	}
 #ifdef myEnableJPEGLS1
-	if (JpegLsDecode(&bImg[0], imgsz, &cImg[0], dcm.imageBytes, &params) != OK) {
+	if (JpegLsDecode(&bImg[0], imgsz, &cImg[0], imageBytes, &params) != OK) {
 #else
-	if (JpegLsDecode(&bImg[0], imgsz, &cImg[0], dcm.imageBytes, &params, nullptr) != ApiResult::OK) {
+	if (JpegLsDecode(&bImg[0], imgsz, &cImg[0], imageBytes, &params, nullptr) != ApiResult::OK) {
 #endif
-		free(bImg);
 		printMessage("CharLS failed to read image.\n");
+		return false;
+	}
+	return true;
+} // nii_decodeJPEGLS()
+
+unsigned char *nii_loadImgJPEGLS(char *imgname, struct nifti_1_header hdr, struct TDICOMdata dcm) {
+	// create buffer for uncompressed data
+	size_t imgsz = nii_ImgBytes(hdr);
+	unsigned char *bImg = (unsigned char *)malloc(imgsz); // binary output
+	if (!nii_decodeJPEGLS(imgname, dcm.imageStart, dcm.imageBytes, bImg, imgsz)) {
+		free(bImg);
 		return NULL;
 	}
 	return (bImg);
-}
+} // nii_loadImgJPEGLS()
+
+// JPEG-LS images that need no reformatting after decoding can be decoded straight into the caller's buffer
+bool isDirectJPEGLS(struct nifti_1_header *hdr, struct TDICOMdata *dcm, bool iVaries, struct TDTI4D *dti4D) {
+	if (dcm->compressionScheme != kCompressJPEGLS)
+		return false;
+	if ((hdr->datatype == DT_RGB24) || (dcm->isYBRfull) || (dcm->CSA.mosaicSlices > 1))
+		return false;
+	if ((iVaries) && (!dcm->isFloat))
+		return false;
+	if ((dti4D != NULL) && (dti4D->sliceOrder[0] >= 0))
+		return false;
+	return true;
+} // isDirectJPEGLS()
 #endif
 
+void nii_loadImgXLFinish(struct nifti_1_header *hdr, struct TDICOMdata dcm) {
+	int nAcq = dcm.locationsInAcquisition;
+	if ((nAcq > 1) && (hdr->dim[0] < 4) && ((hdr->dim[3] % nAcq) == 0) && (hdr->dim[3] > nAcq)) {
+		hdr->dim[4] = hdr->dim[3] / nAcq;
+		hdr->dim[3] = nAcq;
+		hdr->dim[0] = 4;
+	}
+} // nii_loadImgXLFinish()
+
 unsigned char *nii_loadImgXLCore(char *imgname, struct nifti_1_header *hdr, struct TDICOMdata dcm, bool iVaries, int compressFlag, int isVerbose, struct TDTI4D *dti4D) {
 	// provided with a filename (imgname) and DICOM header (dcm), creates NIfTI header (hdr) and img
 	// n.b. must ALWAYS be called from nii_loadImgXLCore()
 	unsigned char *img;
+	bool isSliceOrdered = false; // slices already loaded in final order
 	if (dcm.compressionScheme == kCompress50) {
 #ifdef myDisableClassicJPEG
 		printMessage("Software not compiled to decompress classic JPEG DICOM images\n");
@@ -3890,6 +4298,9 @@ unsigned char *nii_loadImgXLCore(char *imgname, struct nifti_1_header *hdr, stru
 		if (dcm.compressionScheme == kCompressYes) {
 		printMessage("%d Unable to decompress DICOM transfer syntax '%s'\n", compressFlag, dcm.transferSyntax);
 		return NULL;
+	} else if ((dti4D != NULL) && (dti4D->sliceOrder[0] >= 0) && (dcm.CSA.mosaicSlices < 2) && (dcm.bitsAllocated == hdr->bitpix)) {
+		img = nii_loadImgCoreSliceOrder(imgname, *hdr, dcm.imageStart, dti4D);
+		isSliceOrdered = true;
 	} else
 		img = nii_loadImgCore(imgname, *hdr, dcm.bitsAllocated, dcm.imageStart);
 	if (img == NULL)
@@ -3907,13 +4318,8 @@ unsigned char *nii_loadImgXLCore(char *imgname, struct nifti_1_header *hdr, stru
 	}
 	if ((dti4D == NULL) && (!dcm.isFloat) && (iVaries)) // must do after
 		img = nii_iVaries(img, hdr, NULL);
-	int nAcq = dcm.locationsInAcquisition;
-	if ((nAcq > 1) && (hdr->dim[0] < 4) && ((hdr->dim[3] % nAcq) == 0) && (hdr->dim[3] > nAcq)) {
-		hdr->dim[4] = hdr->dim[3] / nAcq;
-		hdr->dim[3] = nAcq;
-		hdr->dim[0] = 4;
-	}
-	if ((dti4D != NULL) && (dti4D->sliceOrder[0] >= 0))
+	nii_loadImgXLFinish(hdr, dcm);
+	if ((dti4D != NULL) && (dti4D->sliceOrder[0] >= 0) && (!isSliceOrdered))
 		img = nii_reorderSlicesX(img, hdr, dti4D);
 	if ((dti4D != NULL) && (!dcm.isFloat) && (iVaries))
 		img = nii_iVaries(img, hdr, dti4D);
@@ -3950,6 +4356,31 @@ unsigned char *nii_loadImgXL(char *imgname, struct nifti_1_header *hdr, struct T
 	for (int i = 3; i < 8; i++)
 		 hdr2D->dim[i] = 1;
 	int lastimageBytes = dcm.imageBytes;
+#if defined(myEnableJPEGLS) || defined(myEnableJPEGLS1)
+	if (isDirectJPEGLS(hdr2D, &dcm, iVaries, dti4D)) { // frames decoded in parallel, each straight into its slice of img
+		bool isOK = true;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) reduction(&& : isOK)
+#endif
+		for (int i = 0; i < frames; i++) {
+			if (!isOK)
+				continue;
+			long imageStart = (long)dti4D->offsetTable[i];
+			long imageBytes = lastimageBytes;
+			if (i < (frames - 1))
+				imageBytes = (long)dti4D->offsetTable[i + 1] - imageStart;
+			if (!nii_decodeJPEGLS(imgname, imageStart, imageBytes, img + i * sliceBytes2D, sliceBytes2D)) {
+				printError("Failed to decode frame %d/%d offset: %ld bytes: %ld format: %s\n", (i + 1), frames, imageStart, imageBytes, dcm.transferSyntax);
+				isOK = false;
+			}
+		}
+		free(hdr2D);
+		if (isOK)
+			return img;
+		free(img);
+		return NULL;
+	}
+#endif
 	for (int i = 0; i < frames; i++) {
 		dcm.imageStart = dti4D->offsetTable[i];
 		dcm.imageBytes = lastimageBytes;
@@ -3960,15 +4391,41 @@ unsigned char *nii_loadImgXL(char *imgname, struct nifti_1_header *hdr, struct T
 			printError("Failed to decode frame %d/%d offset: %d bytes: %d format: %s\n", (i+1), frames, dcm.imageStart, dcm.imageBytes, dcm.transferSyntax);
 			free(img);
 			free(img2D);
+			free(hdr2D);
 			return NULL;
 		}
 		// Copy the 2D slice into the correct position in the 3D/4D image buffer
 		memcpy(img + i * sliceBytes2D, img2D, sliceBytes2D);
 		free(img2D);
 	}
+	free(hdr2D);
 	return img;
 } // nii_loadImgXL()
 
+int nii_loadImgXLInto(char *imgname, struct nifti_1_header *hdr, struct TDICOMdata dcm, bool iVaries, int compressFlag, int isVerbose, struct TDTI4D *dti4D, unsigned char *dst, size_t dstBytes) {
+	// as nii_loadImgXL(), but the image is stored in dst (at most dstBytes are written)
+#if defined(myEnableJPEGLS) || defined(myEnableJPEGLS1)
+	if (dcm.offsetTableItems <= 1) {
+		if (headerDcm2Nii(dcm, hdr, true) == EXIT_FAILURE)
+			return EXIT_FAILURE;
+		if ((isDirectJPEGLS(hdr, &dcm, iVaries, dti4D)) && (nii_ImgBytes(*hdr) == dstBytes)) {
+			if (!nii_decodeJPEGLS(imgname, dcm.imageStart, dcm.imageBytes, dst, dstBytes))
+				return EXIT_FAILURE;
+			nii_loadImgXLFinish(hdr, dcm);
+			headerDcm2NiiSForm(dcm, dcm, hdr, false);
+			return EXIT_SUCCESS;
+		}
+	}
+#endif
+	unsigned char *img = nii_loadImgXL(imgname, hdr, dcm, iVaries, compressFlag, isVerbose, dti4D);
+	if (img == NULL)
+		return EXIT_FAILURE;
+	size_t imgsz = nii_ImgBytes(*hdr);
+	memcpy(dst, img, (imgsz < dstBytes) ? imgsz : dstBytes);
+	free(img);
+	return EXIT_SUCCESS;
+} // nii_loadImgXLInto()
+
 int isSQ(uint32_t groupElement, bool isPhilips) { // Detect sequence VR ("SQ") for implicit tags
 	static const int array_size = 35;
 	uint32_t array[array_size] = {0x0008 + (uint32_t(0x1111) << 16), 0x0008 + (uint32_t(0x1115) << 16), 0x0008 + (uint32_t(0x1140) << 16), 0x0008 + (uint32_t(0x1199) << 16), 0x0008 + (uint32_t(0x2218) << 16), 0x0008 + (uint32_t(0x9092) << 16), 0x0018 + (uint32_t(0x9006) << 16), 0x0018 + (uint32_t(0x9042) << 16), 0x0018 + (uint32_t(0x9045) << 16), 0x0018 + (uint32_t(0x9049) << 16), 0x0018 + (uint32_t(0x9112) << 16), 0x0018 + (uint32_t(0x9114) << 16), 0x0018 + (uint32_t(0x9115) << 16), 0x0018 + (uint32_t(0x9117) << 16), 0x0018 + (uint32_t(0x9119) << 16), 0x0018 + (uint32_t(0x9125) << 16), 0x0018 + (uint32_t(0x9152) << 16), 0x0018 + (uint32_t(0x9176) << 16), 0x0018 + (uint32_t(0x9226) << 16), 0x0018 + (uint32_t(0x9239) << 16), 0x0020 + (uint32_t(0x9071) << 16), 0x0020 + (uint32_t(0x9111) << 16), 0x0020 + (uint32_t(0x9113) << 16), 0x0020 + (uint32_t(0x9116) << 16), 0x0020 + (uint32_t(0x9221) << 16), 0x0020 + (uint32_t(0x9222) << 16), 0x0028 + (uint32_t(0x9110) << 16), 0x0028 + (uint32_t(0x9132) << 16), 0x0028 + (uint32_t(0x9145) << 16), 0x0040 + (uint32_t(0x0260) << 16), 0x0040 + (uint32_t(0x0555) << 16), 0x0040 + (uint32_t(0xa170) << 16), 0x5200 + (uint32_t(0x9229) << 16), 0x5200 + (uint32_t(0x9230) << 16)};
@@ -3987,7 +4444,7 @@ int isSQ(uint32_t groupElement, bool isPhilips) { // Detect sequence VR ("SQ") f
 
 int isDICOMfile(const char *fname) { // 0=NotDICOM, 1=DICOM, 2=Maybe(not Part 10 compliant)
 	// Someday: it might be worthwhile to detect "IMGF" at offset 3228 to warn user if they attempt to convert Signa data
-	FILE *fp = fopen(fname, "rb");
+	FILE *fp = nii_fopen(fname, "rb");
 	if (!fp)
 		return 0;
 	fseek(fp, 0, SEEK_END);
@@ -4009,6 +4466,110 @@ int isDICOMfile(const char *fname) { // 0=NotDICOM, 1=DICOM, 2=Maybe(not Part 10
 	return 0;
 } // isDICOMfile()
 
+static bool peekSeriesUidCrc(unsigned char *buffer, size_t sz, uint32_t *seriesUidCrc) {
+	// walk top-level elements of a little-endian Part 10 file up to (0020,000E)
+	if ((sz < 144) || (buffer[128] != 'D') || (buffer[129] != 'I') || (buffer[130] != 'C') || (buffer[131] != 'M'))
+		return false;
+	size_t lPos = 132;
+	bool isMeta = true;
+	bool isExplicitVR = true;
+	int manufacturer = kMANUFACTURER_UNKNOWN;
+	int sqDepth = 0;
+	while ((lPos + 12) <= sz) {
+		uint32_t group = buffer[lPos] | (buffer[lPos + 1] << 8);
+		uint32_t element = buffer[lPos + 2] | (buffer[lPos + 3] << 8);
+		if (group != 0x0002)
+			isMeta = false;
+		if (group == 0xFFFE) { // item and delimiters have no VR
+			uint32_t itemLength = buffer[lPos + 4] | (buffer[lPos + 5] << 8) | (buffer[lPos + 6] << 16) | ((uint32_t)buffer[lPos + 7] << 24);
+			lPos += 8;
+			if (element != 0xE000)
+				sqDepth--; // item or sequence delimiter
+			else if (itemLength == 0xFFFFFFFF)
+				sqDepth++;
+			else
+				lPos += itemLength;
+			if (sqDepth < 0)
+				return false;
+			continue;
+		}
+		size_t hdrBytes = 8;
+		uint32_t lLength;
+		bool isSQ = false;
+		if ((isMeta) || (isExplicitVR)) {
+			char vr[3] = {(char)buffer[lPos + 4], (char)buffer[lPos + 5], 0};
+			isSQ = (strcmp(vr, "SQ") == 0);
+			if ((isSQ) || (strcmp(vr, "OB") == 0) || (strcmp(vr, "OD") == 0) || (strcmp(vr, "OF") == 0) || (strcmp(vr, "OL") == 0) || (strcmp(vr, "OV") == 0) || (strcmp(vr, "OW") == 0) || (strcmp(vr, "SV") == 0) || (strcmp(vr, "UC") == 0) || (strcmp(vr, "UN") == 0) || (strcmp(vr, "UR") == 0) || (strcmp(vr, "UT") == 0) || (strcmp(vr, "UV") == 0)) {
+				lLength = buffer[lPos + 8] | (buffer[lPos + 9] << 8) | (buffer[lPos + 10] << 16) | ((uint32_t)buffer[lPos + 11] << 24);
+				hdrBytes = 12;
+			} else
+				lLength = buffer[lPos + 6] | (buffer[lPos + 7] << 8);
+		} else {
+			isSQ = true; // implicit VR: only sequences have undefined length
+			lLength = buffer[lPos + 4] | (buffer[lPos + 5] << 8) | (buffer[lPos + 6] << 16) | ((uint32_t)buffer[lPos + 7] << 24);
+		}
+		lPos += hdrBytes;
+		if (lLength == 0xFFFFFFFF) {
+			if (!isSQ)
+				return false; // e.g. UN of undefined length is implicit VR inside
+			sqDepth++;
+			continue;
+		}
+		if ((lPos + lLength) > sz)
+			return false;
+		if (sqDepth == 0) {
+			char txt[kDICOMStr] = {""};
+			if ((group == 0x0002) && (element == 0x0010)) { // transfer syntax
+				dcmStr(lLength, &buffer[lPos], txt);
+				if ((strcmp(txt, "1.2.840.10008.1.2.2") == 0) || (strcmp(txt, "1.2.840.10008.1.2.1.99") == 0))
+					return false; // big endian or deflated
+				isExplicitVR = (strcmp(txt, "1.2.840.10008.1.2") != 0);
+			}
+			if ((group == 0x0002) && (element == 0x0013)) { // implementation version name: issue383 MATLAB, XA10A
+				dcmStr(lLength, &buffer[lPos], txt);
+				if ((strstr(txt, "MATLAB") != NULL) || (strstr(txt, "XA10A") != NULL))
+					return false;
+			}
+			if ((group == 0x0008) && (element == 0x0070))
+				manufacturer = dcmStrManufacturer(lLength, &buffer[lPos]);
+			if ((group == 0x0018) && (element == 0x1020)) { // software versions: Siemens XA
+				dcmStr(lLength, &buffer[lPos], txt);
+				if (strstr(txt, "XA") != NULL)
+					return false;
+			}
+			if ((group == 0x0020) && (element == 0x000E)) {
+				if ((manufacturer == kMANUFACTURER_UNKNOWN) || (manufacturer == kMANUFACTURER_SIEMENS))
+					return false; // issue252, issue394: Siemens series CRC may come from other tags
+				dcmStr(lLength, &buffer[lPos], txt);
+				if (strlen(txt) < 1)
+					return false;
+				*seriesUidCrc = mz_crc32X((unsigned char *)&txt, strlen(txt));
+				return true;
+			}
+			if ((group > 0x0020) || ((group == 0x0020) && (element > 0x000E)))
+				return false; // no series instance UID
+		}
+		lPos += lLength;
+	}
+	return false;
+} // peekSeriesUidCrc()
+
+bool readDICOMseriesUidCrc(const char *fname, uint32_t *seriesUidCrc) {
+	// minimal pre-parse for series selection: reads only the leading tags of the file
+	//  returns true only if readDICOM() would certainly report the same seriesUidCrc
+	//  Siemens, MATLAB, big endian, deflated and non Part 10 files are left to the full parser
+	FILE *fp = nii_fopen(fname, "rb");
+	if (!fp)
+		return false;
+	const size_t kPeekBytes = 65536;
+	unsigned char *buffer = scratchHeader(kPeekBytes);
+	size_t sz = fread(buffer, 1, kPeekBytes, fp);
+	fclose(fp);
+	bool ret = peekSeriesUidCrc(buffer, sz, seriesUidCrc);
+	scratchHeaderFree(buffer);
+	return ret;
+} // readDICOMseriesUidCrc()
+
 // START RIR 12/2017 Robert I. Reid
 
 // Gathering spot for all the info needed to get the b value and direction
@@ -4403,7 +4964,7 @@ struct TDICOMdata readDICOMx(char *fname, struct TDCMprefs *prefs, struct TDTI4D
 		d.isExplicitVR = false;
 		isPart10prefix = false;
 	}
-	FILE *file = fopen(fname, "rb");
+	FILE *file = nii_fopen(fname, "rb");
 	if (!file) {
 		printMessage("Unable to open file %s\n", fname);
 		return d;
@@ -4439,8 +5000,9 @@ struct TDICOMdata readDICOMx(char *fname, struct TDCMprefs *prefs, struct TDTI4D
 	// printf("%d -> %d\n", MaxBufferSz, fileLen);
 	size_t lFileOffset = 0;
 	fseek(file, 0, SEEK_SET);
-	// Allocate memory
-	unsigned char *buffer = (unsigned char *)malloc(MaxBufferSz + 1);
+	// Allocate memory: header segments reuse a per-thread buffer
+	scratchReset();
+	unsigned char *buffer = scratchHeader(MaxBufferSz + 1);
 	if (!buffer) {
 		printError("Memory exhausted!");
 		fclose(file);
@@ -7923,7 +8485,7 @@ struct TDICOMdata readDICOMx(char *fname, struct TDCMprefs *prefs, struct TDTI4D
 #endif
 		lPos = lPos + (lLength);
 	} // while d.imageStart == 0
-	free(buffer);
+	scratchHeaderFree(buffer);
 	if (d.bitsStored < 0)
 		d.isValid = false;
 	// printf("%d bval=%g bvec=%g %g %g<<<\n", d.CSA.numDti, d.CSA.dtiV[0], d.CSA.dtiV[1], d.CSA.dtiV[2], d.CSA.dtiV[3]);
@@ -8680,6 +9242,23 @@ struct TDICOMdata readDICOMx(char *fname, struct TDCMprefs *prefs, struct TDTI4D
 	// printf("%g\t%g\t%s\n", d.intenIntercept, d.intenScale, fname);
 	if ((d.isLocalizer) && (strstr(d.seriesDescription, "b1map"))) // issue751 b1map uses same base as scout
 		d.isLocalizer = false;
+#ifndef myDisableOpenJPEG
+	if ((prefs->j2kReduce > 0) && (d.isValid) && (d.compressionScheme == kCompressYes) && (compressFlag != kCompressNone) && (d.CSA.mosaicSlices < 2)) {
+		// quick-look: OpenJPEG discards the finest resolution levels, each halves the columns and rows
+		int f = 1 << prefs->j2kReduce;
+		for (int i = 1; i < 4; i++) { // position is center of first voxel, which now spans f*f original voxels
+			float shift = 0.5f * (f - 1) * ((d.orient[i] * d.xyzMM[1]) + (d.orient[i + 3] * d.xyzMM[2]));
+			d.patientPosition[i] += shift;
+			d.patientPositionLast[i] += shift;
+		}
+		d.xyzDim[1] = (d.xyzDim[1] + f - 1) / f;
+		d.xyzDim[2] = (d.xyzDim[2] + f - 1) / f;
+		d.xyzMM[1] *= f;
+		d.xyzMM[2] *= f;
+		d.j2kReduce = prefs->j2kReduce;
+	}
+	d.j2kThreads = prefs->j2kThreads;
+#endif
 	free(dcmDim);
 	d.isXA = isSiemensXA;
 	return d;
@@ -8689,6 +9268,8 @@ void setDefaultPrefs(struct TDCMprefs *prefs) {
 	prefs->isVerbose = false;
 	prefs->compressFlag = kCompressSupport;
 	prefs->isIgnoreTriggerTimes = false;
+	prefs->j2kReduce = 0;
+	prefs->j2kThreads = 0;
 }
 
 struct TDICOMdata readDICOMv(char *fname, int isVerbose, int compressFlag, struct TDTI4D *dti4D) {
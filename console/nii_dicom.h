@@ -1,6 +1,7 @@
 #include "nifti1_io_core.h"
 #include <stdbool.h> //requires VS 2015 or later
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #ifndef USING_R
 #include "nifti1.h"
@@ -260,7 +261,7 @@ struct TDICOMdata {
 	int xyzDim[5];
 	uint32_t coilCrc, seriesUidCrc, instanceUidCrc;
 	int overlayStart[kMaxOverlay];
-	int postLabelDelay, shimGradientX, shimGradientY, shimGradientZ, phaseNumber, spoiling, mtState, partialFourierDirection, interp3D, aslFlags, durationLabelPulseGE, epiVersionGE, internalepiVersionGE, maxEchoNumGE, rawDataRunNumber, numberOfTR, numberOfImagesInGridUIH, numberOfDiffusionT2GE, numberOfDiffusionDirectionGE, tensorFileGE, diffCyclingModeGE, phaseEncodingGE, protocolBlockStartGE, protocolBlockLengthGE, modality, dwellTime, effectiveEchoSpacingGE, phaseEncodingLines, phaseEncodingSteps, frequencyEncodingSteps, phaseEncodingStepsOutOfPlane, echoTrainLength, echoNum, sliceOrient, manufacturer, converted2NII, acquNum, frameNum, imageNum, imageStart, offsetTableItems, imageBytes, bitsStored, bitsAllocated, samplesPerPixel, locationsInAcquisition, locationsInAcquisitionConflict, compressionScheme;
+	int postLabelDelay, shimGradientX, shimGradientY, shimGradientZ, phaseNumber, spoiling, mtState, partialFourierDirection, interp3D, aslFlags, durationLabelPulseGE, epiVersionGE, internalepiVersionGE, maxEchoNumGE, rawDataRunNumber, numberOfTR, numberOfImagesInGridUIH, numberOfDiffusionT2GE, numberOfDiffusionDirectionGE, tensorFileGE, diffCyclingModeGE, phaseEncodingGE, protocolBlockStartGE, protocolBlockLengthGE, modality, dwellTime, effectiveEchoSpacingGE, phaseEncodingLines, phaseEncodingSteps, frequencyEncodingSteps, phaseEncodingStepsOutOfPlane, echoTrainLength, echoNum, sliceOrient, manufacturer, converted2NII, acquNum, frameNum, imageNum, imageStart, offsetTableItems, imageBytes, bitsStored, bitsAllocated, samplesPerPixel, locationsInAcquisition, locationsInAcquisitionConflict, compressionScheme, j2kReduce, j2kThreads;
 	float compressedSensingFactor, xRayTubeCurrent, exposureTimeMs, numberOfExcitations, numberOfArms, numberOfPointsPerArm, groupDelay, decayFactor, scatterFraction, percentSampling, waterFatShift, numberOfAverages, patientSize, patientWeight, zSpacing, zThick, pixelBandwidth, SAR, phaseFieldofView, accelFactPE, accelFactOOP, flipAngle, fieldStrength, TE, TI, TR, intenScale, intenIntercept, intenScalePhilips, gantryTilt, lastScanLoc, angulation[4], velocityEncodeScaleGE;
 	float orient[7], patientPosition[4], patientPositionLast[4], xyzMM[4], stackOffcentre[4];
 	float rtia_timerGE, radionuclidePositronFraction, radionuclideTotalDose, radionuclideHalfLife, doseCalibrationFactor, injectedVolume, reconFilterSize; // PET ISOTOPE MODULE ATTRIBUTES (C.8-57)
@@ -278,18 +279,34 @@ struct TDICOMdata {
 };
 
 struct TDCMprefs {
-	int isVerbose, compressFlag, isIgnoreTriggerTimes;
+	int isVerbose, compressFlag, isIgnoreTriggerTimes, j2kReduce, j2kThreads; // j2kReduce: discard the finest JPEG 2000 resolution levels, j2kThreads: OpenJPEG decoder threads (0 = all CPUs)
+};
+
+#if !defined(_WIN64) && !defined(_WIN32) && !defined(USING_R) && (defined(__linux__) || defined(__APPLE__))
+#define myEnableByteSource // DICOM objects may be read from memory or a callback instead of disk (fopencookie/funopen)
+#endif
+
+typedef size_t (*TByteSourceRead)(void *user, uint64_t offset, void *buf, size_t len); // pread-style: return bytes copied to buf
+
+struct TByteSource {
+	const char *name;			 // virtual file name, e.g. "study/series/IM0001.dcm": used in place of a path for sorting and naming
+	const unsigned char *buffer; // entire object in memory, or NULL to use readFunc
+	uint64_t bytes;				 // size of object in bytes
+	TByteSourceRead readFunc;	 // only used if buffer is NULL
+	void *user;					 // passed to readFunc
 };
 
 size_t nii_ImgBytes(struct nifti_1_header hdr);
 void setDefaultPrefs(struct TDCMprefs *prefs);
 int isSameFloatGE(float a, float b);
+uint32_t mz_crc32X(unsigned char *ptr, size_t buf_len);
 void getFileNameX(char *pathParent, const char *path, int maxLen);
 struct TDICOMdata readDICOMv(char *fname, int isVerbose, int compressFlag, struct TDTI4D *dti4D);
 struct TDICOMdata readDICOMx(char *fname, struct TDCMprefs *prefs, struct TDTI4D *dti4D);
 struct TDICOMdata readDICOM(char *fname);
 struct TDICOMdata clear_dicom_data(void);
 struct TDICOMdata nii_readParRec(char *parname, int isVerbose, struct TDTI4D *dti4D, bool isReadPhase);
+void nii_flipYhdr(struct nifti_1_header *h);
 unsigned char *nii_flipY(unsigned char *bImg, struct nifti_1_header *h);
 unsigned char *nii_flipImgY(unsigned char *bImg, struct nifti_1_header *hdr);
 unsigned char *nii_flipZ(unsigned char *bImg, struct nifti_1_header *h);
@@ -297,10 +314,17 @@ unsigned char *nii_flipZ(unsigned char *bImg, struct nifti_1_header *h);
 void changeExt(char *file_name, const char *ext);
 unsigned char *nii_planar2rgb(unsigned char *bImg, struct nifti_1_header *hdr, int isPlanar);
 int isDICOMfile(const char *fname); // 0=not DICOM, 1=DICOM, 2=NOTSURE(not part 10 compliant)
+bool readDICOMseriesUidCrc(const char *fname, uint32_t *seriesUidCrc); // true if series CRC is known from leading tags alone
+FILE *nii_fopen(const char *fname, const char *mode); // fopen() that also resolves registered byte sources
+#ifdef myEnableByteSource
+int nii_setByteSources(struct TByteSource *sources, int nSources); // caller retains ownership of names and buffers until nii_clearByteSources()
+void nii_clearByteSources(void);
+#endif
 void setQSForm(struct nifti_1_header *h, mat44 Q44i, bool isVerbose);
 int headerDcm2Nii2(struct TDICOMdata d, struct TDICOMdata d2, struct nifti_1_header *h, int isVerbose);
 int headerDcm2Nii(struct TDICOMdata d, struct nifti_1_header *h, bool isComputeSForm);
 unsigned char *nii_loadImgXL(char *imgname, struct nifti_1_header *hdr, struct TDICOMdata dcm, bool iVaries, int compressFlag, int isVerbose, struct TDTI4D *dti4D);
+int nii_loadImgXLInto(char *imgname, struct nifti_1_header *hdr, struct TDICOMdata dcm, bool iVaries, int compressFlag, int isVerbose, struct TDTI4D *dti4D, unsigned char *dst, size_t dstBytes);
 #ifdef USING_DCM2NIIXFSWRAPPER
 void remove_specialchars(char *buf);
 #endif
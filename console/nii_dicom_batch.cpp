@@ -23,6 +23,13 @@
 #else
 #include <zlib.h>
 #endif
+#ifdef myEnableLibdeflate
+#include <libdeflate.h>
+#endif
+#ifdef myEnableISAL
+#include <isa-l/crc.h>
+#include <isa-l/igzip_lib.h>
+#endif
 #else
 #undef MiniZ
 #endif
@@ -44,6 +51,7 @@
 #endif
 #include <ctype.h> //toupper
 #include <float.h>
+#include <limits.h> // INT_MAX
 #include <math.h>
 #include <stdbool.h> //requires VS 2015 or later
 #include <stddef.h>
@@ -56,6 +64,18 @@
 #if defined(_WIN64) || defined(_WIN32)
 #include <windows.h> //write to registry
 #endif
+#ifdef _OPENMP
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <omp.h>
+#include <thread>
+#endif
+#ifdef myEnableWatchDir
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#endif
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
@@ -114,22 +134,44 @@ const char kFileSep[2] = "/";
 // no .nii, .bval, .bvec are created.
 MRIFSSTRUCT mrifsStruct;
 std::vector<MRIFSSTRUCT> mrifsStruct_vector;
+static MRIFSSERIES_CALLBACK mrifsSeriesCallback = NULL;
+static void *mrifsSeriesUser = NULL;
+
+// free the image, dti and dicom file names referenced by the struct, leaving NULL pointers
+static void nii_freeMrifsBuffers(MRIFSSTRUCT *s) {
+	free(s->imgM);
+	s->imgM = NULL;
+	free(s->tdti);
+	s->tdti = NULL;
+	free(s->dicomfile);
+	s->dicomfile = NULL;
+	if (s->dicomlst != NULL) {
+		for (int n = 0; n < s->nDcm; n++)
+			free(s->dicomlst[n]);
+		free(s->dicomlst);
+		s->dicomlst = NULL;
+	}
+}
+
+// true once mrifsStruct has been pushed to the vector: the vector entry then owns its buffers
+static bool mrifsStructIsView = false;
+
+// start a new series: release buffers mrifsStruct still owns and clear every per-series field
+static void nii_resetMrifsStruct() {
+	if (!mrifsStructIsView)
+		nii_freeMrifsBuffers(&mrifsStruct);
+	memset(&mrifsStruct, 0, sizeof(mrifsStruct));
+	mrifsStructIsView = false;
+}
 
 // retrieve the struct
 MRIFSSTRUCT *nii_getMrifsStruct() {
 	return &mrifsStruct;
 }
 
-// free the memory used for the image and dti
+// free the memory used for the image and dti, unless it belongs to a series in the vector
 void nii_clrMrifsStruct() {
-	free(mrifsStruct.imgM);
-	free(mrifsStruct.tdti);
-
-	for (int n = 0; n < mrifsStruct.nDcm; n++)
-		free(mrifsStruct.dicomlst[n]);
-
-	if (mrifsStruct.dicomlst != NULL)
-		free(mrifsStruct.dicomlst);
+	nii_resetMrifsStruct();
 }
 
 // retrieve the struct
@@ -137,19 +179,65 @@ std::vector<MRIFSSTRUCT> *nii_getMrifsStructVector() {
 	return &mrifsStruct_vector;
 }
 
-// free the memory used for the image and dti
+// free the memory used for the image and dti of every series, mrifsStruct is cleared if it refers to one of them
 void nii_clrMrifsStructVector() {
 	int nitem = mrifsStruct_vector.size();
-	for (int n = 0; n < nitem; n++) {
-		free(mrifsStruct_vector[n].imgM);
-		free(mrifsStruct_vector[n].tdti);
+	for (int n = 0; n < nitem; n++)
+		nii_freeMrifsBuffers(&mrifsStruct_vector[n]);
+	mrifsStruct_vector.clear();
+	if (mrifsStructIsView)
+		memset(&mrifsStruct, 0, sizeof(mrifsStruct));
+	mrifsStructIsView = false;
+}
+
+MRIFSSERIES::MRIFSSERIES(MRIFSSTRUCT *src) {
+	mrifs = (MRIFSSTRUCT *)malloc(sizeof(MRIFSSTRUCT));
+	memcpy(mrifs, src, sizeof(MRIFSSTRUCT));
+	memset(src, 0, sizeof(MRIFSSTRUCT));
+}
+
+MRIFSSERIES::MRIFSSERIES(MRIFSSERIES &&other) {
+	mrifs = other.mrifs;
+	other.mrifs = NULL;
+}
+
+MRIFSSERIES &MRIFSSERIES::operator=(MRIFSSERIES &&other) {
+	if (this != &other) {
+		if (mrifs != NULL)
+			nii_freeMrifsBuffers(mrifs);
+		free(mrifs);
+		mrifs = other.mrifs;
+		other.mrifs = NULL;
+	}
+	return *this;
+}
 
-		for (int n = 0; n < mrifsStruct.nDcm; n++)
-			free(mrifsStruct_vector[n].dicomlst[n]);
+MRIFSSERIES::~MRIFSSERIES() {
+	if (mrifs != NULL)
+		nii_freeMrifsBuffers(mrifs);
+	free(mrifs);
+}
+
+void nii_setMrifsSeriesCallback(MRIFSSERIES_CALLBACK callback, void *user) {
+	mrifsSeriesCallback = callback;
+	mrifsSeriesUser = user;
+}
 
-		if (mrifsStruct_vector[n].dicomlst != NULL)
-			free(mrifsStruct_vector[n].dicomlst);
+// hand the completed series to the callback (ownership moves, nothing is copied) or keep it in the vector
+static void nii_emitMrifsStruct() {
+	if (mrifsSeriesCallback != NULL) {
+		mrifsSeriesCallback(MRIFSSERIES(&mrifsStruct), mrifsSeriesUser);
+		return;
 	}
+	mrifsStruct_vector.push_back(mrifsStruct);
+	mrifsStructIsView = true;
+}
+
+// each emitted series owns a copy of the name of its first DICOM file
+static void nii_setMrifsDicomfile(const char *fname) {
+	int len_dicomfile = strlen(fname);
+	mrifsStruct.dicomfile = (char *)malloc(len_dicomfile + 1);
+	memcpy(mrifsStruct.dicomfile, fname, len_dicomfile + 1);
 }
 #endif
 
@@ -267,6 +355,10 @@ void opts2Prefs(struct TDCMopts *opts, struct TDCMprefs *prefs) {
 	prefs->isVerbose = opts->isVerbose;
 	prefs->compressFlag = opts->compressFlag;
 	prefs->isIgnoreTriggerTimes = opts->isIgnoreTriggerTimes;
+	prefs->j2kReduce = opts->j2kReduce;
+#ifdef _OPENMP
+	prefs->j2kThreads = (opts->threadsDecode > 0) ? opts->threadsDecode : omp_get_max_threads(); // JPEG 2000 slices are decoded one at a time, with the "--threads" decode budget
+#endif
 }
 
 void geCorrectBvecs(struct TDICOMdata *d, int sliceDir, struct TDTI *vx, int isVerbose) {
@@ -733,7 +825,7 @@ void siemensCsaAscii(const char *filename, TCsaAscii *csaAscii, int csaOffset, i
 	strcpy(protocolName, "");
 	if ((csaOffset < 0) || (csaLength < 8))
 		return;
-	FILE *pFile = fopen(filename, "rb");
+	FILE *pFile = nii_fopen(filename, "rb");
 	if (pFile == NULL)
 		return;
 	fseek(pFile, 0, SEEK_END);
@@ -985,6 +1077,50 @@ void siemensCsaAscii(const char *filename, TCsaAscii *csaAscii, int csaOffset, i
 	return;
 } // siemensCsaAscii()
 
+struct TCsaAsciiCache {
+	// last parsed CSASeriesHeaderInfo: identical for every output (echo, volume split) of a series
+	//  keyed on the SeriesInstanceUID itself, seriesUidCrc is only the series number with "-m 2"
+	bool isValid;
+	char seriesInstanceUID[kDICOMStr];
+	int csaOffset, csaLength;
+	TCsaAscii csaAscii;
+	float shimSetting[8];
+	char coilID[kDICOMStrLarge], consistencyInfo[kDICOMStrLarge], coilElements[kDICOMStrLarge], pulseSequenceDetails[kDICOMStrLarge], fmriExternalInfo[kDICOMStrLarge], protocolName[kDICOMStrLarge];
+	char wipMemBlock[kDICOMStrExtraLarge];
+};
+struct TCsaAsciiCacheHolder {
+	struct TCsaAsciiCache *cache;
+	~TCsaAsciiCacheHolder() {
+		free(cache);
+	}
+};
+static thread_local struct TCsaAsciiCacheHolder csaAsciiCache;
+
+void siemensCsaAsciiCached(const char *filename, const char *seriesInstanceUID, TCsaAscii *csaAscii, int csaOffset, int csaLength, float *shimSetting, char *coilID, char *consistencyInfo, char *coilElements, char *pulseSequenceDetails, char *fmriExternalInfo, char *protocolName, char *wipMemBlock) {
+	// avoid re-reading and re-parsing the same series header for each sidecar of a series
+	if (csaAsciiCache.cache == NULL) {
+		csaAsciiCache.cache = (struct TCsaAsciiCache *)malloc(sizeof(struct TCsaAsciiCache));
+		csaAsciiCache.cache->isValid = false;
+	}
+	struct TCsaAsciiCache *cache = csaAsciiCache.cache;
+	if ((!cache->isValid) || (strlen(seriesInstanceUID) < 1) || (strcmp(cache->seriesInstanceUID, seriesInstanceUID) != 0) || (cache->csaOffset != csaOffset) || (cache->csaLength != csaLength)) {
+		siemensCsaAscii(filename, &cache->csaAscii, csaOffset, csaLength, cache->shimSetting, cache->coilID, cache->consistencyInfo, cache->coilElements, cache->pulseSequenceDetails, cache->fmriExternalInfo, cache->protocolName, cache->wipMemBlock);
+		cache->isValid = true;
+		snprintf(cache->seriesInstanceUID, kDICOMStr, "%s", seriesInstanceUID);
+		cache->csaOffset = csaOffset;
+		cache->csaLength = csaLength;
+	}
+	*csaAscii = cache->csaAscii;
+	memcpy(shimSetting, cache->shimSetting, sizeof(cache->shimSetting));
+	strcpy(coilID, cache->coilID);
+	strcpy(consistencyInfo, cache->consistencyInfo);
+	strcpy(coilElements, cache->coilElements);
+	strcpy(pulseSequenceDetails, cache->pulseSequenceDetails);
+	strcpy(fmriExternalInfo, cache->fmriExternalInfo);
+	strcpy(protocolName, cache->protocolName);
+	strcpy(wipMemBlock, cache->wipMemBlock);
+} // siemensCsaAsciiCached()
+
 #endif // myReadAsciiCsa()
 
 #ifndef myDisableZLib
@@ -1001,7 +1137,7 @@ int geProtocolBlock(const char *filename, int geOffset, int geLength, int isVerb
 	int ret = EXIT_FAILURE;
 	if ((geOffset < 0) || (geLength < 20))
 		return ret;
-	FILE *pFile = fopen(filename, "rb");
+	FILE *pFile = nii_fopen(filename, "rb");
 	if (pFile == NULL)
 		return ret;
 	fseek(pFile, 0, SEEK_END);
@@ -1239,13 +1375,267 @@ void rescueProtocolName(struct TDICOMdata *d, const char *filename) {
 	float shimSetting[8];
 	char protocolName[kDICOMStrLarge], fmriExternalInfo[kDICOMStrLarge], coilID[kDICOMStrLarge], consistencyInfo[kDICOMStrLarge], coilElements[kDICOMStrLarge], pulseSequenceDetails[kDICOMStrLarge], wipMemBlock[kDICOMStrExtraLarge];
 	TCsaAscii csaAscii;
-	siemensCsaAscii(filename, &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
+	siemensCsaAsciiCached(filename, d->seriesInstanceUID, &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
 	if (strlen(protocolName) >= kDICOMStr)
 		protocolName[kDICOMStr - 1] = 0;
 	strcpy(d->protocolName, protocolName);
 #endif
 }
 
+// "--stats" telemetry: wall and CPU time per stage, and per output series the bytes read,
+//  decode time by codec, reorientation and compression time, bytes written and peak image buffer
+#define kStatsStages 3
+#define kStatsCodecs 7 // kCompressNone..kCompressJPEGLS
+static const char *kStatsStageNames[kStatsStages] = {"SearchFiles", "ReadHeaders", "ConvertSeries"};
+static const char *kStatsCodecNames[kStatsCodecs] = {"none", "JPEG2000", "JPEGLossless", "JPEGBaseline", "RLE", "PMSCT_RLE1", "JPEGLS"};
+
+struct TStatsSeries {
+	char name[PATH_MAX];
+	int nFiles, codec, gzLevel; // gzLevel > 0 if chosen adaptively ("--gz-target-mbps")
+	uint64_t bytesRead, bytesUncompressed, bytesWritten, peakBuffer;
+	double wall, cpu, decode, reorient, compress, gzSampleMBps, gzSampleRatio;
+};
+
+struct TStats {
+	bool isEnabled;
+	double startWall, stageWall[kStatsStages], stageCPU[kStatsStages], codecSec[kStatsCodecs];
+	clock_t startCPU;
+	int nFilesParsed, codecDecodes[kStatsCodecs], nSeries, maxSeries;
+	uint64_t bytesParsed;
+	struct TStatsSeries *series, *current; // current = NULL unless a series is being converted
+};
+
+static struct TStats stats = {false};
+
+#ifdef _OPENMP
+// header readers, the converter, parallel decodes and the gz writer all report: updates hold statsLock
+static std::mutex statsLock;
+#define STATS_LOCK() std::lock_guard<std::mutex> statsGuard(statsLock)
+#else
+#define STATS_LOCK()
+#endif
+
+size_t fileBytes(const char *fname);
+
+double statsWallTime(void) {
+#if defined(_WIN64) || defined(_WIN32)
+	return (double)clock() / CLOCKS_PER_SEC; // Windows clock() reports elapsed time
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+} // statsWallTime()
+
+double statsTic(void) {
+	if (!stats.isEnabled)
+		return 0.0;
+	return statsWallTime();
+} // statsTic()
+
+void statsReorient(double tic) {
+	if (!stats.isEnabled)
+		return;
+	double sec = statsWallTime() - tic;
+	STATS_LOCK();
+	if (stats.current != NULL)
+		stats.current->reorient += sec;
+} // statsReorient()
+
+void statsInit(struct TDCMopts *opts) {
+	if ((stats.isEnabled) || (strlen(opts->statsname) < 1))
+		return;
+	memset(&stats, 0, sizeof(stats));
+	stats.isEnabled = true;
+	stats.startWall = statsWallTime();
+	stats.startCPU = clock();
+} // statsInit()
+
+void statsStage(int stage, double *wall, clock_t *cpu) {
+	// accumulate time since *wall and *cpu, then restart the clocks for the next stage
+	if (!stats.isEnabled)
+		return;
+	double now = statsWallTime();
+	clock_t nowCPU = clock();
+	STATS_LOCK();
+	stats.stageWall[stage] += now - *wall;
+	stats.stageCPU[stage] += ((double)(nowCPU - *cpu)) / CLOCKS_PER_SEC;
+	*wall = now;
+	*cpu = nowCPU;
+} // statsStage()
+
+void statsParsed(const char *fname) {
+	if (!stats.isEnabled)
+		return;
+	size_t bytes = fileBytes(fname);
+	STATS_LOCK();
+	stats.nFilesParsed++;
+	stats.bytesParsed += bytes;
+} // statsParsed()
+
+void statsDecode(int codec, double tic) {
+	if (!stats.isEnabled)
+		return;
+	double sec = statsWallTime() - tic;
+	STATS_LOCK();
+	if (stats.current == NULL)
+		return;
+	stats.current->decode += sec;
+	if ((codec < 0) || (codec >= kStatsCodecs))
+		return;
+	stats.codecSec[codec] += sec;
+	stats.codecDecodes[codec]++;
+} // statsDecode()
+
+void statsBuffer(uint64_t bytes) {
+	if (!stats.isEnabled)
+		return;
+	STATS_LOCK();
+	if ((stats.current != NULL) && (bytes > stats.current->peakBuffer))
+		stats.current->peakBuffer = bytes;
+} // statsBuffer()
+
+void statsSeriesName(const char *pathoutname) {
+	if (!stats.isEnabled)
+		return;
+	STATS_LOCK();
+	if ((stats.current != NULL) && (strlen(stats.current->name) < 1))
+		snprintf(stats.current->name, PATH_MAX, "%s", pathoutname);
+} // statsSeriesName()
+
+int statsSeriesIndex(void) {
+	// series being converted, -1 if none: the gz writer reports to it after the converter has moved on
+	if (!stats.isEnabled)
+		return -1;
+	STATS_LOCK();
+	return (stats.current == NULL) ? -1 : (int)(stats.current - stats.series);
+} // statsSeriesIndex()
+
+void statsOutputSeries(int series, const char *fname, size_t uncompressedBytes, double compressTic) {
+	// record an image of series written to disk: compressTic is 0 for uncompressed output
+	if ((!stats.isEnabled) || (series < 0))
+		return;
+	double sec = (compressTic > 0.0) ? statsWallTime() - compressTic : 0.0;
+	size_t bytes = fileBytes(fname);
+	STATS_LOCK();
+	struct TStatsSeries *ss = &stats.series[series];
+	ss->compress += sec;
+	ss->bytesUncompressed += uncompressedBytes;
+	ss->bytesWritten += bytes;
+} // statsOutputSeries()
+
+void statsOutput(const char *fname, size_t uncompressedBytes, double compressTic) {
+	statsOutputSeries(statsSeriesIndex(), fname, uncompressedBytes, compressTic);
+} // statsOutput()
+
+void statsGzLevel(int gzLevel, double sampleMBps, double sampleRatio) {
+	// adaptive gz decision for the latest image of the current series
+	if (!stats.isEnabled)
+		return;
+	STATS_LOCK();
+	if (stats.current == NULL)
+		return;
+	stats.current->gzLevel = gzLevel;
+	stats.current->gzSampleMBps = sampleMBps;
+	stats.current->gzSampleRatio = sampleRatio;
+} // statsGzLevel()
+
+int statsSeriesBegin(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[], struct TSearchList *nameList) {
+	if (!stats.isEnabled)
+		return -1;
+	uint64_t bytesRead = 0;
+	for (int i = 0; i < nConvert; i++)
+		bytesRead += fileBytes(nameList->str[dcmSort[i].indx]);
+	STATS_LOCK();
+	if (stats.nSeries >= stats.maxSeries) {
+		stats.maxSeries = (stats.maxSeries < 64) ? 64 : stats.maxSeries * 2;
+		stats.series = (struct TStatsSeries *)realloc(stats.series, stats.maxSeries * sizeof(struct TStatsSeries));
+	}
+	struct TStatsSeries *ss = &stats.series[stats.nSeries];
+	memset(ss, 0, sizeof(struct TStatsSeries));
+	ss->nFiles = nConvert;
+	ss->codec = dcmList[dcmSort[0].indx].compressionScheme;
+	ss->bytesRead = bytesRead;
+	ss->wall = statsWallTime();
+	ss->cpu = ((double)clock()) / CLOCKS_PER_SEC;
+	stats.current = ss;
+	return stats.nSeries++;
+} // statsSeriesBegin()
+
+void statsSeriesEnd(int series) {
+	if (series < 0)
+		return;
+	STATS_LOCK();
+	struct TStatsSeries *ss = &stats.series[series];
+	ss->wall = statsWallTime() - ss->wall;
+	ss->cpu = (((double)clock()) / CLOCKS_PER_SEC) - ss->cpu;
+	stats.current = NULL;
+} // statsSeriesEnd()
+
+int nii_saveStats(struct TDCMopts *opts) {
+	// "--stats json" reports to stderr, otherwise "--stats <file>" writes a JSON file
+	if (!stats.isEnabled)
+		return EXIT_SUCCESS;
+	FILE *fp = stderr;
+	bool isStdErr = (strcmp(opts->statsname, "json") == 0);
+	if (!isStdErr) {
+		fp = fopen(opts->statsname, "w");
+		if (fp == NULL) {
+			printError("Unable to write statistics to %s\n", opts->statsname);
+			return EXIT_FAILURE;
+		}
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"ConversionSoftwareVersion\": \"%s\",\n", kDCMdate);
+	fprintf(fp, "\t\"WallSeconds\": %g,\n", statsWallTime() - stats.startWall);
+	fprintf(fp, "\t\"CPUSeconds\": %g,\n", ((double)(clock() - stats.startCPU)) / CLOCKS_PER_SEC);
+	fprintf(fp, "\t\"FilesParsed\": %d,\n", stats.nFilesParsed);
+	fprintf(fp, "\t\"BytesParsed\": %llu,\n", (unsigned long long)stats.bytesParsed);
+#ifndef myDisableZLib
+	fprintf(fp, "\t\"GzBackend\": \"%s\",\n", nii_gzBackendName(opts->gzBackend));
+	if (opts->gzTargetMBps > 0)
+		fprintf(fp, "\t\"GzTargetMBps\": %d,\n", opts->gzTargetMBps);
+	if (opts->gzTargetRatio > 0.0)
+		fprintf(fp, "\t\"GzTargetRatio\": %g,\n", opts->gzTargetRatio);
+#endif
+	fprintf(fp, "\t\"Stages\": [\n");
+	for (int i = 0; i < kStatsStages; i++)
+		fprintf(fp, "\t\t{\"Stage\": \"%s\", \"WallSeconds\": %g, \"CPUSeconds\": %g}%s\n", kStatsStageNames[i], stats.stageWall[i], stats.stageCPU[i], (i < (kStatsStages - 1)) ? "," : "");
+	fprintf(fp, "\t],\n");
+	fprintf(fp, "\t\"Codecs\": [");
+	bool isFirst = true;
+	for (int i = 0; i < kStatsCodecs; i++) {
+		if (stats.codecDecodes[i] < 1)
+			continue;
+		fprintf(fp, "%s\n\t\t{\"Codec\": \"%s\", \"Decodes\": %d, \"DecodeSeconds\": %g}", isFirst ? "" : ",", kStatsCodecNames[i], stats.codecDecodes[i], stats.codecSec[i]);
+		isFirst = false;
+	}
+	fprintf(fp, "\n\t],\n");
+	fprintf(fp, "\t\"Series\": [");
+	for (int i = 0; i < stats.nSeries; i++) {
+		struct TStatsSeries *ss = &stats.series[i];
+		fprintf(fp, "%s\n\t\t{", (i > 0) ? "," : "");
+		json_Str(fp, "\"Name\": \"%s\", ", ss->name);
+		const char *codec = ((ss->codec >= 0) && (ss->codec < kStatsCodecs)) ? kStatsCodecNames[ss->codec] : "unknown";
+		fprintf(fp, "\"Files\": %d, \"Codec\": \"%s\", \"BytesRead\": %llu, ", ss->nFiles, codec, (unsigned long long)ss->bytesRead);
+		fprintf(fp, "\"DecodeSeconds\": %g, \"ReorientSeconds\": %g, \"CompressSeconds\": %g, ", ss->decode, ss->reorient, ss->compress);
+		if (ss->gzLevel > 0)
+			fprintf(fp, "\"GzLevel\": %d, \"GzSampleMBps\": %g, \"GzSampleRatio\": %g, ", ss->gzLevel, ss->gzSampleMBps, ss->gzSampleRatio);
+		double ratio = (ss->bytesWritten > 0) ? (double)ss->bytesUncompressed / (double)ss->bytesWritten : 0.0;
+		fprintf(fp, "\"BytesUncompressed\": %llu, \"BytesWritten\": %llu, \"CompressionRatio\": %g, ", (unsigned long long)ss->bytesUncompressed, (unsigned long long)ss->bytesWritten, ratio);
+		fprintf(fp, "\"PeakBufferBytes\": %llu, \"WallSeconds\": %g, \"CPUSeconds\": %g}", (unsigned long long)ss->peakBuffer, ss->wall, ss->cpu);
+	}
+	fprintf(fp, "\n\t]\n");
+	fprintf(fp, "}\n");
+	if (!isStdErr)
+		fclose(fp);
+	free(stats.series);
+	memset(&stats, 0, sizeof(stats));
+	return EXIT_SUCCESS;
+} // nii_saveStats()
+
+#define kJsonBufferBytes 65536 // stdio buffer of a sidecar: typical sidecars are a few KB
+
 void nii_SaveBIDSX(char pathoutname[], struct TDICOMdata d, struct TDCMopts opts, struct nifti_1_header *h, const char *filename, struct TDTI4D *dti4D) {
 	// https://docs.google.com/document/d/1HFUkAEE-pB-angVcYe6pf_-fVf4sCpOHKesUvfb8Grc/edit#
 	//  Generate Brain Imaging Data Structure (BIDS) info
@@ -1269,7 +1659,22 @@ void nii_SaveBIDSX(char pathoutname[], struct TDICOMdata d, struct TDCMopts opts
 	if (fp == NULL)
 		fp = fopen(txtname, "w");
 #else
-	FILE *fp = fopen(txtname, "w");
+	FILE *fp = NULL;
+	char *fpBuffer = NULL;
+#if !defined(_WIN64) && !defined(_WIN32)
+	char *jsonBuffer = NULL;
+	size_t jsonBytes = 0;
+	if ((opts.output != NULL) && (opts.output->json != NULL))
+		fp = open_memstream(&jsonBuffer, &jsonBytes); // sidecar is handed to caller rather than written to disk
+	if (fp == NULL)
+#endif
+	{
+		fp = fopen(txtname, "w");
+		// sidecars up to kJsonBufferBytes reach the disk with a single write when closed, larger ones with one write each time the buffer fills
+		fpBuffer = (char *)malloc(kJsonBufferBytes);
+		if ((fp != NULL) && (fpBuffer != NULL))
+			setvbuf(fp, fpBuffer, _IOFBF, kJsonBufferBytes);
+	}
 #endif
 	fprintf(fp, "{\n");
 	switch (d.modality) {
@@ -1851,7 +2256,7 @@ tse3d: T2*/
 		float shimSetting[8];
 		char protocolName[kDICOMStrLarge], fmriExternalInfo[kDICOMStrLarge], coilID[kDICOMStrLarge], consistencyInfo[kDICOMStrLarge], coilElements[kDICOMStrLarge], pulseSequenceDetails[kDICOMStrLarge], wipMemBlock[kDICOMStrExtraLarge];
 		TCsaAscii csaAscii;
-		siemensCsaAscii(filename, &csaAscii, d.CSA.SeriesHeader_offset, d.CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
+		siemensCsaAsciiCached(filename, d.seriesInstanceUID, &csaAscii, d.CSA.SeriesHeader_offset, d.CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
 		if ((d.phaseEncodingLines < 1) && (csaAscii.phaseEncodingLines > 0))
 			d.phaseEncodingLines = csaAscii.phaseEncodingLines;
 		// if (d.phaseEncodingLines != csaAscii.phaseEncodingLines) //e.g. phaseOversampling
@@ -2474,41 +2879,77 @@ tse3d: T2*/
 	// fprintf(fp, "\t\"ConversionSoftwareVersion\": \"%s\"\n", kDCMvers );kDCMdate
 	fprintf(fp, "}\n");
 	fclose(fp);
+#ifndef USING_R
+	free(fpBuffer);
+#endif
+#if !defined(_WIN64) && !defined(_WIN32) && !defined(USING_R)
+	if (jsonBuffer != NULL) {
+		opts.output->json(opts.output->user, pathoutname, jsonBuffer, jsonBytes);
+		free(jsonBuffer);
+	}
+#endif
 } // nii_SaveBIDSX()
 
-void swapEndian(struct nifti_1_header *hdr, unsigned char *im, bool isNative) {
-	// swap endian from big->little or little->big
-	//  must be told which is native to detect datatype and number of voxels
-	//  one could also auto-detect: hdr->sizeof_hdr==348
-	if (!isNative)
-#if defined(USING_MGH_NIFTI_IO) || defined(USING_R)
-		swap_nifti_header(hdr, 1);
-#else
-		swap_nifti_header(hdr);
-#endif
-	int nVox = 1;
-	for (int i = 1; i < 8; i++)
-		if (hdr->dim[i] > 1)
-			nVox = nVox * hdr->dim[i];
-	int bitpix = hdr->bitpix;
-	int datatype = hdr->datatype;
-	if (isNative)
+void swapEndianHdr(struct nifti_1_header *hdr) {
+	// swap only the header, e.g. a copy that is written while the image is byte-swapped on the fly
 #if defined(USING_MGH_NIFTI_IO) || defined(USING_R)
-		swap_nifti_header(hdr, 1);
+	swap_nifti_header(hdr, 1);
 #else
-		swap_nifti_header(hdr);
+	swap_nifti_header(hdr);
 #endif
-	if (datatype == DT_RGBA32)
-		return;
-	// n.b. do not swap 8-bit, 24-bit RGB, and 32-bit RGBA
-	if (bitpix == 16)
-		nifti_swap_2bytes(nVox, im);
-	if (bitpix == 32)
-		nifti_swap_4bytes(nVox, im);
-	if (bitpix == 64)
-		nifti_swap_8bytes(nVox, im);
 }
 
+int swapEndianBytes(struct nifti_1_header *hdr) {
+	// bytes per swapped element for a native-endian header, 0 if voxels are stored byte-wise
+	//  n.b. do not swap 8-bit, 24-bit RGB, and 32-bit RGBA
+	if (hdr->datatype == DT_RGBA32)
+		return 0;
+	if ((hdr->bitpix == 16) || (hdr->bitpix == 32) || (hdr->bitpix == 64))
+		return hdr->bitpix / 8;
+	return 0;
+}
+
+#define kSwapChunkBytes 262144 // bounce buffer for byte-swapped output, multiple of 8
+
+void swapEndianCopy(unsigned char *dst, const unsigned char *src, size_t bytes, int swapBytes) {
+	// byte-reversing copy: fixed-width loops compilers turn into vector shuffles
+	if (swapBytes == 2) {
+		for (size_t i = 0; i < bytes; i += 2) {
+			dst[i] = src[i + 1];
+			dst[i + 1] = src[i];
+		}
+	} else if (swapBytes == 4) {
+		for (size_t i = 0; i < bytes; i += 4) {
+			dst[i] = src[i + 3];
+			dst[i + 1] = src[i + 2];
+			dst[i + 2] = src[i + 1];
+			dst[i + 3] = src[i];
+		}
+	} else if (swapBytes == 8) {
+		for (size_t i = 0; i < bytes; i += 8)
+			for (int j = 0; j < 8; j++)
+				dst[i + j] = src[i + 7 - j];
+	} else
+		memcpy(dst, src, bytes);
+}
+
+size_t fwriteSwapped(const unsigned char *im, size_t imgsz, int swapBytes, FILE *fp) {
+	// write image, byte-swapping through a small bounce buffer so the caller's image is never modified
+	if (swapBytes < 2)
+		return fwrite(im, 1, imgsz, fp);
+	unsigned char *buf = (unsigned char *)malloc(kSwapChunkBytes);
+	size_t written = 0;
+	for (size_t pos = 0; pos < imgsz; pos += kSwapChunkBytes) {
+		size_t n = imgsz - pos;
+		if (n > kSwapChunkBytes)
+			n = kSwapChunkBytes;
+		swapEndianCopy(buf, &im[pos], n, swapBytes);
+		written += fwrite(buf, 1, n, fp);
+	}
+	free(buf);
+	return written;
+} // fwriteSwapped()
+
 #ifndef USING_R
 
 void nii_SaveBIDS(char pathoutname[], struct TDICOMdata d, struct TDCMopts opts, struct nifti_1_header *h, const char *filename) {
@@ -2564,35 +3005,75 @@ unsigned char *reorderVolumes(struct nifti_1_header *hdr, unsigned char *inImg,
 	//  volOrderIndex[0] reports location of desired first volume
 	//  complicated by fact that 4D DTI data is often huge
 	//  simple solutions would create an output buffer that would double RAM usage (2 *numVol)
-	//  here we bubble-sort volumes in place to use numVols+1 memory
+	//  here we follow each cycle of the permutation in place to use numVols+1 memory,
+	//  so every volume is copied at most once (plus once for the first volume of each cycle)
 	int numVol = hdr->dim[4];
-	int numVolBytes = hdr->dim[1] * hdr->dim[2] * hdr->dim[3] * (hdr->bitpix / 8);
-	int *inPos = (int *)malloc(numVol * sizeof(int));
-	for (int i = 0; i < numVol; i++)
-		inPos[i] = i;
-	unsigned char *tempVol = (unsigned char *)malloc(numVolBytes);
+	size_t numVolBytes = (size_t)hdr->dim[1] * hdr->dim[2] * hdr->dim[3] * (hdr->bitpix / 8);
+	if ((!volOrderIndex) || (numVol < 2) || (numVolBytes < 1)) {
+		free(volOrderIndex);
+		return inImg;
+	}
+	// volOrderIndex may list only the leading volumes (e.g. ADC excluded): complete the permutation,
+	//  appending unlisted volumes in their original order
+	int *srcVol = (int *)malloc(numVol * sizeof(int));
+	unsigned char *isDone = (unsigned char *)calloc(numVol, sizeof(unsigned char));
 	for (int o = 0; o < numVol; o++) {
-		int i = inPos[volOrderIndex[o]]; // input volume
-		if (i == o)
-			continue;														   // volume in correct order
-		memcpy(&tempVol[0], &inImg[o * numVolBytes], numVolBytes);			   // make temp
-		memcpy(&inImg[o * numVolBytes], &inImg[i * numVolBytes], numVolBytes); // copy volume to desire location dest, src, bytes
-		memcpy(&inImg[i * numVolBytes], &tempVol[0], numVolBytes);			   // copy unsorted volume
-		inPos[o] = i;
-	} // for each volume
-	free(inPos);
+		int i = volOrderIndex[o];
+		srcVol[o] = -1;
+		if ((i < 0) || (i >= numVol) || (isDone[i]))
+			continue;
+		srcVol[o] = i;
+		isDone[i] = 1;
+	}
+	int nextUnused = 0;
+	for (int o = 0; o < numVol; o++) {
+		if (srcVol[o] >= 0)
+			continue;
+		while (isDone[nextUnused])
+			nextUnused++;
+		srcVol[o] = nextUnused;
+		isDone[nextUnused] = 1;
+	}
+	memset(isDone, 0, numVol * sizeof(unsigned char));
+	unsigned char *tempVol = NULL;
+	for (int start = 0; start < numVol; start++) {
+		if ((isDone[start]) || (srcVol[start] == start))
+			continue;
+		if (!tempVol)
+			tempVol = (unsigned char *)malloc(numVolBytes);
+		memcpy(tempVol, &inImg[start * numVolBytes], numVolBytes); // free the first slot of this cycle
+		int o = start;
+		while (true) {
+			isDone[o] = 1;
+			int i = srcVol[o];
+			if (i == start) {
+				memcpy(&inImg[o * numVolBytes], tempVol, numVolBytes);
+				break;
+			}
+			memcpy(&inImg[o * numVolBytes], &inImg[i * numVolBytes], numVolBytes); // dest, src, bytes
+			o = i;
+		}
+	} // for each cycle
+	free(srcVol);
+	free(isDone);
 	free(volOrderIndex);
 	free(tempVol);
 	return inImg;
 } // reorderVolumes()
 #endif // naive_reorder_vols
 
-float *bvals; // global variable for cmp_bvals
+struct TBvalKey {
+	float bval;
+	int vol;
+};
+
 int cmp_bvals(const void *a, const void *b) {
-	int ia = *(int *)a;
-	int ib = *(int *)b;
-	// return bvals[ia] > bvals[ib] ? -1 : bvals[ia] < bvals[ib];
-	return bvals[ia] < bvals[ib] ? -1 : bvals[ia] > bvals[ib];
+	// sort key carries its own b-value so no global table is needed
+	const struct TBvalKey *ka = (const struct TBvalKey *)a;
+	const struct TBvalKey *kb = (const struct TBvalKey *)b;
+	if (ka->bval != kb->bval)
+		return ka->bval < kb->bval ? -1 : 1;
+	return ka->vol - kb->vol;
 } // cmp_bvals()
 
 bool isAllZeroFloat(float v1, float v2, float v3) {
@@ -2784,7 +3265,7 @@ int *nii_saveDTI(char pathoutname[], int nConvert, struct TDCMsort dcmSort[], st
 	}
 	float kADCval = maxB0 + 1; // mark as unusual
 	*numADC = 0;
-	bvals = (float *)malloc(numDti * sizeof(float));
+	float *bvals = (float *)malloc(numDti * sizeof(float));
 	int numGEwarn = 0;
 	bool isGEADC = (dcmList[indx0].numberOfDiffusionDirectionGE == 0); // GE non-DTI
 	for (int i = 0; i < numDti; i++) {
@@ -2856,9 +3337,17 @@ int *nii_saveDTI(char pathoutname[], int nConvert, struct TDCMsort dcmSort[], st
 	int *volOrderIndex = (int *)malloc(numDti * sizeof(int));
 	for (int i = 0; i < numDti; i++)
 		volOrderIndex[i] = i;
-	if (opts.isSortDTIbyBVal)
-		qsort(volOrderIndex, numDti, sizeof(*volOrderIndex), cmp_bvals);
-	else if (*numADC > 0) {
+	if (opts.isSortDTIbyBVal) {
+		struct TBvalKey *keys = (struct TBvalKey *)malloc(numDti * sizeof(struct TBvalKey));
+		for (int i = 0; i < numDti; i++) {
+			keys[i].bval = bvals[i];
+			keys[i].vol = i;
+		}
+		qsort(keys, numDti, sizeof(struct TBvalKey), cmp_bvals);
+		for (int i = 0; i < numDti; i++)
+			volOrderIndex[i] = keys[i].vol;
+		free(keys);
+	} else if (*numADC > 0) {
 		int o = 0;
 		for (int i = 0; i < numDti; i++) {
 			if (bvals[i] < kADCval) {
@@ -2868,17 +3357,13 @@ int *nii_saveDTI(char pathoutname[], int nConvert, struct TDCMsort dcmSort[], st
 		} // for each volume
 	} // if sort else if has ADC
 	free(bvals);
-	// save VX as sorted
-	TDTI *vxOrig = (TDTI *)malloc(numDti * sizeof(TDTI));
-	for (int i = 0; i < numDti; i++)
-		vxOrig[i] = vx[i];
-	// remove ADC
+	// save VX as sorted, gathering into a single new table and dropping ADC
 	numDti = numDti - *numADC;
-	free(vx);
-	vx = (TDTI *)malloc(numDti * sizeof(TDTI));
+	TDTI *vxSorted = (TDTI *)malloc(numDti * sizeof(TDTI));
 	for (int i = 0; i < numDti; i++)
-		vx[i] = vxOrig[volOrderIndex[i]];
-	free(vxOrig);
+		vxSorted[i] = vx[volOrderIndex[i]];
+	free(vx);
+	vx = vxSorted;
 	// if no ADC or sequential, the is no need to re-order volumes
 	bool isSequential = true;
 	for (int i = 1; i < (numDti + *numADC); i++)
@@ -3249,6 +3734,29 @@ int isSameFloatT(float a, float b, float tolerance) {
 	return (fabs(a - b) <= tolerance);
 }
 
+void permuteTDCMsort(struct TDCMsort dcmSort[], int n, const int *srcIdx) {
+	// in-place gather dcmSort[i] = dcmSort[srcIdx[i]] by following each cycle of the permutation,
+	//  needs one flag per entry rather than a second copy of the array
+	unsigned char *isDone = (unsigned char *)calloc(n, sizeof(unsigned char));
+	for (int start = 0; start < n; start++) {
+		if ((isDone[start]) || (srcIdx[start] == start))
+			continue;
+		struct TDCMsort tmp = dcmSort[start];
+		int o = start;
+		while (true) {
+			isDone[o] = 1;
+			int i = srcIdx[o];
+			if (i == start) {
+				dcmSort[o] = tmp;
+				break;
+			}
+			dcmSort[o] = dcmSort[i];
+			o = i;
+		}
+	}
+	free(isDone);
+} // permuteTDCMsort()
+
 bool ensureSequentialSlicePositions(int d3, int d4, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[], int verbose) {
 	// ensure slice position is sequential: either ascending [1 2 3] or descending [3 2 1], not [1 3 2], [3 1 2] etc.
 	// n.b. as currently designed, this will force swapDim3Dim4() for 4D data
@@ -3379,32 +3887,30 @@ bool ensureSequentialSlicePositions(int d3, int d4, struct TDCMsort dcmSort[], s
 		printWarning("Reordering volumes based on FrameReferenceTime (0054,1300; issue 577)\n");
 	else if ((!isPhaseIsBValNumber) && ((maxVolOut - minVolOut + 1) != d4))
 		printError("Check sorted order: 4D dataset has %d volumes, but volume index ranges from %d..%d\n", d4, minVolOut, maxVolOut);
-	TDCMsort *dcmSortIn = (TDCMsort *)malloc(nConvert * sizeof(TDCMsort));
-	for (int i = 0; i < nConvert; i++)
-		dcmSortIn[i] = dcmSort[i];
 	qsort(floatSort, nConvert, sizeof(struct TFloatSort), compareTFloatSort); // sort based on series and image numbers....
+	int *srcIdx = (int *)malloc(nConvert * sizeof(int));
 	for (int i = 0; i < nConvert; i++)
-		dcmSort[i] = dcmSortIn[floatSort[i].index];
+		srcIdx[i] = floatSort[i].index;
+	permuteTDCMsort(dcmSort, nConvert, srcIdx);
+	free(srcIdx);
 	free(floatSort);
-	free(dcmSortIn);
 	return false;
 } // ensureSequentialSlicePositions()
 
 void swapDim3Dim4(int d3, int d4, struct TDCMsort dcmSort[]) {
 	// swap space and time: input A0,A1...An,B0,B1...Bn output A0,B0,A1,B1,...
 	int nConvert = d3 * d4;
-	TDCMsort *dcmSortIn = (TDCMsort *)malloc(nConvert * sizeof(TDCMsort));
-	for (int i = 0; i < nConvert; i++)
-		dcmSortIn[i] = dcmSort[i];
+	int *srcIdx = (int *)malloc(nConvert * sizeof(int));
 	int i = 0;
 	for (int b = 0; b < d3; b++)
 		for (int a = 0; a < d4; a++) {
 			int k = (a * d3) + b;
 			// printMessage("%d -> %d %d ->%d\n",i,a, b, k);
-			dcmSort[k] = dcmSortIn[i];
+			srcIdx[k] = i;
 			i++;
 		}
-	free(dcmSortIn);
+	permuteTDCMsort(dcmSort, nConvert, srcIdx); // transpose in place
+	free(srcIdx);
 } // swapDim3Dim4()
 
 bool intensityScaleVaries(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[]) {
@@ -4247,18 +4753,74 @@ unsigned long mz_crc32(unsigned long crc, const unsigned char *ptr, size_t buf_l
 #define MZ_DEFAULT_LEVEL 6
 #endif
 
-void writeNiiGz(char *baseName, struct nifti_1_header hdr, unsigned char *src_buffer, unsigned long src_len, int gzLevel, bool isSkipHeader) {
-	// create gz file in RAM, save to disk http://www.zlib.net/zlib_how.html
-	//  in general this single-threaded approach is slower than PIGZ but is useful for slow (network attached) disk drives
-	char fname[2048] = {""};
-	strcpy(fname, baseName);
-	if (!isSkipHeader)
-		strcat(fname, ".nii.gz");
-	unsigned long hdrPadBytes = sizeof(hdr) + 4; // 348 byte header + 4 byte pad
-	if (isSkipHeader)
-		hdrPadBytes = 0;
-	unsigned long cmp_len = mz_compressBound(src_len + hdrPadBytes);
+// internal gz writer: header, image and footer segments are compressed as a single raw deflate stream in a gzip wrapper
+//  zlib/miniz and ISA-L stream the segments, libdeflate needs the whole input in one contiguous buffer
+#define kGzSegments 3
+
+struct TGzInput {
+	const unsigned char *seg[kGzSegments];
+	unsigned long segBytes[kGzSegments], totalBytes;
+	int nSeg, swapSeg, swapBytes; // segment swapSeg is byte-swapped as it is read if swapBytes > 1, source is not modified
+};
+
+struct TGzReader {
+	struct TGzInput *in;
+	int iSeg;
+	unsigned long pos;
+	unsigned char *buf; // bounce buffer for swapped chunks
+};
+
+void gzInputInit(struct TGzInput *in) {
+	memset(in, 0, sizeof(struct TGzInput));
+	in->swapSeg = -1;
+} // gzInputInit()
+
+void gzInputAdd(struct TGzInput *in, const unsigned char *seg, unsigned long segBytes, int swapBytes) {
+	if (in->nSeg >= kGzSegments)
+		return;
+	if (swapBytes > 1) {
+		in->swapSeg = in->nSeg;
+		in->swapBytes = swapBytes;
+	}
+	in->seg[in->nSeg] = seg;
+	in->segBytes[in->nSeg] = segBytes;
+	in->totalBytes += segBytes;
+	in->nSeg++;
+} // gzInputAdd()
+
+bool gzReadChunk(struct TGzReader *rd, const unsigned char **ptr, unsigned long *n) {
+	// next run of input bytes as stored, false once every segment is consumed
+	struct TGzInput *in = rd->in;
+	while ((rd->iSeg < in->nSeg) && (rd->pos >= in->segBytes[rd->iSeg])) {
+		rd->iSeg++;
+		rd->pos = 0;
+	}
+	if (rd->iSeg >= in->nSeg)
+		return false;
+	const unsigned char *src = &in->seg[rd->iSeg][rd->pos];
+	unsigned long len = in->segBytes[rd->iSeg] - rd->pos;
+	if ((rd->iSeg == in->swapSeg) && (in->swapBytes > 1)) {
+		if (len > kSwapChunkBytes)
+			len = kSwapChunkBytes;
+		if (rd->buf == NULL)
+			rd->buf = (unsigned char *)malloc(kSwapChunkBytes);
+		swapEndianCopy(rd->buf, src, len, in->swapBytes);
+		src = rd->buf;
+	}
+	*ptr = src;
+	*n = len;
+	rd->pos += len;
+	return true;
+} // gzReadChunk()
+
+typedef unsigned char *(*TGzDeflate)(struct TGzInput *in, int gzLevel, unsigned long *cmpBytes, unsigned long *crc);
+
+unsigned char *gzDeflateZlib(struct TGzInput *in, int gzLevel, unsigned long *cmpBytes, unsigned long *crc) {
+	// zlib or miniz, streaming: returns raw deflate data, NULL on failure
+	unsigned long cmp_len = mz_compressBound(in->totalBytes);
 	unsigned char *pCmp = (unsigned char *)malloc(cmp_len);
+	if (pCmp == NULL)
+		return NULL;
 	z_stream strm;
 	strm.total_in = 0;
 	strm.total_out = 0;
@@ -4272,46 +4834,209 @@ void writeNiiGz(char *baseName, struct nifti_1_header hdr, unsigned char *src_bu
 		zLevel = gzLevel;
 	if (zLevel > MZ_UBER_COMPRESSION)
 		zLevel = MZ_UBER_COMPRESSION;
-	if (deflateInit(&strm, zLevel) != Z_OK) {
+	if (deflateInit2(&strm, zLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) { // negative window: no zlib header or adler32
 		free(pCmp);
-		return;
+		return NULL;
 	}
-	unsigned char *pHdr;
-	if (!isSkipHeader) {
-		// add header
-		pHdr = (unsigned char *)malloc(hdrPadBytes);
-		pHdr[hdrPadBytes - 1] = 0;
-		pHdr[hdrPadBytes - 2] = 0;
-		pHdr[hdrPadBytes - 3] = 0;
-		pHdr[hdrPadBytes - 4] = 0;
-		memcpy(pHdr, &hdr, sizeof(hdr));
-		strm.avail_in = (unsigned int)hdrPadBytes; // size of input
-		strm.next_in = (uint8_t *)pHdr;			   // input header -- TPX strm.next_in = (Bytef *)pHdr; uint32_t
+	struct TGzReader rd = {in, 0, 0, NULL};
+	const unsigned char *ptr;
+	unsigned long n;
+	while (gzReadChunk(&rd, &ptr, &n)) {
+		*crc = mz_crc32(*crc, ptr, n);
+		strm.avail_in = (unsigned int)n;
+		strm.next_in = (uint8_t *)ptr;
 		deflate(&strm, Z_NO_FLUSH);
 	}
-	// add image
-	strm.avail_in = (unsigned int)src_len; // size of input
-	strm.next_in = (uint8_t *)src_buffer;  // input image -- TPX strm.next_in = (Bytef *)src_buffer;
-	deflate(&strm, Z_FINISH);			   // Z_NO_FLUSH;
-	// finish up
+	free(rd.buf);
+	int ret = deflate(&strm, Z_FINISH);
 	deflateEnd(&strm);
-	unsigned long file_crc32 = mz_crc32(0L, Z_NULL, 0);
-	if (!isSkipHeader)
-		file_crc32 = mz_crc32(file_crc32, pHdr, (unsigned int)hdrPadBytes);
-	file_crc32 = mz_crc32(file_crc32, src_buffer, (unsigned int)src_len);
-	cmp_len = strm.total_out;
-	if (cmp_len <= 0) {
+	if (ret != Z_STREAM_END) {
 		free(pCmp);
-		free(src_buffer);
-		return;
+		return NULL;
 	}
-	FILE *fileGz = fopen(fname, "wb");
-	if (!fileGz) {
+	*cmpBytes = strm.total_out;
+	return pCmp;
+} // gzDeflateZlib()
+
+#ifdef myEnableLibdeflate
+unsigned char *gzDeflateLibdeflate(struct TGzInput *in, int gzLevel, unsigned long *cmpBytes, unsigned long *crc) {
+	// libdeflate, whole buffer: segments are gathered unless the input is a single unswapped segment
+	int level = 6;
+	if ((gzLevel > 0) && (gzLevel <= 12))
+		level = gzLevel;
+	struct libdeflate_compressor *compressor = libdeflate_alloc_compressor(level);
+	if (compressor == NULL)
+		return NULL;
+	const unsigned char *src = in->seg[0];
+	unsigned char *gather = NULL;
+	if ((in->nSeg != 1) || (in->swapSeg == 0)) {
+		gather = (unsigned char *)malloc(in->totalBytes);
+		struct TGzReader rd = {in, 0, 0, NULL};
+		const unsigned char *ptr;
+		unsigned long n, pos = 0;
+		while (gzReadChunk(&rd, &ptr, &n)) {
+			memcpy(&gather[pos], ptr, n);
+			pos += n;
+		}
+		free(rd.buf);
+		src = gather;
+	}
+	*crc = libdeflate_crc32((uint32_t)*crc, src, in->totalBytes);
+	size_t cmp_len = libdeflate_deflate_compress_bound(compressor, in->totalBytes);
+	unsigned char *pCmp = (unsigned char *)malloc(cmp_len);
+	*cmpBytes = libdeflate_deflate_compress(compressor, src, in->totalBytes, pCmp, cmp_len);
+	libdeflate_free_compressor(compressor);
+	free(gather);
+	if (*cmpBytes < 1) {
 		free(pCmp);
-		free(src_buffer);
-		return;
+		return NULL;
+	}
+	return pCmp;
+} // gzDeflateLibdeflate()
+#endif
+
+#ifdef myEnableISAL
+unsigned char *gzDeflateISAL(struct TGzInput *in, int gzLevel, unsigned long *cmpBytes, unsigned long *crc) {
+	// ISA-L igzip, streaming: levels 1..9 map to igzip levels 1..3
+	static const uint32_t kLevelBufBytes[4] = {0, ISAL_DEF_LVL1_DEFAULT, ISAL_DEF_LVL2_DEFAULT, ISAL_DEF_LVL3_DEFAULT};
+	int level = 2;
+	if ((gzLevel > 0) && (gzLevel < 3))
+		level = 1;
+	else if (gzLevel > 6)
+		level = 3;
+	unsigned long cmp_len = mz_compressBound(in->totalBytes) + 1024; // igzip stored blocks plus end of stream
+	unsigned char *pCmp = (unsigned char *)malloc(cmp_len);
+	struct isal_zstream strm;
+	isal_deflate_init(&strm);
+	strm.level = level;
+	strm.level_buf_size = kLevelBufBytes[level];
+	strm.level_buf = (uint8_t *)malloc(strm.level_buf_size);
+	strm.next_out = pCmp;
+	strm.avail_out = (uint32_t)cmp_len;
+	strm.flush = NO_FLUSH;
+	strm.end_of_stream = 0;
+	struct TGzReader rd = {in, 0, 0, NULL};
+	const unsigned char *ptr;
+	unsigned long n;
+	bool isOK = true;
+	while ((isOK) && (gzReadChunk(&rd, &ptr, &n))) {
+		*crc = crc32_gzip_refl((uint32_t)*crc, ptr, n);
+		strm.next_in = (uint8_t *)ptr;
+		strm.avail_in = (uint32_t)n;
+		isOK = (isal_deflate(&strm) == COMP_OK) && (strm.avail_in == 0);
+	}
+	free(rd.buf);
+	if (isOK) {
+		strm.avail_in = 0;
+		strm.end_of_stream = 1;
+		isOK = (isal_deflate(&strm) == COMP_OK) && (strm.internal_state.state == ZSTATE_END);
+	}
+	free(strm.level_buf);
+	if (!isOK) {
+		free(pCmp);
+		return NULL;
 	}
-	// write header http://www.gzip.org/zlib/rfc-gzip.html
+	*cmpBytes = strm.total_out;
+	return pCmp;
+} // gzDeflateISAL()
+#endif
+
+struct TGzBackend {
+	const char *name;
+	TGzDeflate deflate; // NULL if not compiled in
+};
+
+static const struct TGzBackend kGzBackends[kGzBackendCount] = {
+	{"zlib", gzDeflateZlib},
+#ifdef myEnableLibdeflate
+	{"libdeflate", gzDeflateLibdeflate},
+#else
+	{"libdeflate", NULL},
+#endif
+#ifdef myEnableISAL
+	{"isal", gzDeflateISAL},
+#else
+	{"isal", NULL},
+#endif
+};
+
+const char *nii_gzBackendName(int gzBackend) {
+	if ((gzBackend < 0) || (gzBackend >= kGzBackendCount))
+		gzBackend = kGzBackendZlib;
+	return kGzBackends[gzBackend].name;
+} // nii_gzBackendName()
+
+int nii_gzBackend(const char *name) {
+	// "--gz-backend": backends that were not compiled in fall back to zlib
+	for (int i = 0; i < kGzBackendCount; i++) {
+		if (strcmp(name, kGzBackends[i].name) != 0)
+			continue;
+		if (kGzBackends[i].deflate != NULL)
+			return i;
+		printWarning("Compiled without %s support, using %s\n", name, kGzBackends[kGzBackendZlib].name);
+		return kGzBackendZlib;
+	}
+	printWarning("Unknown gz backend '%s', using %s\n", name, kGzBackends[kGzBackendZlib].name);
+	return kGzBackendZlib;
+} // nii_gzBackend()
+
+TGzDeflate gzBackendDeflate(int gzBackend) {
+	if ((gzBackend > 0) && (gzBackend < kGzBackendCount) && (kGzBackends[gzBackend].deflate != NULL))
+		return kGzBackends[gzBackend].deflate;
+	return gzDeflateZlib;
+} // gzBackendDeflate()
+
+#define kGzSampleBytes 262144
+#define kGzSampleMinGain 1.02 // a stronger level must shrink the sample by at least 2%
+
+int gzAdaptiveLevel(unsigned char *im, size_t imgsz, struct TDCMopts *opts) {
+	// "--gz-target-mbps": compress a sample from the middle of the image at increasing levels,
+	//  keep the strongest level that still meets the throughput target and meaningfully improves the ratio
+	// "--gz-target-ratio": stop at the first level whose sample reaches this ratio
+	//  n.b. measured single-threaded with the internal backend, pigz is faster on multi-core machines
+	static const int kLevels[] = {1, 3, 6, 9};
+	int nLevels = sizeof(kLevels) / sizeof(kLevels[0]);
+	if (imgsz <= kGzSampleBytes) { // sampling would cost more than compressing the whole image at any level
+		statsGzLevel(opts->gzLevel, 0.0, 0.0);
+		return opts->gzLevel;
+	}
+	size_t sampleBytes = kGzSampleBytes;
+	TGzDeflate gzDeflate = gzDeflateZlib;
+	if (strlen(opts->pigzname) < 1)
+		gzDeflate = gzBackendDeflate(opts->gzBackend);
+	int level = kLevels[0];
+	double levelMBps = 0.0, levelRatio = 0.0;
+	for (int i = 0; i < nLevels; i++) {
+		struct TGzInput in;
+		gzInputInit(&in);
+		gzInputAdd(&in, &im[(imgsz - sampleBytes) / 2], sampleBytes, 0);
+		unsigned long cmpBytes = 0;
+		unsigned long crc = mz_crc32(0L, Z_NULL, 0);
+		double tic = statsWallTime();
+		unsigned char *pCmp = gzDeflate(&in, kLevels[i], &cmpBytes, &crc);
+		double sec = statsWallTime() - tic;
+		if (pCmp == NULL)
+			break;
+		free(pCmp);
+		double mbps = (sec > 0.0) ? (sampleBytes / sec) / 1000000.0 : DBL_MAX;
+		double ratio = (cmpBytes > 0) ? (double)sampleBytes / (double)cmpBytes : 0.0;
+		if ((i > 0) && ((mbps < opts->gzTargetMBps) || (ratio < (levelRatio * kGzSampleMinGain))))
+			break; // stronger levels are only slower
+		level = kLevels[i];
+		levelMBps = mbps;
+		levelRatio = ratio;
+		if ((opts->gzTargetRatio > 0.0) && (ratio >= opts->gzTargetRatio))
+			break; // good enough
+	}
+	statsGzLevel(level, levelMBps, levelRatio);
+	if (opts->isVerbose > 1)
+		printMessage("Adaptive gz level %d (sample %g MB/s, ratio %.2f, target %d MB/s, ratio %g)\n", level, levelMBps, levelRatio, opts->gzTargetMBps, opts->gzTargetRatio);
+	return level;
+} // gzAdaptiveLevel()
+
+int writeGzFile(FILE *fileGz, const char *fname, unsigned char *pCmp, unsigned long cmp_len, unsigned long file_crc32, unsigned long totalBytes) {
+	// save raw deflate data as gzip file http://www.gzip.org/zlib/rfc-gzip.html, closes fileGz and frees pCmp
+	// write header
 	fputc((char)0x1f, fileGz); // ID1
 	fputc((char)0x8b, fileGz); // ID2
 	fputc((char)0x08, fileGz); // CM - use deflate compression method
@@ -4322,22 +5047,198 @@ void writeNiiGz(char *baseName, struct nifti_1_header hdr, unsigned char *src_bu
 	fputc((char)0x00, fileGz); // MTIME2
 	fputc((char)0x00, fileGz); // XFL
 	fputc((char)0xff, fileGz); // OS
-	// write Z-compressed data
-	fwrite(&pCmp[2], sizeof(char), cmp_len - 6, fileGz); //-6 as LZ78 format has 2 bytes header (typically 0x789C) and 4 bytes tail (ADLER 32)
+	// write raw deflate data
+	size_t nWritten = fwrite(pCmp, sizeof(char), cmp_len, fileGz);
 	// write tail: write redundancy check and uncompressed size as bytes to ensure LITTLE-ENDIAN order
 	fputc((unsigned char)(file_crc32), fileGz);
 	fputc((unsigned char)(file_crc32 >> 8), fileGz);
 	fputc((unsigned char)(file_crc32 >> 16), fileGz);
 	fputc((unsigned char)(file_crc32 >> 24), fileGz);
-	fputc((unsigned char)(strm.total_in), fileGz);
-	fputc((unsigned char)(strm.total_in >> 8), fileGz);
-	fputc((unsigned char)(strm.total_in >> 16), fileGz);
-	fputc((unsigned char)(strm.total_in >> 24), fileGz);
-	fclose(fileGz);
+	fputc((unsigned char)(totalBytes), fileGz);
+	fputc((unsigned char)(totalBytes >> 8), fileGz);
+	fputc((unsigned char)(totalBytes >> 16), fileGz);
+	fputc((unsigned char)(totalBytes >> 24), fileGz);
+	bool isWriteError = (ferror(fileGz) != 0) || (nWritten != cmp_len);
 	free(pCmp);
+	if ((fclose(fileGz) != 0) || (isWriteError)) {
+		printError("Unable to write %s\n", fname);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+} // writeGzFile()
+
+int writeGz(const char *fname, struct TGzInput *in, int gzLevel, int gzBackend) {
+	// compress in RAM with the chosen backend, then save gzip file
+	TGzDeflate gzDeflate = gzBackendDeflate(gzBackend);
+	unsigned long cmp_len = 0;
+	unsigned long file_crc32 = mz_crc32(0L, Z_NULL, 0);
+	unsigned char *pCmp = gzDeflate(in, gzLevel, &cmp_len, &file_crc32);
+	if (pCmp == NULL) {
+		printError("Unable to compress %s (%s)\n", fname, nii_gzBackendName(gzBackend));
+		return EXIT_FAILURE;
+	}
+	FILE *fileGz = fopen(fname, "wb");
+	if (!fileGz) {
+		free(pCmp);
+		printError("Unable to write %s\n", fname);
+		return EXIT_FAILURE;
+	}
+	return writeGzFile(fileGz, fname, pCmp, cmp_len, file_crc32, in->totalBytes);
+} // writeGz()
+
+int writeNiiGz(char *baseName, struct nifti_1_header hdr, unsigned char *src_buffer, unsigned long src_len, int gzLevel, int gzBackend, bool isSkipHeader, int swapBytes) {
+	// create gz file in RAM, save to disk http://www.zlib.net/zlib_how.html
+	//  in general this single-threaded approach is slower than PIGZ but is useful for slow (network attached) disk drives
+	//  swapBytes > 1 byte-swaps the image as it is compressed, src_buffer is not modified
+	char fname[2048] = {""};
+	strcpy(fname, baseName);
+	if (!isSkipHeader)
+		strcat(fname, ".nii.gz");
+	unsigned char pHdr[sizeof(hdr) + 4]; // 348 byte header + 4 byte pad
+	memset(pHdr, 0, sizeof(pHdr));
+	memcpy(pHdr, &hdr, sizeof(hdr));
+	struct TGzInput in;
+	gzInputInit(&in);
 	if (!isSkipHeader)
-		free(pHdr);
+		gzInputAdd(&in, pHdr, sizeof(pHdr), 0);
+	gzInputAdd(&in, src_buffer, src_len, swapBytes);
+	return writeGz(fname, &in, gzLevel, gzBackend);
 } // writeNiiGz()
+
+#if defined(_OPENMP) && !defined(USING_R)
+#define myGzWriterThread
+#endif
+
+#ifdef myGzWriterThread
+// Compressor/writer stage: with more than one thread, nii_saveNII() hands internal .nii.gz writes to a dedicated thread,
+//  so the next series is loaded, decoded and reoriented while the previous one is compressed.
+//  The output file is created before nii_saveNII() returns, as name conflicts are resolved by checking which files exist.
+//  Jobs own a copy of the image: nii_saveNII() waits while the copies exceed kGzWriterBytes, larger images are written inline.
+#define kGzWriterBytes ((size_t)512 << 20)
+
+struct TGzJob {
+	FILE *fileGz;
+	char fname[2048];
+	struct nifti_1_header hdr; // already in output byte order
+	unsigned char *img;
+	size_t imgsz;
+	int gzLevel, gzBackend, swapBytes;
+	int statsSeries; // "--stats" series the image belongs to
+};
+
+struct TGzWriter {
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<struct TGzJob> jobs;
+	std::thread writer; // started by the first job
+	size_t imgBytes;	// image copies queued or being written
+	bool isActive, isClosed, isError;
+};
+
+static struct TGzWriter gzWriter;
+
+int gzWriterJob(struct TGzJob *job) {
+	unsigned char pHdr[sizeof(struct nifti_1_header) + 4]; // 348 byte header + 4 byte pad
+	memset(pHdr, 0, sizeof(pHdr));
+	memcpy(pHdr, &job->hdr, sizeof(struct nifti_1_header));
+	struct TGzInput in;
+	gzInputInit(&in);
+	gzInputAdd(&in, pHdr, sizeof(pHdr), 0);
+	gzInputAdd(&in, job->img, job->imgsz, job->swapBytes);
+	TGzDeflate gzDeflate = gzBackendDeflate(job->gzBackend);
+	unsigned long cmp_len = 0;
+	unsigned long file_crc32 = mz_crc32(0L, Z_NULL, 0);
+	unsigned char *pCmp = gzDeflate(&in, job->gzLevel, &cmp_len, &file_crc32);
+	if (pCmp == NULL) {
+		fclose(job->fileGz);
+		remove(job->fname);
+		printError("Unable to compress %s (%s)\n", job->fname, nii_gzBackendName(job->gzBackend));
+		return EXIT_FAILURE;
+	}
+	return writeGzFile(job->fileGz, job->fname, pCmp, cmp_len, file_crc32, in.totalBytes);
+} // gzWriterJob()
+
+void gzWriterRun(struct TGzWriter *w) {
+	std::unique_lock<std::mutex> guard(w->lock);
+	while (true) {
+		while ((w->jobs.empty()) && (!w->isClosed))
+			w->changed.wait(guard);
+		if (w->jobs.empty())
+			break;
+		struct TGzJob job = w->jobs.front();
+		w->jobs.pop_front();
+		guard.unlock();
+		double statsTime = statsTic();
+		int ret = gzWriterJob(&job);
+		if (ret == EXIT_SUCCESS)
+			statsOutputSeries(job.statsSeries, job.fname, job.imgsz + sizeof(struct nifti_1_header) + 4, statsTime);
+		free(job.img);
+		guard.lock();
+		if (ret != EXIT_SUCCESS)
+			w->isError = true;
+		w->imgBytes -= job.imgsz;
+		w->changed.notify_all();
+	}
+} // gzWriterRun()
+
+// enable the writer thread for the conversions of one folder
+void gzWriterStart(struct TDCMopts *opts) {
+	gzWriter.imgBytes = 0;
+	gzWriter.isClosed = false;
+	gzWriter.isError = false;
+	// overwriting would race the pending write of the same name
+	bool isWriter = (opts->threadsWrite < 0) ? (omp_get_max_threads() > 1) : (opts->threadsWrite > 0);
+	gzWriter.isActive = (isWriter) && (opts->isGz) && (strlen(opts->pigzname) < 1) && (opts->nameConflictBehavior != kNAME_CONFLICT_OVERWRITE);
+} // gzWriterStart()
+
+// wait until every queued image is written, returns EXIT_FAILURE if any write failed
+int gzWriterStop(void) {
+	if (!gzWriter.isActive)
+		return EXIT_SUCCESS;
+	{
+		std::lock_guard<std::mutex> guard(gzWriter.lock);
+		gzWriter.isClosed = true;
+		gzWriter.changed.notify_all();
+	}
+	if (gzWriter.writer.joinable())
+		gzWriter.writer.join();
+	gzWriter.isActive = false;
+	return gzWriter.isError ? EXIT_FAILURE : EXIT_SUCCESS;
+} // gzWriterStop()
+
+// queue a .nii.gz write, returns -1 if the caller must write the image itself
+int gzWriterPush(const char *niiFilename, struct nifti_1_header hdr, unsigned char *im, size_t imgsz, int gzLevel, int gzBackend, int swapBytes) {
+	if ((!gzWriter.isActive) || (imgsz > kGzWriterBytes))
+		return -1;
+	struct TGzJob job;
+	snprintf(job.fname, sizeof(job.fname), "%s.nii.gz", niiFilename);
+	job.fileGz = fopen(job.fname, "wb");
+	if (!job.fileGz) {
+		printError("Unable to write %s\n", job.fname);
+		return EXIT_FAILURE;
+	}
+	job.hdr = hdr;
+	job.imgsz = imgsz;
+	job.gzLevel = gzLevel;
+	job.gzBackend = gzBackend;
+	job.swapBytes = swapBytes;
+	job.statsSeries = statsSeriesIndex();
+	{
+		std::unique_lock<std::mutex> guard(gzWriter.lock);
+		while ((gzWriter.imgBytes > 0) && (gzWriter.imgBytes + imgsz > kGzWriterBytes))
+			gzWriter.changed.wait(guard); // back-pressure: wait for the writer
+		gzWriter.imgBytes += imgsz;
+	}
+	job.img = (unsigned char *)malloc(imgsz);
+	memcpy(job.img, im, imgsz);
+	std::lock_guard<std::mutex> guard(gzWriter.lock);
+	gzWriter.jobs.push_back(job);
+	if (!gzWriter.writer.joinable())
+		gzWriter.writer = std::thread(gzWriterRun, &gzWriter);
+	gzWriter.changed.notify_all();
+	return EXIT_SUCCESS;
+} // gzWriterPush()
+#endif
 #endif
 
 #ifndef USING_R
@@ -4411,85 +5312,14 @@ PACKD(typedef struct {
 })
 TmghFooter;
 
-void writeMghGz(char *baseName, Tmgh hdr, TmghFooter footer, unsigned char *src_buffer, unsigned long src_len, int gzLevel) {
-	// create gz file in RAM, save to disk http://www.zlib.net/zlib_how.html
-	//  in general this single-threaded approach is slower than PIGZ but is useful for slow (network attached) disk drives
-	char fname[2048] = {""};
-	strcpy(fname, baseName);
-	unsigned long hdrPadBytes = sizeof(hdr); // 348 byte header + 4 byte pad
-	unsigned long cmp_len = mz_compressBound(src_len + hdrPadBytes);
-	unsigned char *pCmp = (unsigned char *)malloc(cmp_len);
-	z_stream strm;
-	strm.total_in = 0;
-	strm.total_out = 0;
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.next_out = pCmp;					// output char array
-	strm.avail_out = (unsigned int)cmp_len; // size of output
-	int zLevel = MZ_DEFAULT_LEVEL;			// Z_DEFAULT_COMPRESSION;
-	if ((gzLevel > 0) && (gzLevel < 11))
-		zLevel = gzLevel;
-	if (zLevel > MZ_UBER_COMPRESSION)
-		zLevel = MZ_UBER_COMPRESSION;
-	if (deflateInit(&strm, zLevel) != Z_OK) {
-		free(pCmp);
-		return;
-	}
-	// add header
-	strm.avail_in = (unsigned int)sizeof(hdr); // size of input
-	strm.next_in = (uint8_t *)&hdr.version;
-	deflate(&strm, Z_NO_FLUSH);
-	// add image
-	strm.avail_in = (unsigned int)src_len; // size of input
-	strm.next_in = (uint8_t *)src_buffer;  // input image -- TPX strm.next_in = (Bytef *)src_buffer;
-	deflate(&strm, Z_FINISH);
-	// add footer
-	strm.avail_in = (unsigned int)sizeof(footer); // size of input
-	strm.next_in = (uint8_t *)&footer.TR;
-	deflate(&strm, Z_NO_FLUSH);
-	// finish up
-	deflateEnd(&strm);
-	unsigned long file_crc32 = mz_crc32(0L, Z_NULL, 0);
-	file_crc32 = mz_crc32(file_crc32, (uint8_t *)&hdr.version, (unsigned int)sizeof(hdr));
-	file_crc32 = mz_crc32(file_crc32, src_buffer, (unsigned int)src_len);
-	file_crc32 = mz_crc32(file_crc32, (uint8_t *)&footer.TR, (unsigned int)sizeof(footer));
-	cmp_len = strm.total_out;
-	if (cmp_len <= 0) {
-		free(pCmp);
-		free(src_buffer);
-		return;
-	}
-	FILE *fileGz = fopen(fname, "wb");
-	if (!fileGz) {
-		free(pCmp);
-		free(src_buffer);
-		return;
-	}
-	// write header http://www.gzip.org/zlib/rfc-gzip.html
-	fputc((char)0x1f, fileGz); // ID1
-	fputc((char)0x8b, fileGz); // ID2
-	fputc((char)0x08, fileGz); // CM - use deflate compression method
-	fputc((char)0x00, fileGz); // FLG - no addition fields
-	fputc((char)0x00, fileGz); // MTIME0
-	fputc((char)0x00, fileGz); // MTIME1
-	fputc((char)0x00, fileGz); // MTIME2
-	fputc((char)0x00, fileGz); // MTIME2
-	fputc((char)0x00, fileGz); // XFL
-	fputc((char)0xff, fileGz); // OS
-	// write Z-compressed data
-	fwrite(&pCmp[2], sizeof(char), cmp_len - 6, fileGz); //-6 as LZ78 format has 2 bytes header (typically 0x789C) and 4 bytes tail (ADLER 32)
-	// write tail: write redundancy check and uncompressed size as bytes to ensure LITTLE-ENDIAN order
-	fputc((unsigned char)(file_crc32), fileGz);
-	fputc((unsigned char)(file_crc32 >> 8), fileGz);
-	fputc((unsigned char)(file_crc32 >> 16), fileGz);
-	fputc((unsigned char)(file_crc32 >> 24), fileGz);
-	fputc((unsigned char)(strm.total_in), fileGz);
-	fputc((unsigned char)(strm.total_in >> 8), fileGz);
-	fputc((unsigned char)(strm.total_in >> 16), fileGz);
-	fputc((unsigned char)(strm.total_in >> 24), fileGz);
-	fclose(fileGz);
-	free(pCmp);
+int writeMghGz(char *baseName, Tmgh hdr, TmghFooter footer, unsigned char *src_buffer, unsigned long src_len, int gzLevel, int gzBackend, int swapBytes) {
+	// create gz file in RAM, save to disk: header, image and footer share one deflate stream
+	struct TGzInput in;
+	gzInputInit(&in);
+	gzInputAdd(&in, (const unsigned char *)&hdr.version, sizeof(hdr), 0);
+	gzInputAdd(&in, src_buffer, src_len, swapBytes);
+	gzInputAdd(&in, (const unsigned char *)&footer.TR, sizeof(footer), 0);
+	return writeGz(baseName, &in, gzLevel, gzBackend);
 } // writeMghGz()
 
 int nii_saveMGH(char *niiFilename, struct nifti_1_header hdr, unsigned char *im, struct TDCMopts opts, struct TDICOMdata d, struct TDTI4D *dti4D, int numDTI) {
@@ -4574,25 +5404,23 @@ int nii_saveMGH(char *niiFilename, struct nifti_1_header hdr, unsigned char *im,
 	// write the data
 	char fname[2048] = {""};
 	strcpy(fname, niiFilename);
-#ifdef __LITTLE_ENDIAN__		// mgh data ALWAYS big endian!
-	swapEndian(&hdr, im, true); // byte-swap endian (e.g. little->big)
+	int swapBytes = 0;
+#ifdef __LITTLE_ENDIAN__ // mgh data ALWAYS big endian! swapped as written, im is not modified
+	swapBytes = swapEndianBytes(&hdr);
 #endif
 	if (isGz) {
 		strcat(fname, ".mgz");
-		writeMghGz(fname, mgh, footer, im, imgsz, opts.gzLevel);
+		return writeMghGz(fname, mgh, footer, im, imgsz, opts.gzLevel, opts.gzBackend, swapBytes);
 	} else {
 		strcat(fname, ".mgh");
 		FILE *fp = fopen(fname, "wb");
 		if (!fp)
 			return EXIT_FAILURE;
 		fwrite(&mgh, sizeof(Tmgh), 1, fp);
-		fwrite(&im[0], imgsz, 1, fp);
+		fwriteSwapped(im, imgsz, swapBytes, fp);
 		fwrite(&footer, sizeof(TmghFooter), 1, fp);
 		fclose(fp);
 	}
-#ifdef __LITTLE_ENDIAN__		 // mgh data ALWAYS big endian!
-	swapEndian(&hdr, im, false); // byte-swap endian (e.g. little->big)
-#endif
 	return EXIT_SUCCESS;
 } // nii_saveMGH()
 
@@ -4850,8 +5678,7 @@ int nii_saveNRRD(char *niiFilename, struct nifti_1_header hdr, unsigned char *im
 	}
 #else
 	if (strlen(opts.pigzname) < 1) { // internal compression
-		writeNiiGz(fname, hdr, im, imgsz, opts.gzLevel, true);
-		return EXIT_SUCCESS;
+		return writeNiiGz(fname, hdr, im, imgsz, opts.gzLevel, opts.gzBackend, true, 0);
 	}
 #endif
 	// below pigz
@@ -5681,6 +6508,15 @@ int nii_saveNII(char *niiFilename, struct nifti_1_header hdr, unsigned char *im,
 #else
 	if (opts.isOnlyBIDS)
 		return EXIT_SUCCESS;
+	if ((opts.output != NULL) && (opts.output->image != NULL)) {
+		hdr.vox_offset = 352;
+		opts.output->image(opts.output->user, niiFilename, &hdr, im, nii_ImgBytes(hdr));
+		return EXIT_SUCCESS;
+	}
+#ifndef myDisableZLib
+	if ((opts.isGz) && ((opts.gzTargetMBps > 0) || (opts.gzTargetRatio > 0.0)))
+		opts.gzLevel = gzAdaptiveLevel(im, nii_ImgBytes(hdr), &opts); // opts is a copy: level applies to this image only
+#endif
 	if (opts.saveFormat != kSaveFormatNIfTI) {
 		struct TDTI4D *dti4D = (struct TDTI4D *)malloc(sizeof(struct TDTI4D));
 		int ret = nii_saveForeign(niiFilename, hdr, im, opts, d, dti4D, 0);
@@ -5694,6 +6530,14 @@ int nii_saveNII(char *niiFilename, struct nifti_1_header hdr, unsigned char *im,
 		printMessage("Error: Image size is zero bytes %s\n", niiFilename);
 		return EXIT_FAILURE;
 	}
+	// non-native endian output swaps a copy of the header and byte-swaps voxels as they are written:
+	//  im is never modified, so several writers may share it
+	struct nifti_1_header hdrOut = hdr;
+	int swapBytes = 0;
+	if (!opts.isSaveNativeEndian) {
+		swapBytes = swapEndianBytes(&hdr);
+		swapEndianHdr(&hdrOut);
+	}
 #ifndef myDisableGzSizeLimits
 	// see https://github.com/rordenlab/dcm2niix/issues/124
 	uint64_t kMaxPigz = 4294967264;
@@ -5713,14 +6557,22 @@ int nii_saveNII(char *niiFilename, struct nifti_1_header hdr, unsigned char *im,
 		if ((imgsz + hdr.vox_offset) < kMaxPigz)
 			printWarning(" Hint: using external compressor (pigz) should help.\n");
 	} else if ((opts.isGz) && (strlen(opts.pigzname) < 1) && ((imgsz + hdr.vox_offset) < kMaxGz)) { // use internal compressor
-		if (!opts.isSaveNativeEndian)
-			swapEndian(&hdr, im, true); // byte-swap endian (e.g. little->big)
-		writeNiiGz(niiFilename, hdr, im, imgsz, opts.gzLevel, false);
+		double statsTime = statsTic();
+#ifdef myGzWriterThread
+		int ret = gzWriterPush(niiFilename, hdrOut, im, imgsz, opts.gzLevel, opts.gzBackend, swapBytes);
+		if (ret >= 0)
+			return ret;
+#endif
+		if (writeNiiGz(niiFilename, hdrOut, im, imgsz, opts.gzLevel, opts.gzBackend, false, swapBytes) != EXIT_SUCCESS)
+			return EXIT_FAILURE;
+		if (stats.isEnabled) {
+			char gzname[2048];
+			snprintf(gzname, sizeof(gzname), "%s.nii.gz", niiFilename);
+			statsOutput(gzname, imgsz + hdr.vox_offset, statsTime);
+		}
 #ifdef USING_R
 		images->appendPath(std::string(niiFilename) + ".nii.gz");
 #endif
-		if (!opts.isSaveNativeEndian)
-			swapEndian(&hdr, im, false); // unbyte-swap endian (e.g. big->little)
 		return EXIT_SUCCESS;
 	}
 #endif
@@ -5753,20 +6605,19 @@ int nii_saveNII(char *niiFilename, struct nifti_1_header hdr, unsigned char *im,
 		strcat(command, ".gz\""); // add quotes in case spaces in filename 'pigz "c:\my dir\img.nii"'
 		if (opts.isVerbose)
 			printMessage("Compress: %s\n", command);
+		double statsTime = statsTic();
 		FILE *pigzPipe;
 		if ((pigzPipe = popen(command, "w")) == NULL) {
 			printError("Unable to open pigz pipe\n");
 			return EXIT_FAILURE;
 		}
-		if (!opts.isSaveNativeEndian)
-			swapEndian(&hdr, im, true); // byte-swap endian (e.g. little->big)
-		fwrite(&hdr, sizeof(hdr), 1, pigzPipe);
+		fwrite(&hdrOut, sizeof(hdrOut), 1, pigzPipe);
 		uint32_t pad = 0;
 		fwrite(&pad, sizeof(pad), 1, pigzPipe);
-		fwrite(&im[0], imgsz, 1, pigzPipe);
+		fwriteSwapped(im, imgsz, swapBytes, pigzPipe);
 		pclose(pigzPipe);
-		if (!opts.isSaveNativeEndian)
-			swapEndian(&hdr, im, false); // unbyte-swap endian (e.g. big->little)
+		strcat(fname, ".gz");
+		statsOutput(fname, imgsz + hdr.vox_offset, statsTime);
 		return EXIT_SUCCESS;
 	}
 #endif
@@ -5775,16 +6626,11 @@ int nii_saveNII(char *niiFilename, struct nifti_1_header hdr, unsigned char *im,
 	FILE *fp = fopen(fname, "wb");
 	if (!fp)
 		return EXIT_FAILURE;
-	if (!opts.isSaveNativeEndian)
-		swapEndian(&hdr, im, true); // byte-swap endian (e.g. little->big)
-	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(&hdrOut, sizeof(hdrOut), 1, fp);
 	uint32_t pad = 0;
 	fwrite(&pad, sizeof(pad), 1, fp);
-	fwrite(&im[0], imgsz, 1, fp);
+	fwriteSwapped(im, imgsz, swapBytes, fp);
 	fclose(fp);
-
-	if (!opts.isSaveNativeEndian)
-		swapEndian(&hdr, im, false); // unbyte-swap endian (e.g. big->little)
 #endif
 
 #ifdef USING_R
@@ -5794,12 +6640,21 @@ int nii_saveNII(char *niiFilename, struct nifti_1_header hdr, unsigned char *im,
 #ifndef myDisableGzSizeLimits
 		if ((imgsz + hdr.vox_offset) > kMaxPigz) {
 			printWarning("Saving uncompressed data: image too large for pigz.\n");
+			statsOutput(fname, imgsz + hdr.vox_offset, 0.0);
 			return EXIT_SUCCESS;
 		}
 #endif
-		return pigz_File(fname, opts, imgsz);
+		double statsTime = statsTic();
+		int ret = pigz_File(fname, opts, imgsz);
+		if (stats.isEnabled) {
+			char gzname[2048];
+			snprintf(gzname, sizeof(gzname), "%s.gz", fname);
+			statsOutput(gzname, imgsz + hdr.vox_offset, statsTime);
+		}
+		return ret;
 	}
 #endif
+	statsOutput(fname, imgsz + hdr.vox_offset, 0.0);
 	return EXIT_SUCCESS;
 } // nii_saveNII()
 
@@ -5846,28 +6701,132 @@ int int12toint16(int U12) {
 	return (short)(U12 & 0xFFF) - ((U12 & 0x800) << 1);
 }
 
-void nii_mask12bit(unsigned char *img, struct nifti_1_header *hdr, bool isSigned) {
-	// https://github.com/rordenlab/dcm2niix/issues/251
-	if (hdr->datatype != DT_INT16)
-		return;
+// Voxel post-processing of 16-bit series is planned rather than applied immediately:
+//  the 12-bit overflow mask is folded into the range scan, and the dynamic-range multiply
+//  rides along with the row flip, so a large 4D series is streamed through memory twice
+//  instead of once per operation
+enum { kMask12None = 0,
+	kMask12Unsigned,
+	kMask12Signed };
+
+struct TVoxelPlan {
+	int mask12; // pending 12-bit mask for INT16 data, https://github.com/rordenlab/dcm2niix/issues/251
+	int scale16; // pending integer multiplier chosen by nii_scale16bit*(), 1 for none
+};
+
+void nii_initVoxelPlan(struct TVoxelPlan *plan) {
+	plan->mask12 = kMask12None;
+	plan->scale16 = 1;
+} // nii_initVoxelPlan()
+
+static inline uint16_t nii_voxelPlan16(uint16_t v, bool isSigned, int mask12, int scale) {
+	if (!isSigned)
+		return (uint16_t)(v * scale);
+	int16_t v16 = (int16_t)v;
+	if (mask12 == kMask12Signed) // issue 688: signed 12 bit data ranges from 0..4095, any other values are overflow
+		v16 = int12toint16(v16);
+	else if (mask12 == kMask12Unsigned) // 12 bit data ranges from 0..4095, any other values are overflow
+		v16 = v16 & 4095;
+	return (uint16_t)(int16_t)(v16 * scale);
+} // nii_voxelPlan16()
+
+int nii_voxelPlanSlices(struct nifti_1_header *hdr) {
 	int dim3to7 = 1;
 	for (int i = 3; i < 8; i++)
 		if (hdr->dim[i] > 1)
 			dim3to7 = dim3to7 * hdr->dim[i];
-	int nVox = hdr->dim[1] * hdr->dim[2] * dim3to7;
-	if (nVox < 1)
-		return;
-	int16_t *img16 = (int16_t *)img;
-	// issue 688
-	if (isSigned) {
-		for (int i = 0; i < nVox; i++)
-			img16[i] = int12toint16(img16[i]); // signed 12 bit data ranges from 0..4095, any other values are overflow
-
-	} else {
-		for (int i = 0; i < nVox; i++)
-			img16[i] = img16[i] & 4095; // 12 bit data ranges from 0..4095, any other values are overflow
+	return dim3to7;
+} // nii_voxelPlanSlices()
+
+void nii_scanRange16(unsigned char *img, struct nifti_1_header *hdr, struct TVoxelPlan *plan, int *mn, int *mx) {
+	// single min/max pass over INT16/UINT16 data, applying any pending 12-bit mask as it goes
+	bool isSigned = (hdr->datatype == DT_INT16);
+	int mask12 = isSigned ? plan->mask12 : kMask12None;
+	int nVox = hdr->dim[1] * hdr->dim[2] * nii_voxelPlanSlices(hdr);
+	uint16_t *img16 = (uint16_t *)img;
+	int lo = INT_MAX;
+	int hi = INT_MIN;
+#ifdef _OPENMP
+#pragma omp parallel if (nVox > 1048576)
+#endif
+	{
+		int tlo = INT_MAX;
+		int thi = INT_MIN;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int i = 0; i < nVox; i++) {
+			int v;
+			if (isSigned) {
+				if (mask12 != kMask12None)
+					img16[i] = nii_voxelPlan16(img16[i], true, mask12, 1);
+				v = (int16_t)img16[i];
+			} else
+				v = img16[i];
+			if (v < tlo)
+				tlo = v;
+			if (v > thi)
+				thi = v;
+		}
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+		{
+			if (tlo < lo)
+				lo = tlo;
+			if (thi > hi)
+				hi = thi;
+		}
+	}
+	plan->mask12 = kMask12None;
+	*mn = lo;
+	*mx = hi;
+} // nii_scanRange16()
+
+unsigned char *nii_applyVoxelPlan(unsigned char *img, struct nifti_1_header *hdr, struct TVoxelPlan *plan, bool isFlipRows) {
+	// one pass applying the pending 12-bit mask and 16-bit scale, optionally reversing row order (as nii_flipImgY)
+	bool isPending = (plan->mask12 != kMask12None) || (plan->scale16 > 1);
+	if ((!isPending) || (hdr->bitpix != 16) || ((hdr->datatype != DT_INT16) && (hdr->datatype != DT_UINT16))) {
+		nii_initVoxelPlan(plan);
+		if (isFlipRows)
+			return nii_flipImgY(img, hdr);
+		return img;
 	}
-}
+	bool isSigned = (hdr->datatype == DT_INT16);
+	int mask12 = isSigned ? plan->mask12 : kMask12None;
+	int scale = (plan->scale16 > 1) ? plan->scale16 : 1;
+	int nx = hdr->dim[1];
+	int ny = hdr->dim[2];
+	int nSlice = nii_voxelPlanSlices(hdr);
+	uint16_t *img16 = (uint16_t *)img;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if (nSlice > 16)
+#endif
+	for (int sl = 0; sl < nSlice; sl++) {
+		uint16_t *slice = img16 + ((size_t)sl * nx * ny);
+		if (!isFlipRows) {
+			for (size_t i = 0; i < ((size_t)nx * ny); i++)
+				slice[i] = nii_voxelPlan16(slice[i], isSigned, mask12, scale);
+			continue;
+		}
+		for (int y = 0; y < (ny / 2); y++) { // swap order of lines
+			uint16_t *lo = slice + ((size_t)y * nx);
+			uint16_t *hi = slice + ((size_t)(ny - 1 - y) * nx);
+			for (int x = 0; x < nx; x++) {
+				uint16_t v = nii_voxelPlan16(lo[x], isSigned, mask12, scale);
+				lo[x] = nii_voxelPlan16(hi[x], isSigned, mask12, scale);
+				hi[x] = v;
+			}
+		}
+		if (ny % 2) { // middle line stays in place
+			uint16_t *mid = slice + ((size_t)(ny / 2) * nx);
+			for (int x = 0; x < nx; x++)
+				mid[x] = nii_voxelPlan16(mid[x], isSigned, mask12, scale);
+		}
+	} // for each slice
+	nii_initVoxelPlan(plan);
+	return img;
+} // nii_applyVoxelPlan()
 
 unsigned char *nii_uint16toFloat32(unsigned char *img, struct nifti_1_header *hdr, int isVerbose) {
 	if (hdr->datatype != DT_UINT16)
@@ -5894,94 +6853,67 @@ unsigned char *nii_uint16toFloat32(unsigned char *img, struct nifti_1_header *hd
 	return imOut;
 } // nii_uint16toFloat32()
 
-void nii_scale16bitSigned(unsigned char *img, struct nifti_1_header *hdr, int isVerbose) {
+void nii_scale16bitSigned(unsigned char *img, struct nifti_1_header *hdr, struct TVoxelPlan *plan, int isVerbose) {
 	// lossless scaling of INT16 data: e.g. input with range -100...3200 and scl_slope=1
 	//  will be stored as -1000...32000 with scl_slope 0.1
+	//  the multiply itself is deferred to nii_applyVoxelPlan()
 	if (hdr->datatype != DT_INT16)
 		return;
-	int dim3to7 = 1;
-	for (int i = 3; i < 8; i++)
-		if (hdr->dim[i] > 1)
-			dim3to7 = dim3to7 * hdr->dim[i];
-	int nVox = hdr->dim[1] * hdr->dim[2] * dim3to7;
+	int nVox = hdr->dim[1] * hdr->dim[2] * nii_voxelPlanSlices(hdr);
 	if (nVox < 1)
 		return;
-	int16_t *img16 = (int16_t *)img;
-	int16_t max16 = img16[0];
-	int16_t min16 = max16;
-	for (int i = 0; i < nVox; i++) {
-		if (img16[i] < min16)
-			min16 = img16[i];
-		if (img16[i] > max16)
-			max16 = img16[i];
-	}
+	int min16, max16;
+	nii_scanRange16(img, hdr, plan, &min16, &max16);
 	int kMx = 32000; // actually 32767 - maybe a bit of padding for interpolation ringing
-	int scale = kMx / (int)max16;
+	int scale = kMx / max16;
 	if (abs(min16) > max16)
-		scale = kMx / (int)abs(min16);
+		scale = kMx / abs(min16);
 	if (scale < 2) {
 		if (isVerbose)
 			printMessage("Sufficient 16-bit range: raw %d..%d\n", min16, max16);
 		return; // already uses dynamic range
 	}
 	hdr->scl_slope = hdr->scl_slope / scale;
-	for (int i = 0; i < nVox; i++)
-		img16[i] = img16[i] * scale;
+	plan->scale16 = scale;
 	printMessage("Maximizing 16-bit range: raw %d..%d is%d\n", min16, max16, scale);
 	nii_storeIntegerScaleFactor(scale, hdr);
 }
 
-void nii_scale16bitUnsigned(unsigned char *img, struct nifti_1_header *hdr, int isVerbose) {
+void nii_scale16bitUnsigned(unsigned char *img, struct nifti_1_header *hdr, struct TVoxelPlan *plan, int isVerbose) {
 	// lossless scaling of UINT16 data: e.g. input with range 0...3200 and scl_slope=1
 	//  will be stored as 0...64000 with scl_slope 0.05
+	//  the multiply itself is deferred to nii_applyVoxelPlan()
 	if (hdr->datatype != DT_UINT16)
 		return;
-	int dim3to7 = 1;
-	for (int i = 3; i < 8; i++)
-		if (hdr->dim[i] > 1)
-			dim3to7 = dim3to7 * hdr->dim[i];
-	int nVox = hdr->dim[1] * hdr->dim[2] * dim3to7;
+	int nVox = hdr->dim[1] * hdr->dim[2] * nii_voxelPlanSlices(hdr);
 	if (nVox < 1)
 		return;
-	uint16_t *img16 = (uint16_t *)img;
-	uint16_t max16 = img16[0];
-	for (int i = 0; i < nVox; i++)
-		if (img16[i] > max16)
-			max16 = img16[i];
+	int min16, max16;
+	nii_scanRange16(img, hdr, plan, &min16, &max16);
 	int kMx = 64000; // actually 65535 - maybe a bit of padding for interpolation ringing
-	int scale = kMx / (int)max16;
+	int scale = kMx / max16;
 	if (scale < 2) {
 		if (isVerbose > 0)
 			printMessage("Sufficient unsigned 16-bit range: raw max %d\n", max16);
 		return; // already uses dynamic range
 	}
 	hdr->scl_slope = hdr->scl_slope / scale;
-	for (int i = 0; i < nVox; i++)
-		img16[i] = img16[i] * scale;
+	plan->scale16 = scale;
 	printMessage("Maximizing 16-bit range: raw max %d is%d\n", max16, scale);
 	nii_storeIntegerScaleFactor(scale, hdr);
 }
 
 #define UINT16_TO_INT16_IF_LOSSLESS
 #ifdef UINT16_TO_INT16_IF_LOSSLESS
-void nii_check16bitUnsigned(unsigned char *img, struct nifti_1_header *hdr, int isVerbose) {
+void nii_check16bitUnsigned(unsigned char *img, struct nifti_1_header *hdr, struct TVoxelPlan *plan, int isVerbose) {
 	// default NIfTI 16-bit is signed, set to unusual 16-bit unsigned if required...
 	if (hdr->datatype != DT_UINT16)
 		return;
-	int dim3to7 = 1;
-	for (int i = 3; i < 8; i++)
-		if (hdr->dim[i] > 1)
-			dim3to7 = dim3to7 * hdr->dim[i];
-	int nVox = hdr->dim[1] * hdr->dim[2] * dim3to7;
+	int nVox = hdr->dim[1] * hdr->dim[2] * nii_voxelPlanSlices(hdr);
 	if (nVox < 1)
 		return;
-	unsigned short *img16 = (unsigned short *)img;
-	unsigned short max16 = img16[0];
-	// clock_t start = clock();
-	for (int i = 0; i < nVox; i++)
-		if (img16[i] > max16)
-			max16 = img16[i];
-	// printMessage("max16= %d vox=%d %fms\n",max16, nVox, ((double)(clock()-start))/1000);
+	int min16, max16;
+	nii_scanRange16(img, hdr, plan, &min16, &max16);
 	if (max16 > 32767) {
 		if (isVerbose > 0)
 			printMessage("Note: 16-bit UNSIGNED integer image. Some tools will convert to 32-bit.\n");
@@ -5991,7 +6923,7 @@ void nii_check16bitUnsigned(unsigned char *img, struct nifti_1_header *hdr, int
 	}
 } // nii_check16bitUnsigned()
 #else
-void nii_check16bitUnsigned(unsigned char *img, struct nifti_1_header *hdr, int isVerbose) {
+void nii_check16bitUnsigned(unsigned char *img, struct nifti_1_header *hdr, struct TVoxelPlan *plan, int isVerbose) {
 	if (hdr->datatype != DT_UINT16)
 		return;
 	if (isVerbose < 1)
@@ -6042,112 +6974,106 @@ void adjustOriginForNegativeTilt(struct nifti_1_header *hdr, float shiftPxY) {
 	}
 }
 
-unsigned char *nii_saveNII3DtiltFloat32(char *niiFilename, struct nifti_1_header *hdr, unsigned char *im, struct TDCMopts opts, struct TDICOMdata d, float *sliceMMarray, float gantryTiltDeg, int manufacturer) {
-	// correct for gantry tilt - http://www.mathworks.com/matlabcentral/fileexchange/24458-dicom-gantry-tilt-correction
-	if (opts.isOnlyBIDS)
-		return im;
-	if (gantryTiltDeg == 0.0)
-		return im;
-	struct nifti_1_header hdrIn = *hdr;
-	int nVox2DIn = hdrIn.dim[1] * hdrIn.dim[2];
-	if ((nVox2DIn < 1) || (hdrIn.dim[0] != 3) || (hdrIn.dim[3] < 3))
-		return im;
-	if (hdrIn.datatype != DT_FLOAT32) {
-		printMessage("Only able to correct gantry tilt for 16-bit integer or 32-bit float data with at least 3 slices.");
-		return im;
-	}
-	printMessage("Gantry Tilt Correction is new: please validate conversions\n");
-	float GNTtanPx = tan(gantryTiltDeg / (180 / M_PI)) / hdrIn.pixdim[2]; // tangent(degrees->radian)
-// unintuitive step: reverse sign for negative gantry tilt, therefore -27deg == +27deg (why @!?#)
-//  seen in http://www.mathworks.com/matlabcentral/fileexchange/28141-gantry-detector-tilt-correction/content/gantry2.m
-//  also validated with actual data...
-#ifndef newTilt
-	if (manufacturer == kMANUFACTURER_PHILIPS) // see 'Manix' example from Osirix
-		GNTtanPx = -GNTtanPx;
-	else if ((manufacturer == kMANUFACTURER_SIEMENS) && (gantryTiltDeg > 0.0))
-		GNTtanPx = -GNTtanPx;
-	else if (manufacturer == kMANUFACTURER_GE)
-		; // do nothing
-	else if (gantryTiltDeg < 0.0)
-		GNTtanPx = -GNTtanPx; // see Toshiba examples from John Muschelli
-#endif						  // newTilt
-	float *imIn32 = (float *)im;
-	// create new output image: larger due to skew
-	//  compute how many pixels slice must be extended due to skew
-	int s = hdrIn.dim[3] - 1; // top slice
-	float maxSliceMM = fabs(s * hdrIn.pixdim[3]);
-	if (sliceMMarray != NULL)
-		maxSliceMM = fabs(sliceMMarray[s]);
-	int pxOffset = ceil(fabs(GNTtanPx * maxSliceMM));
-	// printMessage("Tilt extends slice by %d pixels", pxOffset);
-	hdr->dim[2] = hdr->dim[2] + pxOffset;
-	// When there is negative tilt, the image origin must be adjusted for the padding that will be added.
-	if (GNTtanPx < 0) {
-		// printMessage("Adjusting origin for %d pixels padding (float)\n", pxOffset);
-		adjustOriginForNegativeTilt(hdr, pxOffset);
-	}
-	int nVox2D = hdr->dim[1] * hdr->dim[2];
-	unsigned char *imOut = (unsigned char *)malloc(nVox2D * hdrIn.dim[3] * 4); // *4 as 32-bits per voxel, sizeof(float) );
-	float *imOut32 = (float *)imOut;
+// round half away from zero like round(), but without a libm call so the row loops vectorize
+//  v - trunc(v) is exact, unlike the add in (int)(v + 0.5f) which rounds 0.49999997f up
+static inline int tiltRoundInt(float v) {
+	int r = (int)v;
+	float frac = v - (float)r;
+	return r + (frac >= 0.5f) - (frac <= -0.5f);
+}
+
+static inline int64_t tiltRoundInt(double v) {
+	int64_t r = (int64_t)v;
+	double frac = v - (double)r;
+	return r + (frac >= 0.5) - (frac <= -0.5);
+}
+
+template <typename T, typename TAcc>
+static inline T tiltRound(TAcc v) {
+	return (T)tiltRoundInt(v);
+}
+
+template <>
+inline float tiltRound<float, float>(float v) {
+	return round(v); // float data may exceed the integer range
+}
+
+template <>
+inline double tiltRound<double, double>(double v) {
+	return round(v);
+}
+
+template <typename T, typename TAcc>
+static void nii_tiltShear(T *imIn, T *imOut, int nCol, int nRowIn, int nRowOut, int nSlice, float *offsets, T pixelPaddingValue, bool hasPixelPaddingValue) {
+	// shear each slice along rows: output row r blends input rows floor(r-Offset) and floor(r-Offset)+1
+	// with weights that are constant for the slice, so each row is a contiguous blend the compiler can vectorize
+	// slices are independent and run in parallel when compiled with OpenMP
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if (nSlice > 16)
+#endif
+	for (int s = 0; s < nSlice; s++) { // for each slice
+		float Offset = offsets[s];
+		float fracHi = ceil(Offset) - Offset; // ceil not floor since rI=r-Offset not rI=r+Offset
+		float fracLo = 1.0f - fracHi;
+		T *sliceIn = imIn + ((size_t)s * nRowIn * nCol);
+		T *sliceOut = imOut + ((size_t)s * nRowOut * nCol);
+		for (int r = 0; r < nRowOut; r++) { // for each row of output
+			T *rowOut = sliceOut + ((size_t)r * nCol);
+			float rI = (float)r - Offset; // input row
+			if ((rI < 0.0) || (rI >= nRowIn)) {
+				for (int c = 0; c < nCol; c++)
+					rowOut[c] = pixelPaddingValue;
+				continue;
+			}
+			int rLo = floor(rI);
+			int rHi = rLo + 1;
+			if (rHi >= nRowIn)
+				rHi = rLo;
+			T *rowLo = sliceIn + ((size_t)rLo * nCol); // row below
+			T *rowHi = sliceIn + ((size_t)rHi * nCol); // row above
+			if (!hasPixelPaddingValue) {
+				for (int c = 0; c < nCol; c++) // for each column
+					rowOut[c] = tiltRound<T, TAcc>((((TAcc)rowLo[c]) * fracLo) + ((TAcc)rowHi[c]) * fracHi);
+				continue;
+			}
+			for (int c = 0; c < nCol; c++) { // for each column
+				T valLo = rowLo[c];
+				T valHi = rowHi[c];
+				if ((valLo == pixelPaddingValue) || (valHi == pixelPaddingValue)) {
+					// https://github.com/rordenlab/dcm2niix/issues/262 - Use nearest neighbor interpolation
+					// when at least one of the values is padding.
+					rowOut[c] = fracHi >= 0.5 ? valHi : valLo;
+				} else
+					rowOut[c] = tiltRound<T, TAcc>((((TAcc)valLo) * fracLo) + ((TAcc)valHi) * fracHi);
+			} // for c (each column)
+		} // for r (each row)
+	} // for s (each slice)
+} // nii_tiltShear()
+
+template <typename T, typename TAcc>
+static unsigned char *nii_tiltShearImg(unsigned char *im, struct nifti_1_header hdrIn, struct nifti_1_header *hdr, struct TDICOMdata d, float *offsets, double minVal, double maxVal) {
 	// set surrounding voxels to padding (if present) or darkest observed value
+	T *imIn = (T *)im;
+	size_t nVoxIn = (size_t)hdrIn.dim[1] * hdrIn.dim[2] * hdrIn.dim[3];
 	bool hasPixelPaddingValue = !isnan(d.pixelPaddingValue);
-	float pixelPaddingValue;
+	T pixelPaddingValue;
 	if (hasPixelPaddingValue) {
-		pixelPaddingValue = d.pixelPaddingValue;
+		double pad = d.pixelPaddingValue;
+		if (minVal != maxVal) // integer data
+			pad = fmin(fmax(round(pad), minVal), maxVal);
+		pixelPaddingValue = (T)pad;
 	} else {
 		// Find darkest pixel value. Note that `hasPixelPaddingValue` remains false so that the darkest value
 		// will not trigger nearest neighbor interpolation below when this value is found in the image.
-		pixelPaddingValue = imIn32[0];
-		for (int v = 0; v < (nVox2DIn * hdrIn.dim[3]); v++)
-			if (imIn32[v] < pixelPaddingValue)
-				pixelPaddingValue = imIn32[v];
-	}
-	for (int v = 0; v < (nVox2D * hdrIn.dim[3]); v++)
-		imOut32[v] = pixelPaddingValue;
-	// copy skewed voxels
-	for (int s = 0; s < hdrIn.dim[3]; s++) { // for each slice
-		float sliceMM = s * hdrIn.pixdim[3];
-		if (sliceMMarray != NULL)
-			sliceMM = sliceMMarray[s]; // variable slice thicknesses
-		// sliceMM -= mmMidZ; //adjust so tilt relative to middle slice
-		if (GNTtanPx < 0)
-			sliceMM -= maxSliceMM;
-		float Offset = GNTtanPx * sliceMM;
-		float fracHi = ceil(Offset) - Offset; // ceil not floor since rI=r-Offset not rI=r+Offset
-		float fracLo = 1.0f - fracHi;
-		for (int r = 0; r < hdr->dim[2]; r++) { // for each row of output
-			float rI = (float)r - Offset;		// input row
-			if ((rI >= 0.0) && (rI < hdrIn.dim[2])) {
-				int rLo = floor(rI);
-				int rHi = rLo + 1;
-				if (rHi >= hdrIn.dim[2])
-					rHi = rLo;
-				rLo = (rLo * hdrIn.dim[1]) + (s * nVox2DIn);  // offset to start of row below
-				rHi = (rHi * hdrIn.dim[1]) + (s * nVox2DIn);  // offset to start of row above
-				int rOut = (r * hdrIn.dim[1]) + (s * nVox2D); // offset to output row
-				for (int c = 0; c < hdrIn.dim[1]; c++) {	  // for each column
-					float valLo = (float)imIn32[rLo + c];
-					float valHi = (float)imIn32[rHi + c];
-					if (hasPixelPaddingValue && (valLo == pixelPaddingValue || valHi == pixelPaddingValue)) {
-						// https://github.com/rordenlab/dcm2niix/issues/262 - Use nearest neighbor interpolation
-						// when at least one of the values is padding.
-						imOut32[rOut + c] = fracHi >= 0.5 ? valHi : valLo;
-					} else {
-						imOut32[rOut + c] = round(valLo * fracLo + valHi * fracHi);
-					}
-				} // for c (each column)
-			} // rI (input row) in range
-		} // for r (each row)
-	} // for s (each slice)*/
-	free(im);
-	if (sliceMMarray != NULL)
-		return imOut; // we will save after correcting for variable slice thicknesses
-	char niiFilenameTilt[2048] = {""};
-	strcat(niiFilenameTilt, niiFilename);
-	strcat(niiFilenameTilt, "_Tilt");
-	nii_saveNII3D(niiFilenameTilt, *hdr, imOut, opts, d);
+		pixelPaddingValue = imIn[0];
+		for (size_t v = 0; v < nVoxIn; v++)
+			if (imIn[v] < pixelPaddingValue)
+				pixelPaddingValue = imIn[v];
+	}
+	unsigned char *imOut = (unsigned char *)malloc((size_t)hdr->dim[1] * hdr->dim[2] * hdrIn.dim[3] * sizeof(T));
+	nii_tiltShear<T, TAcc>(imIn, (T *)imOut, hdrIn.dim[1], hdrIn.dim[2], hdr->dim[2], hdrIn.dim[3], offsets, pixelPaddingValue, hasPixelPaddingValue);
 	return imOut;
-} // nii_saveNII3DtiltFloat32()
+} // nii_tiltShearImg()
 
 unsigned char *nii_saveNII3Dtilt(char *niiFilename, struct nifti_1_header *hdr, unsigned char *im, struct TDCMopts opts, struct TDICOMdata d, float *sliceMMarray, float gantryTiltDeg, int manufacturer) {
 	// correct for gantry tilt - http://www.mathworks.com/matlabcentral/fileexchange/24458-dicom-gantry-tilt-correction
@@ -6159,10 +7085,8 @@ unsigned char *nii_saveNII3Dtilt(char *niiFilename, struct nifti_1_header *hdr,
 	int nVox2DIn = hdrIn.dim[1] * hdrIn.dim[2];
 	if ((nVox2DIn < 1) || (hdrIn.dim[0] != 3) || (hdrIn.dim[3] < 3))
 		return im;
-	if (hdrIn.datatype == DT_FLOAT32)
-		return nii_saveNII3DtiltFloat32(niiFilename, hdr, im, opts, d, sliceMMarray, gantryTiltDeg, manufacturer);
-	if (hdrIn.datatype != DT_INT16) {
-		printMessage("Only able to correct gantry tilt for 16-bit integer data with at least 3 slices.");
+	if ((hdrIn.datatype != DT_UINT8) && (hdrIn.datatype != DT_INT16) && (hdrIn.datatype != DT_UINT16) && (hdrIn.datatype != DT_INT32) && (hdrIn.datatype != DT_UINT32) && (hdrIn.datatype != DT_FLOAT32) && (hdrIn.datatype != DT_FLOAT64)) {
+		printMessage("Only able to correct gantry tilt for scalar integer or float data with at least 3 slices.");
 		return im;
 	}
 	printMessage("Gantry Tilt Correction is new: please validate conversions\n");
@@ -6180,7 +7104,6 @@ unsigned char *nii_saveNII3Dtilt(char *niiFilename, struct nifti_1_header *hdr,
 	else if (gantryTiltDeg < 0.0)
 		GNTtanPx = -GNTtanPx; // see Toshiba examples from John Muschelli
 #endif						  // newTilt
-	short *imIn16 = (short *)im;
 	// create new output image: larger due to skew
 	//  compute how many pixels slice must be extended due to skew
 	int s = hdrIn.dim[3] - 1; // top slice
@@ -6190,31 +7113,13 @@ unsigned char *nii_saveNII3Dtilt(char *niiFilename, struct nifti_1_header *hdr,
 	int pxOffset = ceil(fabs(GNTtanPx * maxSliceMM));
 	// printMessage("Tilt extends slice by %d pixels", pxOffset);
 	hdr->dim[2] = hdr->dim[2] + pxOffset;
-
 	// When there is negative tilt, the image origin must be adjusted for the padding that will be added.
 	if (GNTtanPx < 0) {
-		// printMessage("Adjusting origin for %d pixels padding (short)\n", pxOffset);
+		// printMessage("Adjusting origin for %d pixels padding\n", pxOffset);
 		adjustOriginForNegativeTilt(hdr, pxOffset);
 	}
-	int nVox2D = hdr->dim[1] * hdr->dim[2];
-	unsigned char *imOut = (unsigned char *)malloc(nVox2D * hdrIn.dim[3] * 2); // *2 as 16-bits per voxel, sizeof( short) );
-	short *imOut16 = (short *)imOut;
-	// set surrounding voxels to padding (if present) or darkest observed value
-	bool hasPixelPaddingValue = !isnan(d.pixelPaddingValue);
-	short pixelPaddingValue;
-	if (hasPixelPaddingValue) {
-		pixelPaddingValue = (short)round(d.pixelPaddingValue);
-	} else {
-		// Find darkest pixel value. Note that `hasPixelPaddingValue` remains false so that the darkest value
-		// will not trigger nearest neighbor interpolation below when this value is found in the image.
-		pixelPaddingValue = imIn16[0];
-		for (int v = 0; v < (nVox2DIn * hdrIn.dim[3]); v++)
-			if (imIn16[v] < pixelPaddingValue)
-				pixelPaddingValue = imIn16[v];
-	}
-	for (int v = 0; v < (nVox2D * hdrIn.dim[3]); v++)
-		imOut16[v] = pixelPaddingValue;
-	// copy skewed voxels
+	// row shift of each slice, computed once
+	float *offsets = (float *)malloc(hdrIn.dim[3] * sizeof(float));
 	for (int s = 0; s < hdrIn.dim[3]; s++) { // for each slice
 		float sliceMM = s * hdrIn.pixdim[3];
 		if (sliceMMarray != NULL)
@@ -6222,33 +7127,25 @@ unsigned char *nii_saveNII3Dtilt(char *niiFilename, struct nifti_1_header *hdr,
 		// sliceMM -= mmMidZ; //adjust so tilt relative to middle slice
 		if (GNTtanPx < 0)
 			sliceMM -= maxSliceMM;
-		float Offset = GNTtanPx * sliceMM;
-		float fracHi = ceil(Offset) - Offset; // ceil not floor since rI=r-Offset not rI=r+Offset
-		float fracLo = 1.0f - fracHi;
-		for (int r = 0; r < hdr->dim[2]; r++) { // for each row of output
-			float rI = (float)r - Offset;		// input row
-			if ((rI >= 0.0) && (rI < hdrIn.dim[2])) {
-				int rLo = floor(rI);
-				int rHi = rLo + 1;
-				if (rHi >= hdrIn.dim[2])
-					rHi = rLo;
-				rLo = (rLo * hdrIn.dim[1]) + (s * nVox2DIn);  // offset to start of row below
-				rHi = (rHi * hdrIn.dim[1]) + (s * nVox2DIn);  // offset to start of row above
-				int rOut = (r * hdrIn.dim[1]) + (s * nVox2D); // offset to output row
-				for (int c = 0; c < hdrIn.dim[1]; c++) {	  // for each row
-					short valLo = imIn16[rLo + c];
-					short valHi = imIn16[rHi + c];
-					if (hasPixelPaddingValue && (valLo == pixelPaddingValue || valHi == pixelPaddingValue)) {
-						// https://github.com/rordenlab/dcm2niix/issues/262 - Use nearest neighbor interpolation
-						// when at least one of the values is padding.
-						imOut16[rOut + c] = fracHi >= 0.5 ? valHi : valLo;
-					} else {
-						imOut16[rOut + c] = round((((float)valLo) * fracLo) + ((float)valHi) * fracHi);
-					}
-				} // for c (each column)
-			} // rI (input row) in range
-		} // for r (each row)
-	} // for s (each slice)*/
+		offsets[s] = GNTtanPx * sliceMM;
+	}
+	// integer types are interpolated in their native type (float weights, double for 32-bit integers)
+	unsigned char *imOut;
+	if (hdrIn.datatype == DT_UINT8)
+		imOut = nii_tiltShearImg<uint8_t, float>(im, hdrIn, hdr, d, offsets, 0, UINT8_MAX);
+	else if (hdrIn.datatype == DT_INT16)
+		imOut = nii_tiltShearImg<int16_t, float>(im, hdrIn, hdr, d, offsets, INT16_MIN, INT16_MAX);
+	else if (hdrIn.datatype == DT_UINT16)
+		imOut = nii_tiltShearImg<uint16_t, float>(im, hdrIn, hdr, d, offsets, 0, UINT16_MAX);
+	else if (hdrIn.datatype == DT_INT32)
+		imOut = nii_tiltShearImg<int32_t, double>(im, hdrIn, hdr, d, offsets, INT32_MIN, INT32_MAX);
+	else if (hdrIn.datatype == DT_UINT32)
+		imOut = nii_tiltShearImg<uint32_t, double>(im, hdrIn, hdr, d, offsets, 0, UINT32_MAX);
+	else if (hdrIn.datatype == DT_FLOAT32)
+		imOut = nii_tiltShearImg<float, float>(im, hdrIn, hdr, d, offsets, 0, 0);
+	else
+		imOut = nii_tiltShearImg<double, double>(im, hdrIn, hdr, d, offsets, 0, 0);
+	free(offsets);
 	free(im);
 	if (sliceMMarray != NULL)
 		return imOut; // we will save after correcting for variable slice thicknesses
@@ -6259,16 +7156,52 @@ unsigned char *nii_saveNII3Dtilt(char *niiFilename, struct nifti_1_header *hdr,
 	return imOut;
 } // nii_saveNII3Dtilt()
 
+struct TEqSlice { // source slices and weights for one equidistant output slice
+	int sLo, sHi;
+	float fracLo, fracHi;
+	bool isCopy; // select only from upper slice
+};
+
+template <typename T, typename TAcc>
+static void nii_eqBlend(T *im, T *imX, size_t nVox2D, int nSliceIn, int nSliceOut, int nVol, struct TEqSlice *eq) {
+	// each output slice is a copy or a weighted blend of two input slices: independent, so run in parallel
+	int nOut = nSliceOut * nVol;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if (nOut > 16)
+#endif
+	for (int i = 0; i < nOut; i++) {
+		int vol = i / nSliceOut;
+		struct TEqSlice *e = &eq[i % nSliceOut];
+		T *out = imX + ((size_t)i * nVox2D);
+		T *lo = im + (((size_t)vol * nSliceIn + e->sLo) * nVox2D);
+		T *hi = im + (((size_t)vol * nSliceIn + e->sHi) * nVox2D);
+		if (e->isCopy) {
+			memcpy(out, hi, nVox2D * sizeof(T));
+			continue;
+		}
+		TAcc fracLo = e->fracLo;
+		TAcc fracHi = e->fracHi;
+		for (size_t v = 0; v < nVox2D; v++)
+			out[v] = round((((TAcc)lo[v]) * fracLo) + ((TAcc)hi[v]) * fracHi);
+	}
+} // nii_eqBlend()
+
 int nii_saveNII3Deq(char *niiFilename, struct nifti_1_header hdr, unsigned char *im, struct TDCMopts opts, struct TDICOMdata d, float *sliceMMarray) {
 	// convert image with unequal slice distances to equal slice distances
 	// sliceMMarray = 0.0 3.0 6.0 12.0 22.0 <- ascending distance from first slice
+	// 4D images (e.g. multiphase CT) are resampled volume by volume using the same slice positions
 	if (opts.isOnlyBIDS)
 		return EXIT_SUCCESS;
 	int nVox2D = hdr.dim[1] * hdr.dim[2];
-	if ((nVox2D < 1) || (hdr.dim[0] != 3) || (hdr.dim[3] < 3))
+	int nVol = 1;
+	if (hdr.dim[0] > 3)
+		for (int i = 4; i < 8; i++)
+			if (hdr.dim[i] > 1)
+				nVol = nVol * hdr.dim[i];
+	if ((nVox2D < 1) || (hdr.dim[0] < 3) || (hdr.dim[0] > 4) || (hdr.dim[3] < 3))
 		return EXIT_FAILURE;
-	if ((hdr.datatype != DT_FLOAT32) && (hdr.datatype != DT_UINT8) && (hdr.datatype != DT_RGB24) && (hdr.datatype != DT_INT16)) {
-		printMessage("Only able to make equidistant slices from 8,16,24-bit integer or 32-bit float image data.");
+	if ((hdr.datatype != DT_FLOAT32) && (hdr.datatype != DT_FLOAT64) && (hdr.datatype != DT_UINT8) && (hdr.datatype != DT_RGB24) && (hdr.datatype != DT_INT16) && (hdr.datatype != DT_UINT16) && (hdr.datatype != DT_INT32) && (hdr.datatype != DT_UINT32)) {
+		printMessage("Only able to make equidistant slices from 8,16,24,32-bit integer or 32,64-bit float image data.");
 		return EXIT_FAILURE;
 	}
 	float mn = sliceMMarray[1] - sliceMMarray[0];
@@ -6305,98 +7238,52 @@ int nii_saveNII3Deq(char *niiFilename, struct nifti_1_header hdr, unsigned char
 		hdrX.srow_z[1] = hdr.srow_z[1] * Scale;
 		hdrX.srow_z[2] = hdr.srow_z[2] * Scale;
 	}
-	unsigned char *imX;
-	if (hdr.datatype == DT_FLOAT32) {
-		float *im32 = (float *)im;
-		imX = (unsigned char *)malloc((nVox2D * slices) * 4); // sizeof(float)
-		float *imX32 = (float *)imX;
-		for (int s = 0; s < slices; s++) {
-			float sliceXmm = s * mn;	// distance from first slice
-			int sliceXi = (s * nVox2D); // offset for this slice
-			int sHi = 0;
-			while ((sHi < (hdr.dim[3] - 1)) && (sliceMMarray[sHi] < sliceXmm))
-				sHi += 1;
-			int sLo = sHi - 1;
-			if (sLo < 0)
-				sLo = 0;
-			float mmHi = sliceMMarray[sHi];
-			float mmLo = sliceMMarray[sLo];
-			sLo = sLo * nVox2D;
-			sHi = sHi * nVox2D;
-			if ((mmHi == mmLo) || (sliceXmm > mmHi)) { // select only from upper slice TPX
-				// for (int v=0; v < nVox2D; v++)
-				//  imX16[sliceXi+v] = im16[sHi+v];
-				memcpy(&imX32[sliceXi], &im32[sHi], nVox2D * sizeof(float)); // memcpy( dest, src, bytes)
-			} else {
-				float fracHi = (sliceXmm - mmLo) / (mmHi - mmLo);
-				float fracLo = 1.0 - fracHi;
-				// weight between two slices
-				for (int v = 0; v < nVox2D; v++)
-					imX32[sliceXi + v] = round(((float)im32[sLo + v] * fracLo) + (float)im32[sHi + v] * fracHi);
-			}
-		}
-	} else if (hdr.datatype == DT_INT16) {
-		short *im16 = (short *)im;
-		imX = (unsigned char *)malloc((nVox2D * slices) * 2); // sizeof( short) );
-		short *imX16 = (short *)imX;
-		for (int s = 0; s < slices; s++) {
-			float sliceXmm = s * mn;	// distance from first slice
-			int sliceXi = (s * nVox2D); // offset for this slice
-			int sHi = 0;
-			while ((sHi < (hdr.dim[3] - 1)) && (sliceMMarray[sHi] < sliceXmm))
-				sHi += 1;
-			int sLo = sHi - 1;
-			if (sLo < 0)
-				sLo = 0;
-			float mmHi = sliceMMarray[sHi];
-			float mmLo = sliceMMarray[sLo];
-			sLo = sLo * nVox2D;
-			sHi = sHi * nVox2D;
-			if ((mmHi == mmLo) || (sliceXmm > mmHi)) { // select only from upper slice TPX
-				// for (int v=0; v < nVox2D; v++)
-				//  imX16[sliceXi+v] = im16[sHi+v];
-				memcpy(&imX16[sliceXi], &im16[sHi], nVox2D * sizeof(unsigned short)); // memcpy( dest, src, bytes)
-			} else {
-				float fracHi = (sliceXmm - mmLo) / (mmHi - mmLo);
-				float fracLo = 1.0 - fracHi;
-				// weight between two slices
-				for (int v = 0; v < nVox2D; v++)
-					imX16[sliceXi + v] = round(((float)im16[sLo + v] * fracLo) + (float)im16[sHi + v] * fracHi);
-			}
-		}
-	} else {
-		if (hdr.datatype == DT_RGB24)
-			nVox2D = nVox2D * 3;
-		imX = (unsigned char *)malloc((nVox2D * slices) * 2); // sizeof( short) );
-		for (int s = 0; s < slices; s++) {
-			float sliceXmm = s * mn;	// distance from first slice
-			int sliceXi = (s * nVox2D); // offset for this slice
-			int sHi = 0;
-			while ((sHi < (hdr.dim[3] - 1)) && (sliceMMarray[sHi] < sliceXmm))
-				sHi += 1;
-			int sLo = sHi - 1;
-			if (sLo < 0)
-				sLo = 0;
-			float mmHi = sliceMMarray[sHi];
-			float mmLo = sliceMMarray[sLo];
-			sLo = sLo * nVox2D;
-			sHi = sHi * nVox2D;
-			if ((mmHi == mmLo) || (sliceXmm > mmHi)) {	 // select only from upper slice TPX
-				memcpy(&imX[sliceXi], &im[sHi], nVox2D); // memcpy( dest, src, bytes)
-			} else {
-				float fracHi = (sliceXmm - mmLo) / (mmHi - mmLo);
-				float fracLo = 1.0 - fracHi; // weight between two slices
-				for (int v = 0; v < nVox2D; v++)
-					imX[sliceXi + v] = round(((float)im[sLo + v] * fracLo) + (float)im[sHi + v] * fracHi);
-			}
-		}
-	}
+	// slice weights are the same for every volume: compute the table once
+	// sliceMMarray is ascending, so the upper source slice never moves backwards
+	struct TEqSlice *eq = (struct TEqSlice *)malloc(slices * sizeof(struct TEqSlice));
+	int sHi = 0;
+	for (int s = 0; s < slices; s++) {
+		float sliceXmm = s * mn; // distance from first slice
+		while ((sHi < (hdr.dim[3] - 1)) && (sliceMMarray[sHi] < sliceXmm))
+			sHi += 1;
+		int sLo = sHi - 1;
+		if (sLo < 0)
+			sLo = 0;
+		float mmHi = sliceMMarray[sHi];
+		float mmLo = sliceMMarray[sLo];
+		eq[s].sLo = sLo;
+		eq[s].sHi = sHi;
+		eq[s].isCopy = (mmHi == mmLo) || (sliceXmm > mmHi); // select only from upper slice TPX
+		eq[s].fracHi = eq[s].isCopy ? 1.0f : (sliceXmm - mmLo) / (mmHi - mmLo);
+		eq[s].fracLo = 1.0 - eq[s].fracHi; // weight between two slices
+	}
+	size_t nVoxX = (size_t)nVox2D * slices * nVol;
+	unsigned char *imX = (unsigned char *)malloc(nVoxX * (hdr.bitpix / 8));
+	if (hdr.datatype == DT_FLOAT32)
+		nii_eqBlend<float, float>((float *)im, (float *)imX, nVox2D, hdr.dim[3], slices, nVol, eq);
+	else if (hdr.datatype == DT_FLOAT64)
+		nii_eqBlend<double, double>((double *)im, (double *)imX, nVox2D, hdr.dim[3], slices, nVol, eq);
+	else if (hdr.datatype == DT_INT16)
+		nii_eqBlend<int16_t, float>((int16_t *)im, (int16_t *)imX, nVox2D, hdr.dim[3], slices, nVol, eq);
+	else if (hdr.datatype == DT_UINT16)
+		nii_eqBlend<uint16_t, float>((uint16_t *)im, (uint16_t *)imX, nVox2D, hdr.dim[3], slices, nVol, eq);
+	else if (hdr.datatype == DT_INT32)
+		nii_eqBlend<int32_t, double>((int32_t *)im, (int32_t *)imX, nVox2D, hdr.dim[3], slices, nVol, eq);
+	else if (hdr.datatype == DT_UINT32)
+		nii_eqBlend<uint32_t, double>((uint32_t *)im, (uint32_t *)imX, nVox2D, hdr.dim[3], slices, nVol, eq);
+	else // DT_UINT8, DT_RGB24: planar RGB blends each byte
+		nii_eqBlend<uint8_t, float>(im, imX, (size_t)nVox2D * (hdr.bitpix / 8), hdr.dim[3], slices, nVol, eq);
+	free(eq);
 	char niiFilenameEq[2048] = {""};
 	strcat(niiFilenameEq, niiFilename);
 	strcat(niiFilenameEq, "_Eq");
-	nii_saveNII3D(niiFilenameEq, hdrX, imX, opts, d);
+	int ret;
+	if ((nVol > 1) && (!opts.isSave3D))
+		ret = nii_saveNII(niiFilenameEq, hdrX, imX, opts, d);
+	else
+		ret = nii_saveNII3D(niiFilenameEq, hdrX, imX, opts, d);
 	free(imX);
-	return EXIT_SUCCESS;
+	return ret;
 } // nii_saveNII3Deq()
 
 float PhilipsPreciseVal(float lPV, float lRS, float lRI, float lSS) {
@@ -7001,7 +7888,7 @@ void setBidsSiemens(struct TDICOMdata *d, int nConvert, int isVerbose, const cha
 		float shimSetting[8];
 		char protocolName[kDICOMStrLarge], fmriExternalInfo[kDICOMStrLarge], coilID[kDICOMStrLarge], consistencyInfo[kDICOMStrLarge], coilElements[kDICOMStrLarge], wipMemBlock[kDICOMStrExtraLarge];
 		TCsaAscii csaAscii;
-		siemensCsaAscii(filename, &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, seqDetails, fmriExternalInfo, protocolName, wipMemBlock);
+		siemensCsaAsciiCached(filename, d->seriesInstanceUID, &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, seqDetails, fmriExternalInfo, protocolName, wipMemBlock);
 		inv1 = csaAscii.alTI[0] / 1000.0;
 		inv2 = csaAscii.alTI[1] / 1000.0;
 		lContrasts = csaAscii.lContrasts;
@@ -7826,7 +8713,7 @@ void rescueSliceTimingSiemens(struct TDICOMdata *d, int verbose, int nSL, const
 	float shimSetting[8];
 	char protocolName[kDICOMStrLarge], fmriExternalInfo[kDICOMStrLarge], coilID[kDICOMStrLarge], consistencyInfo[kDICOMStrLarge], coilElements[kDICOMStrLarge], pulseSequenceDetails[kDICOMStrLarge], wipMemBlock[kDICOMStrExtraLarge];
 	TCsaAscii csaAscii;
-	siemensCsaAscii(filename, &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
+	siemensCsaAsciiCached(filename, d->seriesInstanceUID, &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
 	int ucMode = csaAscii.ucMode;
 	if ((ucMode < 1) || (ucMode == 3) || (ucMode > 4))
 		return;
@@ -8025,7 +8912,7 @@ int sliceTimingCore(struct TDCMsort *dcmSort, struct TDICOMdata *dcmList, struct
 void loadOverlay(char *imgname, unsigned char *img, int offset, int x, int y, int z) {
 	int nvox = x * y * z;
 	size_t imgszRead = (nvox + 7) >> 3; // overlay stored as 1 bit per voxel
-	FILE *file = fopen(imgname, "rb");
+	FILE *file = nii_fopen(imgname, "rb");
 	if (!file) {
 		printError("Unable to open '%s'\n", imgname);
 		return;
@@ -8053,6 +8940,18 @@ void loadOverlay(char *imgname, unsigned char *img, int offset, int x, int y, in
 	return;
 } // loadOverlay()
 
+#ifdef _OPENMP
+int stageThreads(int threads) {
+	// "--threads" budget of a stage, 0 = all threads
+	return (threads > 0) ? threads : omp_get_max_threads();
+} // stageThreads()
+
+bool isReentrantDecode(int compressionScheme) {
+	// decoders that several threads may run at once
+	return (compressionScheme == kCompressNone) || (compressionScheme == kCompressRLE) || (compressionScheme == kCompressPMSCT_RLE1) || (compressionScheme == kCompressC3) || (compressionScheme == kCompressJPEGLS);
+} // isReentrantDecode()
+#endif
+
 int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts opts, struct TDTI4D *dti4D, int segVol) {
 #if 0
 #ifdef USING_DCM2NIIXFSWRAPPER
@@ -8136,11 +9035,14 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 #endif
 
 #ifdef USING_DCM2NIIXFSWRAPPER
+	nii_resetMrifsStruct(); // split series (echoes, image types) must not inherit tdti, dicomfile or name postfixes
 	mrifsStruct.tdicomData = dcmList[indx]; // first in sorted list dcmSort
 #endif
 
 	struct nifti_1_header hdr0 = {0};
+	double statsTime = statsTic();
 	unsigned char *img = nii_loadImgXL(nameList->str[indx], &hdr0, dcmList[indx], iVaries, opts.compressFlag, opts.isVerbose, dti4D);
+	statsDecode(dcmList[indx].compressionScheme, statsTime);
 	if (strlen(opts.imageComments) > 0) {
 		for (int i = 0; i < 24; i++)
 			hdr0.aux_file[i] = 0; // remove dcm.imageComments
@@ -8152,6 +9054,7 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 		return EXIT_FAILURE;
 	size_t imgsz = nii_ImgBytes(hdr0);
 	unsigned char *imgM = (unsigned char *)malloc(imgsz * (uint64_t)nConvert);
+	statsBuffer(imgsz * (uint64_t)nConvert);
 	memcpy(&imgM[0], &img[0], imgsz);
 	free(img);
 
@@ -8473,6 +9376,26 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 						}
 					} // imageNum not sequential
 				} // dx varies
+			} else if ((dxVaries) && (!isSameFloat(dx, 0.0)) && (hdr0.dim[3] > 2) && ((hdr0.dim[3] * hdr0.dim[4]) == nConvert)) {
+				// 4D, e.g. multiphase CT: equalize slices if every volume shares the same variable slice positions
+				int nZ = hdr0.dim[3];
+				sliceMMarray = (float *)malloc(sizeof(float) * nConvert);
+				bool isVolSame = true;
+				bool isSliceVaries = false;
+				for (int i = 0; i < nConvert; i++) {
+					int z = i % nZ;
+					sliceMMarray[i] = intersliceDistance(dcmList[dcmSort[i - z].indx], dcmList[dcmSort[i].indx]);
+					if ((i >= nZ) && (!isSameFloatT(sliceMMarray[i], sliceMMarray[z], kSliceTolerance)))
+						isVolSame = false;
+					if ((i < nZ) && (z > 0) && (!isSameFloatT(dx, sliceMMarray[z] - sliceMMarray[z - 1], kSliceTolerance)))
+						isSliceVaries = true;
+				}
+				if ((isVolSame) && (isSliceVaries))
+					printWarning("Interslice distance varies in this volume (incompatible with NIfTI format).\n");
+				else {
+					free(sliceMMarray);
+					sliceMMarray = NULL;
+				}
 			} // not 4D
 			if ((hdr0.dim[4] > 0) && (dxVaries) && (dx == 0.0) && ((dcmList[dcmSort[0].indx].manufacturer == kMANUFACTURER_UNKNOWN) || (dcmList[dcmSort[0].indx].manufacturer == kMANUFACTURER_GE) || (dcmList[dcmSort[0].indx].manufacturer == kMANUFACTURER_PHILIPS))) { // Niels Janssen has provided GE sequential multi-phase acquisitions that also require swizzling
 				swapDim3Dim4(hdr0.dim[3], hdr0.dim[4], dcmSort);
@@ -8504,7 +9427,6 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 					dcmList[indx0].CSA.numDti = 1;
 		}
 		// printMessage(" %d %d %d %d %lu\n", hdr0.dim[1], hdr0.dim[2], hdr0.dim[3], hdr0.dim[4], (unsigned long)[imgM length]);
-		struct nifti_1_header hdrI;
 		// double time = -1.0;
 		if ((!opts.isOnlyBIDS) && (nConvert > 1)) {
 			// for (int i = 0; i < nConvert; i++)
@@ -8512,30 +9434,49 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 			// int iStart = 1;
 			// if (isReorder) iStart = 0;
 			// for (int i = 1; i < nConvert; i++) { //<- works except where ensureSequentialSlicePositions() changes 1st slice
+			bool isLoadError = false;
+#ifdef _OPENMP
+			// slices are decoded in parallel, straight into imgM, unless a decoder keeps global state (classic JPEG) or starts its own threads (JPEG 2000)
+			bool isParallelDecode = true;
+			for (int i = 0; i < nConvert; i++)
+				if (!isReentrantDecode(dcmList[dcmSort[i].indx].compressionScheme))
+					isParallelDecode = false;
+			int nDecoders = stageThreads(opts.threadsDecode);
+#pragma omp parallel for schedule(dynamic, 1) reduction(|| : isLoadError) if (isParallelDecode) num_threads(nDecoders)
+#endif
 			for (int i = 0; i < nConvert; i++) { // stack additional images
-				indx = dcmSort[i].indx;
+				if (isLoadError)
+					continue;
+				int indxI = dcmSort[i].indx;
+				struct nifti_1_header hdrI;
 				// double time2 = dcmList[dcmSort[i].indx].acquisitionTime;
 				// if (time != time2)
 				//	printWarning("%g\n", time2);
 				// time = time2;
 				// if (headerDcm2Nii(dcmList[indx], &hdrI) == EXIT_FAILURE) return EXIT_FAILURE;
-				img = nii_loadImgXL(nameList->str[indx], &hdrI, dcmList[indx], iVaries, opts.compressFlag, opts.isVerbose, dti4D);
-				if (img == NULL)
-					return EXIT_FAILURE;
+				double statsTimeI = statsTic();
+				int ret = nii_loadImgXLInto(nameList->str[indxI], &hdrI, dcmList[indxI], iVaries, opts.compressFlag, opts.isVerbose, dti4D, &imgM[(uint64_t)i * imgsz], imgsz);
+				statsDecode(dcmList[indxI].compressionScheme, statsTimeI);
+				if (ret != EXIT_SUCCESS) {
+					isLoadError = true;
+					continue;
+				}
 				if ((hdr0.dim[1] != hdrI.dim[1]) || (hdr0.dim[2] != hdrI.dim[2]) || (hdr0.bitpix != hdrI.bitpix)) {
-					printError("Image dimensions differ %s %s", nameList->str[dcmSort[0].indx], nameList->str[indx]);
-					free(imgM);
-					free(img);
-					return EXIT_FAILURE;
+					printError("Image dimensions differ %s %s", nameList->str[dcmSort[0].indx], nameList->str[indxI]);
+					isLoadError = true;
+					continue;
 				}
-				memcpy(&imgM[(uint64_t)i * imgsz], &img[0], imgsz);
-				free(img);
 
 #ifdef USING_DCM2NIIXFSWRAPPER
 				if (opts.isVerbose)
-					printMessage("load Image #%d %s\n", i, nameList->str[indx]);
+					printMessage("load Image #%d %s\n", i, nameList->str[indxI]);
 #endif
 			}
+			indx = dcmSort[nConvert - 1].indx;
+			if (isLoadError) {
+				free(imgM);
+				return EXIT_FAILURE;
+			}
 		} // skip if we are only creating BIDS
 		if (hdr0.dim[4] > 1) // for 4d datasets, last volume should be acquired before first
 			checkDateTimeOrder(&dcmList[dcmSort[0].indx], &dcmList[dcmSort[nConvert - 1].indx]);
@@ -8582,14 +9523,20 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 			if (isSameDouble(opts.seriesNumber[i], seriesNum))
 				break;
 		}
-		if (i == opts.numSeries)
+		if (i == opts.numSeries) {
+			free(sliceMMarray);
+			free(imgM);
 			return EXIT_SUCCESS;
+		}
 	}
 #else
 	// opts.numSeries equals to 1
 	double seriesNum = (double)dcmList[dcmSort[0].indx].seriesUidCrc;
-	if (!isSameDouble(opts.seriesNumber[0], seriesNum))
+	if (!isSameDouble(opts.seriesNumber[0], seriesNum)) {
+		free(sliceMMarray);
+		free(imgM);
 		return EXIT_SUCCESS;
+	}
 #endif
 
 	if (opts.numSeries >= 0) // issue453
@@ -8656,7 +9603,9 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 		printMessage("***USING_DCM2NIIXFSWRAPPER***: skip nii_flipZ() when sliceDir < 0 (%s:%s:%d)\n", __FILE__, __func__, __LINE__);
 #else
 		isFlipZ = true;
+		statsTime = statsTic();
 		imgM = nii_flipZ(imgM, &hdr0);
+		statsReorient(statsTime);
 		sliceDir = abs(sliceDir); // change this, we have flipped the image so GE DTI bvecs no longer need to be flipped!
 #endif
 	}
@@ -8664,18 +9613,21 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 	int numADC = 0;
 	int *volOrderIndex = nii_saveDTI(pathoutname, nConvert, dcmSort, dcmList, opts, sliceDir, dti4D, &numADC, hdr0.dim[4]);
 	PhilipsPrecise(&dcmList[dcmSort[0].indx], opts.isPhilipsFloatNotDisplayScaling, &hdr0, opts.isVerbose);
-	if ((dcmList[dcmSort[0].indx].bitsStored == 12) && (dcmList[dcmSort[0].indx].bitsAllocated == 16))
-		nii_mask12bit(imgM, &hdr0, dcmList[dcmSort[0].indx].isSigned);
+	struct TVoxelPlan voxelPlan; // per-voxel work deferred to a single pass, see nii_applyVoxelPlan()
+	nii_initVoxelPlan(&voxelPlan);
+	if ((dcmList[dcmSort[0].indx].bitsStored == 12) && (dcmList[dcmSort[0].indx].bitsAllocated == 16) && (hdr0.datatype == DT_INT16))
+		voxelPlan.mask12 = dcmList[dcmSort[0].indx].isSigned ? kMask12Signed : kMask12Unsigned;
 	if ((opts.saveFormat == kSaveFormatMGH) && (hdr0.datatype == DT_UINT16))
 		imgM = nii_uint16toFloat32(imgM, &hdr0, opts.isVerbose);
 	if ((opts.isMaximize16BitRange == kMaximize16BitRange_True) && (hdr0.datatype == DT_INT16)) {
-		nii_scale16bitSigned(imgM, &hdr0, opts.isVerbose); // allow INT16 to use full dynamic range
+		nii_scale16bitSigned(imgM, &hdr0, &voxelPlan, opts.isVerbose); // allow INT16 to use full dynamic range
 	} else if ((opts.isMaximize16BitRange == kMaximize16BitRange_True) && (hdr0.datatype == DT_UINT16) && (!dcmList[dcmSort[0].indx].isSigned)) {
-		nii_scale16bitUnsigned(imgM, &hdr0, opts.isVerbose); // allow UINT16 to use full dynamic range
+		nii_scale16bitUnsigned(imgM, &hdr0, &voxelPlan, opts.isVerbose); // allow UINT16 to use full dynamic range
 	} else if ((opts.isMaximize16BitRange == kMaximize16BitRange_False) && (hdr0.datatype == DT_UINT16) && (!dcmList[dcmSort[0].indx].isSigned))
-		nii_check16bitUnsigned(imgM, &hdr0, opts.isVerbose); // save UINT16 as INT16 if we can do this losslessly
+		nii_check16bitUnsigned(imgM, &hdr0, &voxelPlan, opts.isVerbose); // save UINT16 as INT16 if we can do this losslessly
 	if ((dcmList[dcmSort[0].indx].isXA10A) && (nConvert > 1) && (nConvert == (hdr0.dim[3] * hdr0.dim[4])))
 		printWarning("Siemens XA exported as classic not enhanced DICOM (issue 236)\n");
+	statsSeriesName(pathoutname);
 #ifndef USING_DCM2NIIXFSWRAPPER
 	printMessage("Convert %d DICOM as %s (%dx%dx%dx%d)\n", nConvert, pathoutname, hdr0.dim[1], hdr0.dim[2], hdr0.dim[3], hdr0.dim[4]);
 #else
@@ -8696,6 +9648,7 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 	// 3D-EPI vs 3D SPACE/MPRAGE/ETC
 	bool isFlipY = false;
 	bool isSetOrtho = false;
+	statsTime = statsTic();
 	if ((opts.isRotate3DAcq) && (dcmList[dcmSort[0].indx].is3DAcq) && (!dcmList[dcmSort[0].indx].isEPI) && (hdr0.dim[3] > 1) && (hdr0.dim[0] < 4)) {
 		bool isSliceEquidistant = true; // issue539
 		if ((nConvert > 0) && (sliceMMarray != NULL)) {
@@ -8709,17 +9662,19 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 				}
 		}
 		if (isSliceEquidistant) {
+			imgM = nii_applyVoxelPlan(imgM, &hdr0, &voxelPlan, false);
 			imgM = nii_setOrtho(imgM, &hdr0);
 			isSetOrtho = true;
 		}
 	} else if (opts.isFlipY) { //(FLIP_Y) //(dcmList[indx0].CSA.mosaicSlices < 2) &&
-		imgM = nii_flipY(imgM, &hdr0);
+		nii_flipYhdr(&hdr0); // rows are reversed by nii_applyVoxelPlan() below
 		isFlipY = true;
 	} else
 		printMessage("DICOM row order preserved: may appear upside down in tools that ignore spatial transforms\n");
-	if ((dcmList[dcmSort[0].indx].epiVersionGE == kGE_EPI_PEPOLAR_REV) || (dcmList[dcmSort[0].indx].epiVersionGE == kGE_EPI_PEPOLAR_FWD_REV_FLIP) || (dcmList[dcmSort[0].indx].epiVersionGE == kGE_EPI_PEPOLAR_REV_FWD_FLIP)) {
-		imgM = nii_flipImgY(imgM, &hdr0);
-	}
+	bool isFlipRowsGE = (dcmList[dcmSort[0].indx].epiVersionGE == kGE_EPI_PEPOLAR_REV) || (dcmList[dcmSort[0].indx].epiVersionGE == kGE_EPI_PEPOLAR_FWD_REV_FLIP) || (dcmList[dcmSort[0].indx].epiVersionGE == kGE_EPI_PEPOLAR_REV_FWD_FLIP);
+	// pending mask/scale, the DICOM to NIfTI row flip and the GE PEPOLAR row flip share one pass (two flips cancel)
+	imgM = nii_applyVoxelPlan(imgM, &hdr0, &voxelPlan, isFlipY != isFlipRowsGE);
+	statsReorient(statsTime);
 	// begin: gantry tilt we need to save the shear in the transform
 	mat44 sForm;
 	LOAD_MAT44(sForm,
@@ -8888,8 +9843,9 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 	mrifsStruct.hdr0 = hdr0;
 	mrifsStruct.imgsz = nii_ImgBytes(hdr0);
 	mrifsStruct.imgM = imgM;
+	nii_setMrifsDicomfile(nameList->str[dcmSort[0].indx]);
 
-	mrifsStruct_vector.push_back(mrifsStruct);
+	nii_emitMrifsStruct();
 #else
 	free(imgM);
 #endif
@@ -8898,20 +9854,24 @@ int saveDcm2NiiCore(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata d
 	return returnCode;								 // EXIT_SUCCESS;
 } // saveDcm2NiiCore()
 
+int saveDcm2NiiCoreStats(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts opts, struct TDTI4D *dti4D, int segVol) {
+	// saveDcm2NiiCore() with "--stats" bookkeeping for one output series
+	int series = statsSeriesBegin(nConvert, dcmSort, dcmList, nameList);
+	int ret = saveDcm2NiiCore(nConvert, dcmSort, dcmList, nameList, opts, dti4D, segVol);
+	statsSeriesEnd(series);
+	return ret;
+} // saveDcm2NiiCoreStats()
+
 int saveDcm2Nii(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts opts, struct TDTI4D *dti4D) {
 #ifdef USING_DCM2NIIXFSWRAPPER
-	memset(&mrifsStruct, 0, sizeof(mrifsStruct));
+	nii_resetMrifsStruct();
 
 	int indx0 = dcmSort[0].indx;
 
-	int len_dicomfile = strlen(nameList->str[indx0]);
-	mrifsStruct.dicomfile = (char *)malloc(len_dicomfile + 1);
-	memset(mrifsStruct.dicomfile, 0, len_dicomfile + 1);
-	memcpy(mrifsStruct.dicomfile, nameList->str[indx0], len_dicomfile);
-
 	if (opts.isDumpNotConvert) {
+		nii_setMrifsDicomfile(nameList->str[indx0]);
 		mrifsStruct.tdicomData = dcmList[indx0]; // first in sorted list dcmSort
-		mrifsStruct.dicomlst = new char *[nConvert];
+		mrifsStruct.dicomlst = (char **)malloc(nConvert * sizeof(char *));
 		mrifsStruct.nDcm = nConvert;
 
 		// retrieve pulseSequenceDetails (tSequenceFileName)
@@ -8919,9 +9879,9 @@ int saveDcm2Nii(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmLi
 		strcpy(mrifsStruct.pulseSequenceDetails, "");
 		if ((d->manufacturer == kMANUFACTURER_SIEMENS) && (d->CSA.SeriesHeader_offset > 0) && (d->CSA.SeriesHeader_length > 0)) {
 			float shimSetting[8];
-			char protocolName[kDICOMStrLarge], fmriExternalInfo[kDICOMStrLarge], coilID[kDICOMStrLarge], consistencyInfo[kDICOMStrLarge], coilElements[kDICOMStrLarge], pulseSequenceDetails[kDICOMStrLarge], wipMemBlock[kDICOMStrLarge];
+			char protocolName[kDICOMStrLarge], fmriExternalInfo[kDICOMStrLarge], coilID[kDICOMStrLarge], consistencyInfo[kDICOMStrLarge], coilElements[kDICOMStrLarge], pulseSequenceDetails[kDICOMStrLarge], wipMemBlock[kDICOMStrExtraLarge];
 			TCsaAscii csaAscii;
-			siemensCsaAscii(nameList->str[indx0], &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
+			siemensCsaAsciiCached(nameList->str[indx0], d->seriesInstanceUID, &csaAscii, d->CSA.SeriesHeader_offset, d->CSA.SeriesHeader_length, shimSetting, coilID, consistencyInfo, coilElements, pulseSequenceDetails, fmriExternalInfo, protocolName, wipMemBlock);
 			if (strlen(pulseSequenceDetails) >= kDICOMStr)
 				pulseSequenceDetails[kDICOMStr - 1] = 0;
 			strcpy(mrifsStruct.pulseSequenceDetails, pulseSequenceDetails);
@@ -8929,7 +9889,7 @@ int saveDcm2Nii(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmLi
 
 		dcmListDump(nConvert, dcmSort, dcmList, nameList, opts);
 
-		mrifsStruct_vector.push_back(mrifsStruct);
+		nii_emitMrifsStruct();
 
 		return 0;
 	}
@@ -8938,7 +9898,7 @@ int saveDcm2Nii(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmLi
 	//  however, it segments images when these properties vary
 	uint64_t indx = dcmSort[0].indx;
 	if ((!dcmList[indx].isScaleOrTEVaries) || (dcmList[indx].xyzDim[4] < 2))
-		return saveDcm2NiiCore(nConvert, dcmSort, dcmList, nameList, opts, dti4D, -1);
+		return saveDcm2NiiCoreStats(nConvert, dcmSort, dcmList, nameList, opts, dti4D, -1);
 	if ((dcmList[indx].xyzDim[4]) && (dti4D->sliceOrder[0] < 0)) {
 		printError("Unexpected error for image with varying echo time or intensity scaling\n");
 		return EXIT_FAILURE;
@@ -9075,7 +10035,7 @@ int saveDcm2Nii(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmLi
 		if (s > 1)
 			dcmList[indx].CSA.numDti = 0; // only save bvec for first type (magnitude)
 		// Call the save function, passing the pointer to dti4Ds
-		int ret2 = saveDcm2NiiCore(nConvert, dcmSort, dcmList, nameList, opts, dti4Ds, s);
+		int ret2 = saveDcm2NiiCoreStats(nConvert, dcmSort, dcmList, nameList, opts, dti4Ds, s);
 		if (ret2 != EXIT_SUCCESS)
 			ret = ret2;
 	}
@@ -9143,6 +10103,55 @@ int compareTDCMsort(void const *item1, void const *item2) {
 	return retval;
 } // compareTDCMsort()
 
+static inline uint32_t digitTDCMsort(const struct TDCMsort &d, int digit) {
+	// 16-bit digit of the (img, dimensionIndexValues[]) key, digit 0 is most significant
+	if (digit < 4)
+		return (uint32_t)((d.img >> (16 * (3 - digit))) & 0xFFFF);
+	uint32_t v = d.dimensionIndexValues[(digit - 4) >> 1];
+	return ((digit - 4) & 1) ? (v & 0xFFFF) : (v >> 16);
+}
+
+void sortTDCMsort(struct TDCMsort dcmSort[], int n) {
+	// same order as qsort with compareTDCMsort(), but a stable LSD radix sort on 16-bit digits:
+	//  digits that are identical for every image (e.g. series number, unused dimensions) are skipped,
+	//  so large 2D collections usually sort in a handful of linear passes
+	if (n < 256) {
+		qsort(dcmSort, n, sizeof(struct TDCMsort), compareTDCMsort);
+		return;
+	}
+	const int kDigits = 4 + (2 * MAX_NUMBER_OF_DIMENSIONS);
+	int *perm = (int *)malloc(n * sizeof(int));
+	int *next = (int *)malloc(n * sizeof(int));
+	int *count = (int *)malloc((65536 + 1) * sizeof(int));
+	for (int i = 0; i < n; i++)
+		perm[i] = i;
+	for (int digit = kDigits - 1; digit >= 0; digit--) { // least significant first
+		uint32_t first = digitTDCMsort(dcmSort[0], digit);
+		bool isVaries = false;
+		for (int i = 1; i < n; i++)
+			if (digitTDCMsort(dcmSort[i], digit) != first) {
+				isVaries = true;
+				break;
+			}
+		if (!isVaries)
+			continue;
+		memset(count, 0, (65536 + 1) * sizeof(int));
+		for (int i = 0; i < n; i++)
+			count[digitTDCMsort(dcmSort[perm[i]], digit) + 1]++;
+		for (int v = 0; v < 65536; v++)
+			count[v + 1] += count[v];
+		for (int i = 0; i < n; i++)
+			next[count[digitTDCMsort(dcmSort[perm[i]], digit)]++] = perm[i];
+		int *swap = perm;
+		perm = next;
+		next = swap;
+	}
+	permuteTDCMsort(dcmSort, n, perm);
+	free(count);
+	free(next);
+	free(perm);
+} // sortTDCMsort()
+
 int isSameFloatDouble(double a, double b) {
 	// Kludge for bug in 0002,0016="DIGITAL_JACKET", 0008,0070="GE MEDICAL SYSTEMS" DICOM data: Orient field (0020:0037) can vary 0.00604261 == 0.00604273 !!!
 	//  return (a == b); //niave approach does not have any tolerance for rounding errors
@@ -9174,7 +10183,7 @@ TWarnings setWarnings() {
 	return r;
 }
 
-bool isSameSet(struct TDICOMdata d1, struct TDICOMdata d2, struct TDCMopts *opts, struct TWarnings *warnings, bool *isMultiEcho, bool *isNonParallelSlices, bool *isCoilVaries) {
+bool isSameSet(const struct TDICOMdata &d1, const struct TDICOMdata &d2, struct TDCMopts *opts, struct TWarnings *warnings, bool *isMultiEcho, bool *isNonParallelSlices, bool *isCoilVaries) {
 	// returns true if d1 and d2 should be stacked together as a single output
 	if (!d1.isValid)
 		return false;
@@ -9736,7 +10745,6 @@ int searchDirRenameDICOM(char *path, int maxDepth, int depth, struct TDCMopts *o
 // the quick sort method should be faster when handling thousands of files.
 // difference very small for typical datasets (~0.1s for 3200 DICOMs)
 // #define myBubbleSort
-#ifndef myBubbleSort
 struct TCRCsort {
 	uint64_t indx;
 	uint32_t crc;
@@ -9757,25 +10765,318 @@ int compareTCRCsort(void const *item1, void const *item2) {
 		return 1;
 	return 0; // tie
 }
-#endif
 
-#ifdef myTimer
-int reportProgress(int progressPct, float frac) {
-	int newProgressPct = round(100.0 * frac);
-	const int kMinPct = 5;								   // e.g. if 10 then report 0.1, 0.2, 0.3...
-	newProgressPct = (newProgressPct / kMinPct) * kMinPct; // if MinPct is 5 and we are 87 percent done report 85%
-	if (newProgressPct == progressPct)
-		return progressPct;
-	if (newProgressPct != progressPct) // only report for change
-		printProgress((float)newProgressPct / 100.0);
-	return newProgressPct;
+bool isSeriesNotSelected(const char *fname, struct TDCMopts *opts) {
+	// -n pushdown: reject files of series that were not requested from their leading tags,
+	//  before full header parsing and without reading pixels
+	if ((opts->numSeries < 1) || (opts->isIgnoreSeriesInstanceUID))
+		return false;
+	uint32_t seriesUidCrc;
+	if (!readDICOMseriesUidCrc(fname, &seriesUidCrc))
+		return false; // uncertain: readDICOM() and saveDcm2Nii() decide
+	for (int i = 0; i < opts->numSeries; i++) {
+		double dx = opts->seriesNumber[i] - (double)seriesUidCrc;
+		if ((dx > -0.01) && (dx < 1000.0)) // saveDcm2Nii() adds echo / 10 to CRC of multi-echo series
+			return false;
+	}
+	return true;
+} // isSeriesNotSelected()
+
+static uint64_t subSeriesMix(uint64_t h, uint64_t v) {
+	// FNV-1a style combine for subSeriesKey()
+	h ^= v;
+	return h * 1099511628211ULL;
 }
-#endif
 
-int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
-#ifdef USING_DCM2NIIXFSWRAPPER
-	memset(&mrifsStruct, 0, sizeof(mrifsStruct));
-#endif
+uint64_t subSeriesKey(const struct TDICOMdata &d, struct TDCMopts *opts) {
+	// hash of the exact-match criteria of isSameSet() that apply whenever stacking is not forced:
+	//  files with different keys are never stacked, equal keys still need the pairwise check of tolerance fields (TR, TE, orientation...)
+	uint64_t h = 14695981039346656037ULL;
+	h = subSeriesMix(h, d.isValid);
+	h = subSeriesMix(h, (uint64_t)(uint32_t)d.manufacturer);
+	h = subSeriesMix(h, (uint64_t)(uint32_t)d.modality);
+	h = subSeriesMix(h, d.isDerived);
+	for (int i = 1; i < 4; i++)
+		h = subSeriesMix(h, (uint64_t)(uint32_t)d.xyzDim[i]);
+	h = subSeriesMix(h, d.isHasImaginary + (d.isHasPhase << 1) + (d.isHasReal << 2));
+	h = subSeriesMix(h, (uint64_t)(uint32_t)d.echoNum);
+	if (!opts->isForceStackDCE) // otherwise coils are stacked despite variation
+		h = subSeriesMix(h, d.coilCrc);
+	for (const char *c = d.protocolName; *c; c++)
+		h = subSeriesMix(h, (unsigned char)*c);
+	return h;
+} // subSeriesKey()
+
+struct TSubSeriesSort {
+	uint64_t key;
+	int pos;
+};
+
+int compareTSubSeriesSort(void const *item1, void const *item2) {
+	struct TSubSeriesSort const *s1 = (const struct TSubSeriesSort *)item1;
+	struct TSubSeriesSort const *s2 = (const struct TSubSeriesSort *)item2;
+	if (s1->key != s2->key)
+		return (s1->key < s2->key) ? -1 : 1;
+	return s1->pos - s2->pos; // keep group order within a bucket
+}
+
+int saveSeriesUidGroup(int nGroup, struct TCRCsort crcSort[], struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts *opts, struct TDTI4D *dti4D, struct TWarnings *warnings, bool *convertError) {
+	// stack and save all files of crcSort[0..nGroup-1], which must share the same seriesUidCrc
+	// returns number of DICOM files converted, sets convertError if any save fails
+	int nConvertTotal = 0;
+	int *convertIdxs = (int *)malloc(sizeof(int) * (nGroup));
+	// partition the group into buckets of identical subSeriesKey() in one sort, rather than testing every pair:
+	//  a leader is stacked with files of its own bucket. Files of other buckets are never stacked with it,
+	//  but they are still compared until echo and coil variations are both flagged, as file naming depends on these flags
+	struct TSubSeriesSort *keySort = (struct TSubSeriesSort *)malloc(sizeof(struct TSubSeriesSort) * nGroup);
+	for (int i = 0; i < nGroup; i++) {
+		keySort[i].key = subSeriesKey(dcmList[crcSort[i].indx], opts);
+		keySort[i].pos = i;
+	}
+	qsort(keySort, nGroup, sizeof(struct TSubSeriesSort), compareTSubSeriesSort);
+	int *bucketOf = (int *)malloc(sizeof(int) * nGroup);
+	int *nextInBucket = (int *)malloc(sizeof(int) * nGroup); // next group position in same bucket, -1 for none
+	int *bucketCursor = (int *)malloc(sizeof(int) * nGroup); // first position of bucket not before current leader
+	int nBucket = 0;
+	for (int k = 0; k < nGroup; k++) {
+		int pos = keySort[k].pos;
+		if ((k == 0) || (keySort[k].key != keySort[k - 1].key)) {
+			bucketCursor[nBucket] = pos;
+			nBucket++;
+		} else
+			nextInBucket[keySort[k - 1].pos] = pos;
+		bucketOf[pos] = nBucket - 1;
+		nextInBucket[pos] = -1;
+	}
+	free(keySort);
+	int *candidates = (int *)malloc(sizeof(int) * nGroup);
+	for (int i = 0; i < nGroup; i++) {
+		int ii = crcSort[i].indx;
+		if (dcmList[ii].converted2NII)
+			continue;
+		if (!dcmList[ii].isValid)
+			continue;
+
+#ifdef USING_DCM2NIIXFSWRAPPER
+		if (opts->numSeries > 0) {
+			double seriesNum = (double)dcmList[ii].seriesUidCrc;
+			if (!isSameDouble(opts->seriesNumber[0], seriesNum))
+				continue; // we convert one series at a time, skip the ones that we are not interested in
+		}
+#endif
+
+		int nConvert = 0;
+		bool isMultiEcho = false;
+		bool isNonParallelSlices = false;
+		bool isCoilVaries = false;
+		int jMax = nGroup - 1;
+		int nCandidate = 0;
+		bool isForceStack = (opts->isForceStackSameSeries == 1) || ((opts->isForceStackSameSeries == 2) && (dcmList[ii].isXRay));
+		if (isForceStack) { // keys do not apply, test all
+			for (int j = i; j < nGroup; j++)
+				candidates[nCandidate++] = j;
+		} else {
+			int b = bucketOf[i];
+			while ((bucketCursor[b] >= 0) && (bucketCursor[b] < i))
+				bucketCursor[b] = nextInBucket[bucketCursor[b]];
+			for (int j = bucketCursor[b]; j >= 0; j = nextInBucket[j])
+				candidates[nCandidate++] = j; // in group order
+		}
+		for (int c = 0; c < nCandidate; c++) {
+			int ji = crcSort[candidates[c]].indx;
+			if (isSameSet(dcmList[ii], dcmList[ji], opts, warnings, &isMultiEcho, &isNonParallelSlices, &isCoilVaries)) {
+				dcmList[ji].converted2NII = 1; // do not reprocess repeats
+				convertIdxs[nConvert] = ji;
+				nConvert++;
+			}
+		} // for all images with same seriesUID as first one
+		for (int b = 0; (!isForceStack) && (b < nBucket) && ((!isMultiEcho) || (!isCoilVaries)); b++) {
+			if (b == bucketOf[i])
+				continue;
+			while ((bucketCursor[b] >= 0) && (bucketCursor[b] < i))
+				bucketCursor[b] = nextInBucket[bucketCursor[b]];
+			for (int j = bucketCursor[b]; (j >= 0) && ((!isMultiEcho) || (!isCoilVaries)); j = nextInBucket[j])
+				isSameSet(dcmList[ii], dcmList[crcSort[j].indx], opts, warnings, &isMultiEcho, &isNonParallelSlices, &isCoilVaries); // flags only: keys differ, never stacked
+		}
+
+		// MGH set Opts.isForceStackSameSeries = 1 by default, isMultiEcho, isNonParallelSlices, isCoilVaries remain false for MGH default run after isSameSet
+		if ((isNonParallelSlices) && (dcmList[ii].CSA.mosaicSlices > 1) && (nConvert > 0)) { // issue481: if ANY volumes are non-parallel, save ALL as 3D
+			printWarning("Saving mosaics with non-parallel slices as 3D (issue 481)\n");
+			for (int j = i; j < nGroup; j++) {
+				int ji = crcSort[j].indx;
+				dcmList[ji].converted2NII = 1;
+				dcmList[ji].isNonParallelSlices = true;
+				if (isMultiEcho)
+					dcmList[ji].isMultiEcho = true;
+				if (isCoilVaries)
+					dcmList[ji].isCoilVaries = true;
+				struct TDCMsort dcmSort[1];
+				fillTDCMsort(dcmSort[0], ji, dcmList[ji]);
+				int ret = saveDcm2Nii(1, dcmSort, dcmList, nameList, *opts, dti4D);
+				if (ret == EXIT_SUCCESS)
+					nConvertTotal++;
+				else
+					*convertError = true;
+			}
+			continue;
+		} // issue481
+		// issue 381: ensure all images are informed if there are variations in echo, parallel slices, coil name:
+		if (isMultiEcho)
+			for (int j = i; j <= jMax; j++) {
+				int ji = crcSort[j].indx;
+				dcmList[ji].isMultiEcho = true;
+			}
+		if (isNonParallelSlices)
+			for (int j = i; j <= jMax; j++) {
+				int ji = crcSort[j].indx;
+				dcmList[ji].isNonParallelSlices = true;
+			}
+		if (isCoilVaries)
+			for (int j = i; j <= jMax; j++) {
+				int ji = crcSort[j].indx;
+				dcmList[ji].isCoilVaries = true;
+			}
+		TDCMsort *dcmSort = (TDCMsort *)malloc(nConvert * sizeof(TDCMsort));
+		for (int j = 0; j < nConvert; j++)
+			fillTDCMsort(dcmSort[j], convertIdxs[j], dcmList[convertIdxs[j]]);
+		sortTDCMsort(dcmSort, nConvert); // sort based on series and image numbers....
+		if (opts->isVerbose)
+			nConvert = removeDuplicatesVerbose(nConvert, dcmSort, nameList);
+		else
+			nConvert = removeDuplicates(nConvert, dcmSort);
+		int ret = saveDcm2Nii(nConvert, dcmSort, dcmList, nameList, *opts, dti4D);
+		if (ret == EXIT_SUCCESS)
+			nConvertTotal += nConvert;
+		else
+			*convertError = true;
+		free(dcmSort);
+	}
+	free(candidates);
+	free(bucketOf);
+	free(nextInBucket);
+	free(bucketCursor);
+	free(convertIdxs);
+	return nConvertTotal;
+} // saveSeriesUidGroup()
+
+#ifdef myTimer
+int reportProgress(int progressPct, float frac) {
+	int newProgressPct = round(100.0 * frac);
+	const int kMinPct = 5;								   // e.g. if 10 then report 0.1, 0.2, 0.3...
+	newProgressPct = (newProgressPct / kMinPct) * kMinPct; // if MinPct is 5 and we are 87 percent done report 85%
+	if (newProgressPct == progressPct)
+		return progressPct;
+	if (newProgressPct != progressPct) // only report for change
+		printProgress((float)newProgressPct / 100.0);
+	return newProgressPct;
+}
+#endif
+
+// convert a 4D DICOM or PAR/REC file found while reading headers in stage 2
+int convertStage2File(int idx, bool isParRec, struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts *opts, struct TDTI4D *dti4D) {
+	if (isParRec)
+		return convert_parRec(nameList->str[idx], *opts);
+	struct TDCMsort dcmSort[1];
+	fillTDCMsort(dcmSort[0], idx, dcmList[idx]);
+	return saveDcm2Nii(1, dcmSort, dcmList, nameList, *opts, dti4D);
+} // convertStage2File()
+
+#ifdef _OPENMP
+// Stage 2 conversion queue: a dedicated thread converts 4D DICOMs and PAR/REC while the remaining headers are read.
+//  Entries are converted one at a time in file order (output names depend on conversion order), so one image is in memory at a time.
+//  Each queued DICOM owns a copy of its dti4D: the header reader waits while these copies exceed kConvertQueueDti4DBytes.
+#define kConvertQueueDti4DBytes ((size_t)256 << 20)
+
+struct TConvertItem {
+	int idx;
+	bool isParRec;
+	struct TDTI4D *dti4D; // copy owned by the queue, NULL for PAR/REC
+};
+
+struct TConvertQueue {
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<struct TConvertItem> items;
+	std::thread converter; // started by the first entry
+	size_t dti4DBytes;	   // dti4D copies queued or being converted
+	int nConvert;
+	bool isClosed, isError;
+	struct TDICOMdata *dcmList;
+	struct TSearchList *nameList;
+	struct TDCMopts *opts;
+};
+
+void convertQueueInit(struct TConvertQueue *q, struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts *opts) {
+	q->dti4DBytes = 0;
+	q->nConvert = 0;
+	q->isClosed = false;
+	q->isError = false;
+	q->dcmList = dcmList;
+	q->nameList = nameList;
+	q->opts = opts;
+} // convertQueueInit()
+
+void convertQueueRun(struct TConvertQueue *q) {
+	std::unique_lock<std::mutex> guard(q->lock);
+	while (true) {
+		while ((q->items.empty()) && (!q->isClosed))
+			q->changed.wait(guard);
+		if (q->items.empty())
+			break;
+		struct TConvertItem item = q->items.front();
+		q->items.pop_front();
+		guard.unlock();
+		int ret = convertStage2File(item.idx, item.isParRec, q->dcmList, q->nameList, q->opts, item.dti4D);
+		free(item.dti4D);
+		guard.lock();
+		if (ret == EXIT_SUCCESS)
+			q->nConvert++;
+		else
+			q->isError = true;
+		if (!item.isParRec)
+			q->dti4DBytes -= sizeof(struct TDTI4D);
+		q->changed.notify_all();
+	}
+} // convertQueueRun()
+
+// queue a file for the converter thread, an oversize entry is accepted once the queue is empty
+void convertQueuePush(struct TConvertQueue *q, int idx, bool isParRec, struct TDTI4D *dti4D) {
+	struct TConvertItem item;
+	item.idx = idx;
+	item.isParRec = isParRec;
+	item.dti4D = NULL;
+	if (!isParRec) {
+		std::unique_lock<std::mutex> guard(q->lock);
+		while ((q->dti4DBytes > 0) && (q->dti4DBytes + sizeof(struct TDTI4D) > kConvertQueueDti4DBytes))
+			q->changed.wait(guard); // back-pressure: wait for the converter
+		q->dti4DBytes += sizeof(struct TDTI4D);
+		guard.unlock();
+		item.dti4D = (struct TDTI4D *)malloc(sizeof(struct TDTI4D));
+		memcpy(item.dti4D, dti4D, sizeof(struct TDTI4D));
+	}
+	std::lock_guard<std::mutex> guard(q->lock);
+	q->items.push_back(item);
+	if (!q->converter.joinable())
+		q->converter = std::thread(convertQueueRun, q);
+	q->changed.notify_all();
+} // convertQueuePush()
+
+// wait until every queued file is converted
+void convertQueueClose(struct TConvertQueue *q) {
+	{
+		std::lock_guard<std::mutex> guard(q->lock);
+		q->isClosed = true;
+		q->changed.notify_all();
+	}
+	if (q->converter.joinable())
+		q->converter.join();
+} // convertQueueClose()
+#endif
+
+int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
+#ifdef USING_DCM2NIIXFSWRAPPER
+	nii_resetMrifsStruct();
+#endif
 
 	struct TSearchList nameList;
 	int nConvertTotal = 0;
@@ -9794,7 +11095,30 @@ int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
 #ifdef myTimer
 	clock_t start = clock();
 #endif
-	if ((is_fileNotDir(opts->indir)) && isExt(opts->indir, ".txt")) {
+	statsInit(opts);
+	double statsWall = statsTic();
+	clock_t statsCPU = clock();
+#ifdef myEnableByteSource
+	if (opts->byteSources != NULL) { // in-memory objects registered by nii_loadByteSources()
+		nameList.maxItems = opts->numByteSources;
+		nameList.str = (char **)malloc((nameList.maxItems + 1) * sizeof(char *));
+		nameList.numItems = 0;
+		for (int i = 0; i < opts->numByteSources; i++) {
+			const char *dcmname = opts->byteSources[i].name;
+			if (isDICOMfile(dcmname) < 1)
+				continue;
+			nameList.str[nameList.numItems] = (char *)malloc(strlen(dcmname) + 1);
+			strcpy(nameList.str[nameList.numItems], dcmname);
+			nameList.numItems++;
+		}
+		if (nameList.numItems < 1) {
+			free(nameList.str);
+			printError("Unable to find any DICOM images in %d buffers\n", opts->numByteSources);
+			return kEXIT_NO_VALID_FILES_FOUND;
+		}
+	} else
+#endif
+		if ((is_fileNotDir(opts->indir)) && isExt(opts->indir, ".txt")) {
 		nameList.str = (char **)malloc((nameList.maxItems + 1) * sizeof(char *)); // reserve one pointer (32 or 64 bits) per potential file
 		nameList.numItems = 0;
 		FILE *fp = fopen(opts->indir, "r"); // textDICOM
@@ -9865,6 +11189,7 @@ int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
 		printMessage("Stage 1 (Count number of DICOMs) required %f seconds.\n", ((float)(clock() - start)) / CLOCKS_PER_SEC);
 	start = clock();
 #endif
+	statsStage(0, &statsWall, &statsCPU);
 	if (opts->isProgress)
 		progressPct = reportProgress(progressPct, kStage1Frac); // proportion correct, 0..100															// struct TDICOMdata dcmList [nameList.numItems]; //<- this exhausts the stack for large arrays
 	struct TDICOMdata *dcmList = (struct TDICOMdata *)malloc(nameList.numItems * sizeof(struct TDICOMdata));
@@ -9876,47 +11201,109 @@ int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
 	bool isDcmExt = isExt(opts->filename, ".dcm"); // "%r.dcm" with multi-echo should generate "1.dcm", "1e2.dcm"
 	if (isDcmExt)
 		opts->filename[strlen(opts->filename) - 4] = 0; // "%s_%r.dcm" -> "%s_%r"
-														// consider OpenMP
-														// g++-9 -I. main_console.cpp nii_foreign.cpp nii_dicom.cpp jpg_0XC3.cpp ujpeg.cpp nifti1_io_core.cpp nii_ortho.cpp nii_dicom_batch.cpp -o dcm2niix -DmyDisableOpenJPEG -fopenmp
-	for (int i = 0; i < (int)nDcm; i++) {
-		if ((isExt(nameList.str[i], ".par")) && (isDICOMfile(nameList.str[i]) < 1)) {
-			// strcpy(opts->indir, nameList.str[i]); //set to original file name, not path
-			dcmList[i].converted2NII = 1;
-			int ret = convert_parRec(nameList.str[i], *opts);
-			if (ret == EXIT_SUCCESS)
-				nConvertTotal++;
-			else
-				convertError = true;
-			continue;
-		}
-		dcmList[i] = readDICOMx(nameList.str[i], &prefs, dti4D); // ignore compile warning - memory only freed on first of 2 passes
-		// dcmList[i] = readDICOMv(nameList.str[i], opts->isVerbose, opts->compressFlag, dti4D); //ignore compile warning - memory only freed on first of 2 passes
-		if (opts->isIgnoreSeriesInstanceUID)
-			dcmList[i].seriesUidCrc = dcmList[i].seriesNum;
-		// if (!dcmList[i].isValid) printf(">>>>Not a valid DICOM %s\n", nameList.str[i]);
-		if ((dcmList[i].isValid) && ((dti4D->sliceOrder[0] >= 0) || (dcmList[i].CSA.numDti > 1))) { // 4D dataset: dti4D arrays require huge amounts of RAM - write this immediately
-			struct TDCMsort dcmSort[1];
-			fillTDCMsort(dcmSort[0], i, dcmList[i]);
-			dcmList[i].converted2NII = 1;
-			int ret = saveDcm2Nii(1, dcmSort, dcmList, &nameList, *opts, dti4D);
-			if (ret == EXIT_SUCCESS)
-				nConvertTotal++;
-			else
-				convertError = true;
+	// Stage 2 is a pipeline when compiled with OpenMP (-fopenmp, USE_OPENMP):
+	//  reader threads parse headers concurrently, each into its own dti4D,
+	//  while the "ordered" block handles files in the original file order.
+	//  With more than one thread, 4D files and PAR/REC are handed to a dedicated converter thread, so header scanning does not wait for them.
+	int lastParsed = -1; // index of last DICOM parsed: dti4D must describe this file after stage 2, as in serial code
+#ifdef myGzWriterThread
+	gzWriterStart(opts);
+#endif
+#ifdef _OPENMP
+	struct TConvertQueue convertQueue;
+	convertQueueInit(&convertQueue, dcmList, &nameList, opts);
+	int nReaders = stageThreads(opts->threadsRead);
+	bool isBackground = (nReaders > 1) && (!opts->isVerbose);
+	if (isBackground)
+		nReaders--; // one thread converts
+	if (opts->isVerbose)
+		nReaders = 1;
+#pragma omp parallel num_threads(nReaders)
+#endif
+	{
+		struct TDTI4D *dti4Dt = dti4D;
+#ifdef _OPENMP
+		if (omp_get_thread_num() > 0)
+			dti4Dt = (struct TDTI4D *)malloc(sizeof(struct TDTI4D));
+#endif
+		int threadLastParsed = -1;
+#ifdef _OPENMP
+#pragma omp for ordered schedule(dynamic, 1)
+#endif
+		for (int i = 0; i < (int)nDcm; i++) {
+			bool isParRec = (isExt(nameList.str[i], ".par")) && (isDICOMfile(nameList.str[i]) < 1);
+			bool isNotSelected = (!isParRec) && (isSeriesNotSelected(nameList.str[i], opts));
+			if (isNotSelected) {
+				dcmList[i] = clear_dicom_data(); // isValid = false: never stacked or converted
+				dcmList[i].converted2NII = 1;
+			} else if (!isParRec) {
+				dcmList[i] = readDICOMx(nameList.str[i], &prefs, dti4Dt); // ignore compile warning - memory only freed on first of 2 passes
+				// dcmList[i] = readDICOMv(nameList.str[i], opts->isVerbose, opts->compressFlag, dti4D); //ignore compile warning - memory only freed on first of 2 passes
+				if (opts->isIgnoreSeriesInstanceUID)
+					dcmList[i].seriesUidCrc = dcmList[i].seriesNum;
+				threadLastParsed = i;
+			}
+#ifdef _OPENMP
+#pragma omp ordered
+#endif
+			if (!isNotSelected) {
+				bool isConvert = false;
+				if (isParRec) {
+					// strcpy(opts->indir, nameList.str[i]); //set to original file name, not path
+					dcmList[i].converted2NII = 1;
+					isConvert = true;
+				} else {
+					lastParsed = i;
+					statsParsed(nameList.str[i]);
+					// if (!dcmList[i].isValid) printf(">>>>Not a valid DICOM %s\n", nameList.str[i]);
+					if ((dcmList[i].isValid) && ((dti4Dt->sliceOrder[0] >= 0) || (dcmList[i].CSA.numDti > 1))) { // 4D dataset: dti4D arrays require huge amounts of RAM - write this immediately
+						dcmList[i].converted2NII = 1;
+						isConvert = true;
+					}
+					if ((dcmList[i].compressionScheme != kCompressNone) && (!compressionWarning) && (opts->compressFlag != kCompressNone)) {
+						compressionWarning = true; // generate once per conversion rather than once per image
+						printMessage("Image Decompression is new: please validate conversions\n");
+					}
+				}
+#ifdef _OPENMP
+				if ((isConvert) && (isBackground)) {
+					convertQueuePush(&convertQueue, i, isParRec, dti4Dt);
+					isConvert = false; // status is collected by convertQueueClose()
+				}
+#endif
+				if (isConvert) {
+					int ret = convertStage2File(i, isParRec, dcmList, &nameList, opts, dti4Dt);
+					if (ret == EXIT_SUCCESS)
+						nConvertTotal++;
+					else
+						convertError = true;
+				}
+				if (opts->isProgress)
+					progressPct = reportProgress(progressPct, kStage1Frac + (kStage2Frac * (float)i / (float)nDcm)); // proportion correct, 0..100
+			}
 		}
-		if ((dcmList[i].compressionScheme != kCompressNone) && (!compressionWarning) && (opts->compressFlag != kCompressNone)) {
-			compressionWarning = true; // generate once per conversion rather than once per image
-			printMessage("Image Decompression is new: please validate conversions\n");
+		if (dti4Dt != dti4D) {
+			if ((threadLastParsed >= 0) && (threadLastParsed == lastParsed))
+				memcpy(dti4D, dti4Dt, sizeof(struct TDTI4D));
+			free(dti4Dt);
 		}
-		if (opts->isProgress)
-			progressPct = reportProgress(progressPct, kStage1Frac + (kStage2Frac * (float)i / (float)nDcm)); // proportion correct, 0..100
 	}
+#ifdef _OPENMP
+	convertQueueClose(&convertQueue);
+	nConvertTotal += convertQueue.nConvert;
+	if (convertQueue.isError)
+		convertError = true;
+#endif
 #ifdef myTimer
 	if (opts->isProgress > 1)
 		printMessage("Stage 2 (Read DICOM headers, Convert 4D) required %f seconds.\n", ((float)(clock() - start)) / CLOCKS_PER_SEC);
 	start = clock();
 #endif
+	statsStage(1, &statsWall, &statsCPU);
 	if ((opts->isRenameNotConvert) || (opts->onlySearchDirForDICOM != 0)) {
+#ifdef myGzWriterThread
+		gzWriterStop();
+#endif
 		free(dcmList);
 		free(dti4D);
 		return EXIT_SUCCESS;
@@ -9998,7 +11385,7 @@ int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
 						}
 					} // unable to stack images: mark files that may need file name dis-ambiguation
 				}
-				qsort(dcmSort, nConvert, sizeof(struct TDCMsort), compareTDCMsort); // sort based on series and image numbers....
+				sortTDCMsort(dcmSort, nConvert); // sort based on series and image numbers....
 				// dcmList[dcmSort[0].indx].isMultiEcho = isMultiEcho;
 				if (opts->isVerbose)
 					nConvert = removeDuplicatesVerbose(nConvert, dcmSort, &nameList);
@@ -10021,105 +11408,29 @@ int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
 	for (int i = 0; i < (int)nDcm; i++)
 		fillTCRCsort(crcSort[i], i, dcmList[i].seriesUidCrc);
 	qsort(crcSort, nDcm, sizeof(struct TCRCsort), compareTCRCsort); // sort based on series and image numbers....
-	int *convertIdxs = (int *)malloc(sizeof(int) * (nDcm));
-	for (int i = 0; i < (int)nDcm; i++) {
-		int ii = crcSort[i].indx;
-		if (dcmList[ii].converted2NII)
-			continue;
-		if (!dcmList[ii].isValid)
-			continue;
-
-#ifdef USING_DCM2NIIXFSWRAPPER
-		if (opts->numSeries > 0) {
-			double seriesNum = (double)dcmList[ii].seriesUidCrc;
-			if (!isSameDouble(opts->seriesNumber[0], seriesNum))
-				continue; // we convert one series at a time, skip the ones that we are not interested in
-		}
-#endif
-
-		int nConvert = 0;
-		bool isMultiEcho = false;
-		bool isNonParallelSlices = false;
-		bool isCoilVaries = false;
-		int jMax = i;
-		for (int j = i; j < (int)nDcm; j++) {
-			int ji = crcSort[j].indx;
-			if (dcmList[ii].seriesUidCrc != dcmList[ji].seriesUidCrc)
-				break; // seriesUID no longer matches no need to examine any subsequent images
-			jMax = j;
-			if (isSameSet(dcmList[ii], dcmList[ji], opts, &warnings, &isMultiEcho, &isNonParallelSlices, &isCoilVaries)) {
-				dcmList[ji].converted2NII = 1; // do not reprocess repeats
-				convertIdxs[nConvert] = ji;
-				nConvert++;
-			}
-		} // for all images with same seriesUID as first one
-
-		// MGH set Opts.isForceStackSameSeries = 1 by default, isMultiEcho, isNonParallelSlices, isCoilVaries remain false for MGH default run after isSameSet
-		if ((isNonParallelSlices) && (dcmList[ii].CSA.mosaicSlices > 1) && (nConvert > 0)) { // issue481: if ANY volumes are non-parallel, save ALL as 3D
-			printWarning("Saving mosaics with non-parallel slices as 3D (issue 481)\n");
-			for (int j = i; j < (int)nDcm; j++) {
-				int ji = crcSort[j].indx;
-				if (dcmList[ii].seriesUidCrc != dcmList[ji].seriesUidCrc)
-					break;
-				dcmList[ji].converted2NII = 1;
-				dcmList[ji].isNonParallelSlices = true;
-				if (isMultiEcho)
-					dcmList[ji].isMultiEcho = true;
-				if (isCoilVaries)
-					dcmList[ji].isCoilVaries = true;
-				struct TDCMsort dcmSort[1];
-				fillTDCMsort(dcmSort[0], ji, dcmList[ji]);
-				int ret = saveDcm2Nii(1, dcmSort, dcmList, &nameList, *opts, dti4D);
-				if (ret == EXIT_SUCCESS)
-					nConvertTotal++;
-				else
-					convertError = true;
-			}
-			continue;
-		} // issue481
-		// issue 381: ensure all images are informed if there are variations in echo, parallel slices, coil name:
-		if (isMultiEcho)
-			for (int j = i; j <= jMax; j++) {
-				int ji = crcSort[j].indx;
-				dcmList[ji].isMultiEcho = true;
-			}
-		if (isNonParallelSlices)
-			for (int j = i; j <= jMax; j++) {
-				int ji = crcSort[j].indx;
-				dcmList[ji].isNonParallelSlices = true;
-			}
-		if (isCoilVaries)
-			for (int j = i; j <= jMax; j++) {
-				int ji = crcSort[j].indx;
-				dcmList[ji].isCoilVaries = true;
-			}
-		TDCMsort *dcmSort = (TDCMsort *)malloc(nConvert * sizeof(TDCMsort));
-		for (int j = 0; j < nConvert; j++)
-			fillTDCMsort(dcmSort[j], convertIdxs[j], dcmList[convertIdxs[j]]);
-		qsort(dcmSort, nConvert, sizeof(struct TDCMsort), compareTDCMsort); // sort based on series and image numbers....
-		if (opts->isVerbose)
-			nConvert = removeDuplicatesVerbose(nConvert, dcmSort, &nameList);
-		else
-			nConvert = removeDuplicates(nConvert, dcmSort);
-		int ret = saveDcm2Nii(nConvert, dcmSort, dcmList, &nameList, *opts, dti4D);
-		if (ret == EXIT_SUCCESS)
-			nConvertTotal += nConvert;
-		else
-			convertError = true;
-		free(dcmSort);
+	for (int i = 0; i < (int)nDcm;) {
+		int nGroup = 1; // number of files with identical series instance UID
+		while (((i + nGroup) < (int)nDcm) && (crcSort[i + nGroup].crc == crcSort[i].crc))
+			nGroup++;
+		nConvertTotal += saveSeriesUidGroup(nGroup, &crcSort[i], dcmList, &nameList, opts, dti4D, &warnings, &convertError);
+		i += nGroup;
 		if (opts->isProgress)
 			progressPct = reportProgress(progressPct, kStage1Frac + kStage2Frac + (kStage3Frac * (float)nConvertTotal / (float)nDcm)); // proportion correct, 0..100
 	}
-	free(convertIdxs);
 	free(crcSort);
 #endif
 #ifdef USING_R
 	}
 #endif
+#ifdef myGzWriterThread
+	if (gzWriterStop() != EXIT_SUCCESS)
+		convertError = true;
+#endif
 #ifdef myTimer
 	if (opts->isProgress > 1)
 		printMessage("Stage 3 (Convert 2D and 3D images) required %f seconds.\n", ((float)(clock() - start)) / CLOCKS_PER_SEC);
 #endif
+	statsStage(2, &statsWall, &statsCPU);
 	if (opts->isProgress)
 		progressPct = reportProgress(progressPct, 1); // proportion correct, 0..100
 	free(dcmList);
@@ -10139,6 +11450,41 @@ int nii_loadDirCore(char *indir, struct TDCMopts *opts) {
 	return EXIT_SUCCESS;
 } // nii_loadDirCore()
 
+#ifdef myEnableByteSource
+int nii_loadByteSources(struct TByteSource *sources, int nSources, struct TDCMopts *opts) {
+	// library entry point: convert DICOM objects held in memory (or served by a read callback) without spooling them to disk
+	//  set opts->output to receive images and BIDS sidecars in memory, otherwise files are written to opts->outdir
+	//  e.g. sources[0].name = "series1/IM0001.dcm"; sources[0].buffer = bytes; sources[0].bytes = nBytes;
+	if ((sources == NULL) || (nSources < 1)) {
+		printMessage("No input\n");
+		return EXIT_FAILURE;
+	}
+	if (strlen(opts->outdir) < 1) {
+		if (getcwd(opts->outdir, sizeof(opts->outdir)) == NULL)
+			return kEXIT_OUTPUT_FOLDER_INVALID;
+	} else
+		dropTrailingFileSep(opts->outdir);
+	if (!is_dir(opts->outdir, true)) {
+		printError("Output folder invalid: %s\n", opts->outdir);
+		return kEXIT_OUTPUT_FOLDER_INVALID;
+	}
+	if (strlen(opts->indir) < 1) { // "%f" folder name is derived from the virtual name of the first object
+		snprintf(opts->indir, sizeof(opts->indir), "%s", sources[0].name);
+		dropFilenameFromPath(opts->indir);
+	}
+	getFileNameX(opts->indirParent, opts->indir, 512);
+	if (nii_setByteSources(sources, nSources) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	opts->byteSources = sources;
+	opts->numByteSources = nSources;
+	int ret = nii_loadDirCore(opts->indir, opts);
+	opts->byteSources = NULL;
+	opts->numByteSources = 0;
+	nii_clearByteSources();
+	return ret;
+} // nii_loadByteSources()
+#endif
+
 int nii_loadDirOneDirAtATime(char *path, struct TDCMopts *opts, int maxDepth, int depth) {
 	// return kEXIT_NO_VALID_FILES_FOUND if no files in ANY sub folders
 	// return EXIT_FAILURE if ANY failure
@@ -10171,6 +11517,319 @@ int nii_loadDirOneDirAtATime(char *path, struct TDCMopts *opts, int maxDepth, in
 	return ret;
 }
 
+#ifdef myEnableWatchDir
+// "--watch" daemon mode: inotify reports files as they arrive (e.g. from a C-STORE SCP)
+// headers are parsed as each file is closed, and each series is converted once it is complete
+struct TWatchSeries {
+	uint32_t crc;
+	int nFiles, nExpected; // nExpected = 0 if the number of files in the series is unknown
+	double lastUpdate;	   // monotonic time (seconds) a file was last added
+};
+
+struct TWatchDir {
+	int wd, depth;
+	char path[PATH_MAX];
+};
+
+struct TWatchNames { // open addressing hash set of file names
+	size_t n, nSlots; // nSlots is zero or a power of two
+	char **slots;
+};
+
+struct TWatchState {
+	int fd, nDirs, maxDirs, nSeries, maxSeries, nConvertTotal;
+	size_t nDcm;
+	bool convertError;
+	struct TWatchNames ingested; // every file ingested, kept after compaction so a file closed again is not converted twice
+	struct TWatchDir *dirs;
+	struct TWatchSeries *series;
+	struct TDICOMdata *dcmList;
+	struct TSearchList nameList;
+	struct TDTI4D *dti4D;
+	struct TDCMprefs prefs;
+	struct TWarnings warnings;
+};
+
+volatile sig_atomic_t isWatchStop = 0;
+
+void watchSignal(int sig) {
+	isWatchStop = 1;
+}
+
+double watchNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int watchExpectedFiles(struct TDICOMdata *d) {
+	// files in a complete series, 0 if unknown: the series is converted once idle for opts->watchSec
+	//  fMRI and DWI do not report the number of volumes, and MR echoes and magnitude/phase images
+	//  can share one SeriesInstanceUID without any header reporting how many will arrive
+	if ((d->locationsInAcquisition < 1) || (d->isEPI) || (d->isDiffusion) || (d->CSA.mosaicSlices > 1) || (d->xyzDim[3] > 1))
+		return 0;
+	if ((d->modality == kMODALITY_MR) || (d->isMultiEcho) || (d->echoNum > 1))
+		return 0;
+	return d->locationsInAcquisition * max(d->numberOfTR, 1);
+}
+
+bool watchNameFind(struct TWatchNames *set, const char *fname, bool isAdd) {
+	// true if fname is in the set, otherwise adds it if isAdd
+	size_t len = strlen(fname);
+	if ((isAdd) && (((set->n + 1) * 2) > set->nSlots)) { // grow, keeping the load at most 50%
+		size_t nSlots = max(set->nSlots * 2, (size_t)1024);
+		char **slots = (char **)calloc(nSlots, sizeof(char *));
+		for (size_t i = 0; i < set->nSlots; i++) {
+			if (set->slots[i] == NULL)
+				continue;
+			size_t j = mz_crc32X((unsigned char *)set->slots[i], strlen(set->slots[i])) & (nSlots - 1);
+			while (slots[j] != NULL)
+				j = (j + 1) & (nSlots - 1);
+			slots[j] = set->slots[i];
+		}
+		free(set->slots);
+		set->slots = slots;
+		set->nSlots = nSlots;
+	}
+	if (set->nSlots == 0)
+		return false;
+	size_t j = mz_crc32X((unsigned char *)fname, len) & (set->nSlots - 1);
+	while (set->slots[j] != NULL) {
+		if (strcmp(set->slots[j], fname) == 0)
+			return true;
+		j = (j + 1) & (set->nSlots - 1);
+	}
+	if (isAdd) {
+		set->slots[j] = (char *)malloc(len + 1);
+		strcpy(set->slots[j], fname);
+		set->n++;
+	}
+	return false;
+}
+
+void watchIngest(struct TWatchState *st, struct TDCMopts *opts, const char *fname) {
+	const char *base = strrchr(fname, kPathSeparator);
+	base = (base) ? base + 1 : fname;
+	if ((strlen(base) < 1) || (base[0] == '.'))
+		return; // hidden file, e.g. partial upload
+	if ((strlen(base) == 8) && (strcicmp(base, "DICOMDIR") == 0))
+		return;
+	if (watchNameFind(&st->ingested, fname, false))
+		return; // already ingested, e.g. found by the initial scan and then reported closed by inotify
+	if (isDICOMfile(fname) < 1)
+		return;
+	if (isSeriesNotSelected(fname, opts))
+		return;
+	watchNameFind(&st->ingested, fname, true);
+	if (st->nDcm >= st->nameList.maxItems) {
+		unsigned long maxItems = max(st->nameList.maxItems * 2, 1024UL);
+		st->nameList.str = (char **)realloc(st->nameList.str, (maxItems + 1) * sizeof(char *));
+		st->dcmList = (struct TDICOMdata *)realloc(st->dcmList, maxItems * sizeof(struct TDICOMdata));
+		st->nameList.maxItems = maxItems;
+	}
+	size_t i = st->nDcm;
+	st->nameList.str[i] = (char *)malloc(strlen(fname) + 1);
+	strcpy(st->nameList.str[i], fname);
+	st->nDcm++;
+	st->nameList.numItems = st->nDcm;
+	st->dcmList[i] = readDICOMx(st->nameList.str[i], &st->prefs, st->dti4D);
+	statsParsed(st->nameList.str[i]);
+	if (opts->isIgnoreSeriesInstanceUID)
+		st->dcmList[i].seriesUidCrc = st->dcmList[i].seriesNum;
+	if (!st->dcmList[i].isValid) {
+		st->dcmList[i].converted2NII = 1; // discard at next compaction
+		return;
+	}
+	if ((st->dti4D->sliceOrder[0] >= 0) || (st->dcmList[i].CSA.numDti > 1)) { // 4D dataset: complete in a single file
+		struct TDCMsort dcmSort[1];
+		fillTDCMsort(dcmSort[0], i, st->dcmList[i]);
+		st->dcmList[i].converted2NII = 1;
+		int ret = saveDcm2Nii(1, dcmSort, st->dcmList, &st->nameList, *opts, st->dti4D);
+		if (ret == EXIT_SUCCESS)
+			st->nConvertTotal++;
+		else
+			st->convertError = true;
+		return;
+	}
+	uint32_t crc = st->dcmList[i].seriesUidCrc;
+	int s = 0;
+	while ((s < st->nSeries) && (st->series[s].crc != crc))
+		s++;
+	if (s == st->nSeries) {
+		if (st->nSeries >= st->maxSeries) {
+			st->maxSeries = max(st->maxSeries * 2, 64);
+			st->series = (struct TWatchSeries *)realloc(st->series, st->maxSeries * sizeof(struct TWatchSeries));
+		}
+		st->series[s].crc = crc;
+		st->series[s].nFiles = 0;
+		st->series[s].nExpected = watchExpectedFiles(&st->dcmList[i]);
+		st->nSeries++;
+	}
+	st->series[s].nFiles++;
+	st->series[s].lastUpdate = watchNow();
+}
+
+void watchAddDir(struct TWatchState *st, struct TDCMopts *opts, const char *path, int depth) {
+	// watch folder, ingest any files it already holds and recurse into sub-folders
+	int wd = inotify_add_watch(st->fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+	if (wd < 0) {
+		printWarning("Unable to watch folder %s\n", path);
+		return;
+	}
+	if (st->nDirs >= st->maxDirs) {
+		st->maxDirs = max(st->maxDirs * 2, 16);
+		st->dirs = (struct TWatchDir *)realloc(st->dirs, st->maxDirs * sizeof(struct TWatchDir));
+	}
+	st->dirs[st->nDirs].wd = wd;
+	st->dirs[st->nDirs].depth = depth;
+	snprintf(st->dirs[st->nDirs].path, PATH_MAX, "%s", path);
+	st->nDirs++;
+	tinydir_dir dir;
+	tinydir_open(&dir, path);
+	while (dir.has_next) {
+		tinydir_file file;
+		file.is_dir = 0; // avoids compiler warning: this is set by tinydir_readfile
+		tinydir_readfile(&dir, &file);
+		char filename[PATH_MAX] = "";
+		if (snprintf(filename, sizeof(filename), "%s%s%s", path, kFileSep, file.name) >= (int)sizeof(filename)) {
+			printWarning("Path too long, skipping %s\n", file.name);
+			tinydir_next(&dir);
+			continue;
+		}
+		if ((file.is_dir) && (depth < opts->dirSearchDepth) && (file.name[0] != '.'))
+			watchAddDir(st, opts, filename, depth + 1);
+		else if (file.is_reg)
+			watchIngest(st, opts, filename);
+		tinydir_next(&dir);
+	}
+	tinydir_close(&dir);
+}
+
+void watchConvert(struct TWatchState *st, struct TDCMopts *opts, bool isFlush) {
+	// convert series that are complete, or have been idle for opts->watchSec
+	double now = watchNow();
+	bool isConverted = false;
+	for (int s = 0; s < st->nSeries;) {
+		struct TWatchSeries *ws = &st->series[s];
+		bool isComplete = (ws->nExpected > 0) && (ws->nFiles >= ws->nExpected);
+		if ((!isFlush) && (!isComplete) && ((now - ws->lastUpdate) < opts->watchSec)) {
+			s++;
+			continue;
+		}
+		TCRCsort *crcSort = (TCRCsort *)malloc(st->nDcm * sizeof(TCRCsort));
+		int nGroup = 0;
+		for (size_t i = 0; i < st->nDcm; i++)
+			if ((st->dcmList[i].seriesUidCrc == ws->crc) && (!st->dcmList[i].converted2NII))
+				fillTCRCsort(crcSort[nGroup++], i, ws->crc);
+		if (opts->isVerbose)
+			printMessage("Series %u %s (%d files)\n", ws->crc, isComplete ? "complete" : "idle", nGroup);
+		if (nGroup > 0)
+			st->nConvertTotal += saveSeriesUidGroup(nGroup, crcSort, st->dcmList, &st->nameList, opts, st->dti4D, &st->warnings, &st->convertError);
+		free(crcSort);
+		isConverted = true;
+		st->series[s] = st->series[st->nSeries - 1];
+		st->nSeries--;
+	}
+	if (!isConverted)
+		return;
+	// compact: discard converted files so a long running daemon does not accumulate headers
+	size_t n = 0;
+	for (size_t i = 0; i < st->nDcm; i++) {
+		if (st->dcmList[i].converted2NII) {
+			free(st->nameList.str[i]);
+			continue;
+		}
+		if (n != i) {
+			st->dcmList[n] = st->dcmList[i];
+			st->nameList.str[n] = st->nameList.str[i];
+		}
+		n++;
+	}
+	st->nDcm = n;
+	st->nameList.numItems = n;
+#ifndef USING_R
+	fflush(stdout);
+#endif
+}
+
+int nii_watchDir(struct TDCMopts *opts) {
+	struct TWatchState st;
+	memset(&st, 0, sizeof(st));
+	st.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (st.fd < 0) {
+		printError("Unable to watch folder (inotify): %s\n", opts->indir);
+		return kEXIT_INPUT_FOLDER_INVALID;
+	}
+	st.dti4D = (struct TDTI4D *)malloc(sizeof(struct TDTI4D));
+	st.nameList.str = (char **)malloc(sizeof(char *));
+	opts2Prefs(opts, &st.prefs);
+	st.warnings = setWarnings();
+	statsInit(opts);
+	if (isExt(opts->filename, ".dcm")) // see nii_loadDirCore()
+		opts->filename[strlen(opts->filename) - 4] = 0;
+	signal(SIGINT, watchSignal);
+	signal(SIGTERM, watchSignal);
+	printMessage("Watching %s (subfolders %d deep): series converted when complete or after %d seconds without new files\n", opts->indir, opts->dirSearchDepth, opts->watchSec);
+	watchAddDir(&st, opts, opts->indir, 0);
+	char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (!isWatchStop) {
+		struct pollfd pfd;
+		pfd.fd = st.fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1000) > 0) {
+			ssize_t len;
+			while ((len = read(st.fd, buf, sizeof(buf))) > 0) {
+				const struct inotify_event *event;
+				for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+					event = (const struct inotify_event *)ptr;
+					if (event->mask & IN_Q_OVERFLOW)
+						printWarning("Watch event queue overflow: some files may not be converted\n");
+					if (event->len < 1)
+						continue;
+					int d = 0;
+					while ((d < st.nDirs) && (st.dirs[d].wd != event->wd))
+						d++;
+					if (d == st.nDirs)
+						continue;
+					char filename[PATH_MAX] = "";
+					if (snprintf(filename, sizeof(filename), "%s%s%s", st.dirs[d].path, kFileSep, event->name) >= (int)sizeof(filename)) {
+						printWarning("Path too long, skipping %s\n", event->name);
+						continue;
+					}
+					if (event->mask & IN_ISDIR) {
+						if ((st.dirs[d].depth < opts->dirSearchDepth) && (event->name[0] != '.'))
+							watchAddDir(&st, opts, filename, st.dirs[d].depth + 1);
+					} else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+						watchIngest(&st, opts, filename);
+				}
+			}
+		}
+		watchConvert(&st, opts, false);
+	}
+	printMessage("Watch stopped: converting remaining series\n");
+	watchConvert(&st, opts, true);
+	close(st.fd);
+	for (size_t i = 0; i < st.nDcm; i++)
+		free(st.nameList.str[i]);
+	for (size_t i = 0; i < st.ingested.nSlots; i++)
+		free(st.ingested.slots[i]);
+	free(st.ingested.slots);
+	free(st.nameList.str);
+	free(st.dcmList);
+	free(st.dirs);
+	free(st.series);
+	free(st.dti4D);
+	if (st.convertError) {
+		if (st.nConvertTotal == 0)
+			return EXIT_FAILURE;
+		return kEXIT_SOME_OK_SOME_BAD;
+	}
+	if (st.nConvertTotal == 0)
+		return kEXIT_NO_VALID_FILES_FOUND;
+	return EXIT_SUCCESS;
+} // nii_watchDir()
+#endif // myEnableWatchDir
+
 int nii_loadDir(struct TDCMopts *opts) {
 	// Identifies all the DICOM files in a folder and its subfolders
 	if (strlen(opts->indir) < 1) {
@@ -10266,6 +11925,10 @@ int nii_loadDir(struct TDCMopts *opts) {
 	}
 	if ((isFile) && (opts->isOnlySingleFile))
 		return singleDICOM(opts, indir);
+#ifdef myEnableWatchDir
+	if (opts->watchSec > 0)
+		return nii_watchDir(opts);
+#endif
 	if (opts->isOneDirAtATime) {
 		int maxDepth = opts->dirSearchDepth;
 		opts->dirSearchDepth = 0;
@@ -10479,6 +12142,14 @@ void setDefaultOpts(struct TDCMopts *opts, const char *argv[]) { // either "setD
 	opts->isAddNamePostFixes = true; // e.g. "_e2" added for second echo
 	opts->isTestx0021x105E = false;	 // GE test slice times stored in 0021,105E
 	opts->diffCyclingModeGE = -1;
+	opts->watchSec = 0; // 0: convert once and exit, else seconds a series must be idle before conversion
+	opts->j2kReduce = 0; // 0: full resolution, else JPEG 2000 images are decoded at 1/2^n size (quick-look)
+	opts->threadsRead = 0; // "--threads" budgets with OpenMP: 0 = all threads
+	opts->threadsDecode = 0;
+	opts->threadsWrite = -1; // -1: gz writer thread if more than one thread, 0: compress inline, 1: writer thread
+	opts->gzBackend = kGzBackendZlib; // internal compressor, "--gz-backend"
+	opts->gzTargetMBps = 0; // 0: fixed gzLevel, else level chosen per image to compress at least this many MB/s
+	opts->gzTargetRatio = 0.0; // 0: no ratio goal for the adaptive level
 	opts->isIgnoreTriggerTimes = false;
 	opts->saveFormat = kSaveFormatNIfTI;
 	opts->isPipedGz = false; // e.g. pipe data directly to pigz instead of saving uncompressed to disk
@@ -10513,7 +12184,13 @@ void setDefaultOpts(struct TDCMopts *opts, const char *argv[]) { // either "setD
 	opts->isTiltCorrect = true;
 	opts->numSeries = 0;
 	memset(opts->seriesNumber, 0, sizeof(opts->seriesNumber));
+	opts->output = NULL;
+#ifdef myEnableByteSource
+	opts->byteSources = NULL;
+	opts->numByteSources = 0;
+#endif
 	strcpy(opts->filename, "%f_%p_%t_%s");
+	strcpy(opts->statsname, ""); // "--stats": empty for none, "json" for stderr, else filename
 	opts->isDumpNotConvert = false;
 } // setDefaultOpts()
 
@@ -10608,7 +12285,7 @@ void saveIniFile(struct TDCMopts opts) {
 void dcmListDump(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts opts) {
 	for (int i = 0; i < nConvert; i++) {
 		int indx = dcmSort[i].indx;
-		mrifsStruct.dicomlst[i] = new char[strlen(nameList->str[indx]) + 1];
+		mrifsStruct.dicomlst[i] = (char *)malloc(strlen(nameList->str[indx]) + 1);
 		memset(mrifsStruct.dicomlst[i], 0, strlen(nameList->str[indx]) + 1);
 		memcpy(mrifsStruct.dicomlst[i], nameList->str[indx], strlen(nameList->str[indx]));
 
@@ -33,6 +33,23 @@ void nii_clrMrifsStruct();
 std::vector<MRIFSSTRUCT> *nii_getMrifsStructVector();
 void nii_clrMrifsStructVector();
 
+// owns one converted series (image, DTI table, file names); move-only, so a series is never duplicated
+class MRIFSSERIES {
+  public:
+	MRIFSSTRUCT *mrifs;
+	explicit MRIFSSERIES(MRIFSSTRUCT *src); // takes ownership of src buffers, src is cleared
+	MRIFSSERIES(MRIFSSERIES &&other);
+	MRIFSSERIES &operator=(MRIFSSERIES &&other);
+	MRIFSSERIES(const MRIFSSERIES &) = delete;
+	MRIFSSERIES &operator=(const MRIFSSERIES &) = delete;
+	~MRIFSSERIES();
+};
+
+// receives each series as soon as it is converted, series is released when callback returns unless moved elsewhere
+typedef void (*MRIFSSERIES_CALLBACK)(MRIFSSERIES series, void *user);
+// NULL callback restores default: series collected in nii_getMrifsStructVector()
+void nii_setMrifsSeriesCallback(MRIFSSERIES_CALLBACK callback, void *user);
+
 void dcmListDump(int nConvert, struct TDCMsort dcmSort[], struct TDICOMdata dcmList[], struct TSearchList *nameList, struct TDCMopts opts);
 #endif
 
@@ -69,16 +86,38 @@ struct TDicomSeries {
 #define kSaveFormatJNII 3
 #define kSaveFormatBNII 4
 
+#define kGzBackendZlib 0	   // zlib or miniz, streaming (default)
+#define kGzBackendLibdeflate 1 // libdeflate, whole buffer (myEnableLibdeflate)
+#define kGzBackendISAL 2	   // ISA-L igzip, streaming (myEnableISAL)
+#define kGzBackendCount 3
+#define kGzTargetMBpsDefault 50 // "-z a" throughput target when "--gz-target-mbps" is not set
+
+#if defined(__linux__) && !defined(USING_R) && !defined(USING_DCM2NIIXFSWRAPPER)
+#define myEnableWatchDir // "--watch" daemon mode requires inotify
+#endif
+
 #define MAX_NUM_SERIES 16
 #define kOptsStr 512
 
+struct TNiiOutput { // optional hooks: hand images and BIDS sidecars to the caller instead of writing .nii/.json files
+	void (*image)(void *user, const char *niiFilename, const struct nifti_1_header *hdr, const unsigned char *img, size_t imgBytes); // image is native endian, uncompressed
+	void (*json)(void *user, const char *niiFilename, const char *json, size_t jsonBytes);
+	void *user;
+};
+
 struct TDCMopts {
 	bool isDumpNotConvert;
 	bool isIgnoreTriggerTimes, isTestx0021x105E, isAddNamePostFixes, isSaveNativeEndian, isOneDirAtATime, isRenameNotConvert, isSave3D, isGz, isPipedGz, isFlipY, isCreateBIDS, isSortDTIbyBVal, isAnonymizeBIDS, isOnlyBIDS, isCreateText, isForceOnsetTimes, isIgnoreDerivedAnd2D, isPhilipsFloatNotDisplayScaling, isTiltCorrect, isRGBplanar, isOnlySingleFile, isForceStackDCE, isIgnoreSeriesInstanceUID, isRotate3DAcq, isCrop, isGuessBidsFilename;
-	int saveFormat, isMaximize16BitRange, isForceStackSameSeries, nameConflictBehavior, isVerbose, isProgress, compressFlag, dirSearchDepth, onlySearchDirForDICOM, gzLevel, diffCyclingModeGE; // support for compressed data 0=none,
-	char filename[kOptsStr], outdir[kOptsStr], indir[kOptsStr], pigzname[kOptsStr], optsname[kOptsStr], indirParent[kOptsStr], imageComments[24], bidsSubject[kOptsStr], bidsSession[kOptsStr];
+	int saveFormat, isMaximize16BitRange, isForceStackSameSeries, nameConflictBehavior, isVerbose, isProgress, compressFlag, dirSearchDepth, onlySearchDirForDICOM, gzLevel, gzBackend, gzTargetMBps, diffCyclingModeGE, watchSec, j2kReduce, threadsRead, threadsDecode, threadsWrite; // support for compressed data 0=none,
+	char filename[kOptsStr], outdir[kOptsStr], indir[kOptsStr], pigzname[kOptsStr], optsname[kOptsStr], indirParent[kOptsStr], imageComments[24], bidsSubject[kOptsStr], bidsSession[kOptsStr], statsname[kOptsStr];
+	double gzTargetRatio; // "--gz-target-ratio": 0 = off, else weakest sampled gz level reaching this compression ratio
 	double seriesNumber[MAX_NUM_SERIES]; // requires double must store -1 (report but do not convert) as well as seriesUidCrc (uint32)
 	long numSeries;
+	struct TNiiOutput *output; // NULL: write files to outdir
+#ifdef myEnableByteSource
+	struct TByteSource *byteSources; // non-NULL: convert these objects rather than searching indir
+	int numByteSources;
+#endif
 #ifdef USING_R
 	bool isScanOnly, isImageInMemory;
 	void *imageList;
@@ -96,7 +135,16 @@ void readIniFile(struct TDCMopts *opts, const char *argv[]);
 int nii_saveNIIx(char *niiFilename, struct nifti_1_header hdr, unsigned char *im, struct TDCMopts opts);
 int nii_loadDir(struct TDCMopts *opts);
 int nii_loadDirCore(char *indir, struct TDCMopts *opts);
+#ifdef myEnableWatchDir
+int nii_watchDir(struct TDCMopts *opts);
+#endif
+#ifdef myEnableByteSource
+int nii_loadByteSources(struct TByteSource *sources, int nSources, struct TDCMopts *opts);
+#endif
 int singleDICOM(struct TDCMopts *opts, char *fname);
+int nii_saveStats(struct TDCMopts *opts); // report "--stats" telemetry gathered since the first conversion
+int nii_gzBackend(const char *name); // kGzBackend* for "--gz-backend", zlib if not compiled in
+const char *nii_gzBackendName(int gzBackend);
 void nii_SaveBIDS(char pathoutname[], struct TDICOMdata d, struct TDCMopts opts, struct nifti_1_header *h, const char *filename);
 int nii_createFilename(struct TDICOMdata dcm, char *niiFilename, struct TDCMopts opts);
 void nii_createDummyFilename(char *niiFilename, struct TDCMopts opts);
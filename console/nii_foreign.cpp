@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #ifdef _MSC_VER
 #include <direct.h>
@@ -59,8 +60,7 @@ void strClean(char *cString) {
 	}
 }
 
-unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti_1_header *hdr, struct TDCMopts opts, bool isWarnIfNotEcat) {
-// data type
+// ECAT7 data type
 #define ECAT7_BYTE 1
 #define ECAT7_VAXI2 2
 #define ECAT7_VAXI4 3
@@ -68,6 +68,129 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 #define ECAT7_IEEER4 5
 #define ECAT7_SUNI2 6
 #define ECAT7_SUNI4 7
+
+struct TEcat7Frames {
+	const char *fname;
+	size_t *imgOffsets; // first 512-byte block of each frame's voxels
+	float *imgScales; // per-frame scaling applied while loading (isToFloat only)
+	int numVol, numVox, dataType, bytesPerVoxelIn, bytesPerVoxel;
+	bool swapEndian, isToFloat;
+};
+
+// byte swap and VAX conversion kernels: plain loops over whole frames so the compiler can vectorize them
+static void ecat7Swap2(size_t n, unsigned char *buf) {
+	uint16_t *v = (uint16_t *)buf;
+	for (size_t i = 0; i < n; i++)
+		v[i] = (uint16_t)((v[i] << 8) | (v[i] >> 8));
+}
+
+static void ecat7Swap4(size_t n, unsigned char *buf) {
+	uint32_t *v = (uint32_t *)buf;
+	for (size_t i = 0; i < n; i++) {
+		uint32_t u = v[i];
+		v[i] = (u >> 24) | ((u >> 8) & 0x0000FF00u) | ((u << 8) & 0x00FF0000u) | (u << 24);
+	}
+}
+
+static void ecat7VaxR4(size_t n, unsigned char *buf) {
+	// VAX F-floating: 16-bit little-endian words stored low word last, exponent bias 129 (IEEE 127)
+	float *v = (float *)buf;
+	for (size_t i = 0; i < n; i++) {
+		const unsigned char *b = &buf[i * 4];
+		uint32_t u = ((uint32_t)b[1] << 24) | ((uint32_t)b[0] << 16) | ((uint32_t)b[3] << 8) | (uint32_t)b[2];
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		v[i] = (((u >> 23) & 0xFF) == 0) ? 0.0f : f * 0.25f; // zero exponent is VAX zero (or reserved operand)
+	}
+}
+
+static bool ecat7LoadFrame(FILE *f, struct TEcat7Frames *ef, int v, unsigned char *out) {
+	// read frame v into its slot 'out'; input narrower than output is read into the top of the slot and widened in place
+	size_t bytesIn = (size_t)ef->numVox * ef->bytesPerVoxelIn;
+	size_t bytesOut = (size_t)ef->numVox * ef->bytesPerVoxel;
+	unsigned char *in = out + (bytesOut - bytesIn);
+	fseek(f, ef->imgOffsets[v] * 512, SEEK_SET);
+	size_t nRead = fread(in, 1, bytesIn, f);
+	if (nRead != bytesIn) {
+		printMessage("%zu Error reading ECAT file (offset %zu bytes %zu)\n", nRead, ef->imgOffsets[v] * 512, bytesIn);
+		return false;
+	}
+	if (ef->dataType == ECAT7_VAXR4)
+		ecat7VaxR4(ef->numVox, in);
+	else if ((ef->swapEndian) && (ef->bytesPerVoxelIn == 2))
+		ecat7Swap2(ef->numVox, in);
+	else if ((ef->swapEndian) && (ef->bytesPerVoxelIn == 4))
+		ecat7Swap4(ef->numVox, in);
+	if (!ef->isToFloat)
+		return true;
+	float scale = ef->imgScales[v];
+	float *img32 = (float *)out;
+	if (ef->bytesPerVoxelIn == 4) {
+		for (int i = 0; i < ef->numVox; i++)
+			img32[i] *= scale;
+		return true;
+	}
+	// widen through a small bounce buffer: a chunk is copied out before any write can reach it
+	const int kChunk = 4096;
+	int16_t chunk16[kChunk];
+	uint8_t *chunk8 = (uint8_t *)chunk16;
+	for (int i = 0; i < ef->numVox; i += kChunk) {
+		int n = ef->numVox - i;
+		if (n > kChunk)
+			n = kChunk;
+		memcpy(chunk16, &in[(size_t)i * ef->bytesPerVoxelIn], (size_t)n * ef->bytesPerVoxelIn);
+		if (ef->bytesPerVoxelIn == 2)
+			for (int j = 0; j < n; j++)
+				img32[i + j] = chunk16[j] * scale;
+		else
+			for (int j = 0; j < n; j++)
+				img32[i + j] = chunk8[j] * scale;
+	}
+	return true;
+} // ecat7LoadFrame()
+
+static unsigned char *ecat7LoadFrames(struct TEcat7Frames *ef, int first, int count) {
+	// frames are independent: each thread reads and converts whole frames directly into the output volume
+	size_t bytesPerVolume = (size_t)ef->numVox * ef->bytesPerVoxel;
+	unsigned char *img = (unsigned char *)malloc(bytesPerVolume * count);
+	if (!img)
+		return NULL;
+	int nErr = 0;
+#ifdef _OPENMP
+#pragma omp parallel if (count > 1)
+#endif
+	{
+		FILE *f = fopen(ef->fname, "rb");
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for (int v = 0; v < count; v++) {
+			if ((f) && (ecat7LoadFrame(f, ef, first + v, &img[v * bytesPerVolume])))
+				continue;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+			nErr++;
+		}
+		if (f)
+			fclose(f);
+	}
+	if (nErr > 0) {
+		free(img);
+		return NULL;
+	}
+	return img;
+} // ecat7LoadFrames()
+
+static void ecat7FreeFrames(struct TEcat7Frames *ef) {
+	free(ef->imgOffsets);
+	free(ef->imgScales);
+	ef->imgOffsets = NULL;
+	ef->imgScales = NULL;
+}
+
+int readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti_1_header *hdr, struct TDCMopts opts, bool isWarnIfNotEcat, struct TEcat7Frames *ef) {
+// reads headers and frame offsets, voxels are loaded later with ecat7LoadFrames()
 // file types
 // #define ECAT7_UNKNOWN 0
 #define ECAT7_2DSCAN 1
@@ -154,13 +277,13 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 	if (!f || n != 1) {
 		printMessage("Problem reading ECAT7 file!\n");
 		fclose(f);
-		return NULL;
+		return EXIT_FAILURE;
 	}
 	if ((mhdr.magic[0] != 'M') || (mhdr.magic[1] != 'A') || (mhdr.magic[2] != 'T') || (mhdr.magic[3] != 'R') || (mhdr.magic[4] != 'I') || (mhdr.magic[5] != 'X')) {
 		if (isWarnIfNotEcat)
 			printMessage("Signature not 'MATRIX' (ECAT7): '%s'\n", fname);
 		fclose(f);
-		return NULL;
+		return EXIT_FAILURE;
 	}
 	swapEndian = mhdr.file_type > 255;
 	if (swapEndian) {
@@ -174,7 +297,7 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 	if ((mhdr.file_type < ECAT7_2DSCAN) || (mhdr.file_type > ECAT7_3DSCANFIT)) {
 		printMessage("Unknown ECAT file type %d\n", mhdr.file_type);
 		fclose(f);
-		return NULL;
+		return EXIT_FAILURE;
 	}
 	// read list matrix
 	ecat_list_hdr lhdr;
@@ -183,7 +306,7 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 	if (nRead != 1) {
 		printMessage("Error reading ECAT file (list header)\n");
 		fclose(f);
-		return NULL;
+		return EXIT_FAILURE;
 	}
 	if (swapEndian)
 		nifti_swap_4bytes(128, &lhdr.hdr[0]);
@@ -196,7 +319,7 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 	if (nRead != 1) {
 		printMessage("Error reading ECAT file (image header)\n");
 		fclose(f);
-		return NULL;
+		return EXIT_FAILURE;
 	}
 	if (swapEndian) {
 		nifti_swap_2bytes(5, &ihdr.data_type);
@@ -214,16 +337,17 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 		nifti_swap_4bytes(3, &ihdr.mtx_1_4);
 		nifti_swap_2bytes(3, &ihdr.scatter_type);
 	}
-	if ((ihdr.data_type != ECAT7_BYTE) && (ihdr.data_type != ECAT7_SUNI2) && (ihdr.data_type != ECAT7_SUNI4)) {
+	if ((ihdr.data_type < ECAT7_BYTE) || (ihdr.data_type > ECAT7_SUNI4)) {
 		printMessage("Unknown or unsupported ECAT data type %d\n", ihdr.data_type);
 		fclose(f);
-		return NULL;
+		return EXIT_FAILURE;
 	}
 	int bytesPerVoxel = 2;
 	if (ihdr.data_type == ECAT7_BYTE)
 		bytesPerVoxel = 1;
-	if (ihdr.data_type == ECAT7_SUNI4)
+	if ((ihdr.data_type == ECAT7_VAXI4) || (ihdr.data_type == ECAT7_VAXR4) || (ihdr.data_type == ECAT7_IEEER4) || (ihdr.data_type == ECAT7_SUNI4))
 		bytesPerVoxel = 4;
+	bool isFloat = (ihdr.data_type == ECAT7_VAXR4) || (ihdr.data_type == ECAT7_IEEER4);
 	// next: read offsets for each volume: data not saved sequentially (each volume preceded by its own ecat_img_hdr)
 	int num_vol = 0;
 	bool isAbort = false;
@@ -239,7 +363,9 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 			if (nRead != 1) {
 				printMessage("Error reading ECAT file (yet another list header)\n");
 				fclose(f);
-				return NULL;
+				free(imgOffsets);
+				free(imgSlopes);
+				return EXIT_FAILURE;
 			}
 			if (swapEndian)
 				nifti_swap_4bytes(128, &lhdr.hdr[0]);
@@ -255,7 +381,9 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 			if (nRead != 1) {
 				printMessage("Error reading ECAT file (yet another image header)\n");
 				fclose(f);
-				return NULL;
+				free(imgOffsets);
+				free(imgSlopes);
+				return EXIT_FAILURE;
 			}
 			if (swapEndian) {
 				nifti_swap_2bytes(5, &ihdrN.data_type);
@@ -296,65 +424,41 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 		fclose(f);
 		free(imgOffsets);
 		free(imgSlopes);
-		return NULL;
+		return EXIT_FAILURE;
 	}
-	if ((isScaleFactorVaries) && (bytesPerVoxel != 2)) {
+	if ((isScaleFactorVaries) && (bytesPerVoxel == 4) && (!isFloat)) {
 		printError("ECAT scale factor varies between volumes (check for updates) '%s'\n", fname);
 		fclose(f);
 		free(imgOffsets);
 		free(imgSlopes);
-		return NULL;
+		return EXIT_FAILURE;
 	}
-	// load image data
-	unsigned char *img = NULL;
-	if ((isScaleFactorVaries) && (bytesPerVoxel == 2)) { // we need to convert volumes from 16-bit to 32-bit to preserve scaling factors
-		int num_vox = ihdr.x_dimension * ihdr.y_dimension * ihdr.z_dimension;
-		size_t bytesPerVolumeIn = (size_t)(num_vox * bytesPerVoxel); // bytesPerVoxel == 2
-		unsigned char *imgIn = (unsigned char *)malloc(bytesPerVolumeIn);
-		int16_t *img16i = (int16_t *)imgIn;
+	fclose(f);
+	// describe frames: voxels are read by ecat7LoadFrames()
+	ef->fname = fname;
+	ef->imgOffsets = imgOffsets;
+	ef->imgScales = imgSlopes;
+	ef->numVol = num_vol;
+	ef->numVox = ihdr.x_dimension * ihdr.y_dimension * ihdr.z_dimension;
+	ef->dataType = ihdr.data_type;
+	ef->bytesPerVoxelIn = bytesPerVoxel;
+	// voxel byte order is fixed by data type, not by the header: SUN/IEEE types are big-endian, VAX integers little-endian
+	if ((ihdr.data_type == ECAT7_VAXI2) || (ihdr.data_type == ECAT7_VAXI4))
+		ef->swapEndian = !littleEndianPlatform();
+	else
+		ef->swapEndian = littleEndianPlatform();
+	ef->isToFloat = isScaleFactorVaries;
+	if (isScaleFactorVaries) { // convert volumes to 32-bit float to preserve scaling factors
 		bytesPerVoxel = 4;
-		size_t bytesPerVolume = (size_t)(num_vox * bytesPerVoxel);
-		img = (unsigned char *)malloc((size_t)(bytesPerVolume * num_vol));
-		float *img32 = (float *)img;
-		for (int v = 0; v < num_vol; v++) {
-			fseek(f, imgOffsets[v] * 512, SEEK_SET);
-			nRead = fread(&imgIn[0], 1, bytesPerVolumeIn, f);
-			if (nRead != bytesPerVolumeIn) {
-				printMessage("%zu Error reading ECAT file (offset %zu bytes %zu)\n", nRead, imgOffsets[v] * 512, bytesPerVolumeIn);
-				fclose(f);
-				return NULL;
-			}
-			if (swapEndian)
-				nifti_swap_2bytes(num_vox, imgIn);
-			int volOffset = v * num_vox;
-			float scale = imgSlopes[v] * mhdr.ecat_calibration_factor;
-			for (int i = 0; i < num_vox; i++)
-				img32[i + volOffset] = (img16i[i] * scale);
-		}
-		// we have applied the scale factors to the data, so eliminate them
+		isFloat = true;
+		for (int v = 0; v < num_vol; v++)
+			imgSlopes[v] = imgSlopes[v] * mhdr.ecat_calibration_factor;
+		// we apply the scale factors to the data, so eliminate them
 		ihdr.scale_factor = 1.0;
 		mhdr.ecat_calibration_factor = 1.0;
-
-	} else { // if isScaleFactorVaries else simple conversion
-		size_t bytesPerVolume = ihdr.x_dimension * ihdr.y_dimension * ihdr.z_dimension * bytesPerVoxel;
-		img = (unsigned char *)malloc(bytesPerVolume * num_vol);
-		for (int v = 0; v < num_vol; v++) {
-			fseek(f, imgOffsets[v] * 512, SEEK_SET);
-			size_t sz = fread(&img[v * bytesPerVolume], 1, bytesPerVolume, f);
-			if (sz != bytesPerVolume) {
-				free(img);
-				return NULL;
-			}
-		}
-		if ((swapEndian) && (bytesPerVoxel == 2))
-			nifti_swap_2bytes(ihdr.x_dimension * ihdr.y_dimension * ihdr.z_dimension * num_vol, img);
-		if ((swapEndian) && (bytesPerVoxel == 4))
-			nifti_swap_4bytes(ihdr.x_dimension * ihdr.y_dimension * ihdr.z_dimension * num_vol, img);
 	}
+	ef->bytesPerVoxel = bytesPerVoxel;
 	printWarning("ECAT support VERY experimental (Spatial transforms unknown)\n");
-	free(imgOffsets);
-	free(imgSlopes);
-	fclose(f);
 	// fill DICOM header
 	float timeBetweenVolumes = ihdr.frame_duration;
 	if (num_vol > 1)
@@ -401,8 +505,7 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 	// dcm->manufacturersModelName = itoa(mhdr.system_type);
 	snprintf(dcm->manufacturersModelName, kDICOMStr, "%d", mhdr.system_type);
 	dcm->bitsAllocated = bytesPerVoxel * 8;
-	if (isScaleFactorVaries)
-		dcm->isFloat = true;
+	dcm->isFloat = isFloat;
 	dcm->bitsStored = 15; // ensures 16-bit images saved as INT16 not UINT16
 	dcm->samplesPerPixel = 1;
 	dcm->xyzMM[1] = ihdr.x_pixel_size * 10.0; // cm -> mm
@@ -431,26 +534,55 @@ unsigned char *readEcat7(const char *fname, struct TDICOMdata *dcm, struct nifti
 	hdr->scl_slope = ihdr.scale_factor * mhdr.ecat_calibration_factor;
 	if (mhdr.gantry_tilt != 0.0)
 		printMessage("Warning: ECAT gantry tilt not supported %g\n", mhdr.gantry_tilt);
-	return img;
-}
+	return EXIT_SUCCESS;
+} // readEcat7()
 
 int convert_foreign(const char *fn, struct TDCMopts opts) {
 	struct nifti_1_header hdr;
 	struct TDICOMdata dcm = clear_dicom_data();
-	unsigned char *img = NULL;
-	img = readEcat7(fn, &dcm, &hdr, opts, false); // false: silent, do not report if file is not ECAT format
-	if (!img)
+	struct TEcat7Frames ef;
+	if (readEcat7(fn, &dcm, &hdr, opts, false, &ef) != EXIT_SUCCESS) // false: silent, do not report if file is not ECAT format
 		return EXIT_FAILURE;
 	char niiFilename[1024];
 	int ret = nii_createFilename(dcm, niiFilename, opts);
 	if (ret != EXIT_SUCCESS) {
 		printError("Failed to save ECAT as '%s'\n", niiFilename);
+		ecat7FreeFrames(&ef);
 		return ret;
 	}
 	printMessage("Saving ECAT as '%s'\n", niiFilename);
 	// struct TDTI4D dti4D;
 	// nii_SaveBIDS(niiFilename, dcm, opts, &dti4D, &hdr, fn);
 	nii_SaveBIDS(niiFilename, dcm, opts, &hdr, fn);
+	if ((opts.isSave3D) && (ef.numVol > 1)) {
+		// save each frame as its own 3D volume, only one frame is ever in memory
+		struct nifti_1_header hdr1 = hdr;
+		for (int i = 4; i < 8; i++)
+			hdr1.dim[i] = 0;
+		hdr1.dim[0] = 3;
+		char fname[2048] = {""};
+		char zeroPad[64] = {""};
+		int zeroPadLen = (1 + log10((double)ef.numVol));
+		snprintf(zeroPad, 64, "%%s_%%0%dd", zeroPadLen);
+		for (int v = 0; v < ef.numVol; v++) {
+			unsigned char *img = ecat7LoadFrames(&ef, v, 1);
+			if (!img) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+			snprintf(fname, 2048, zeroPad, niiFilename, v + 1);
+			ret = nii_saveNIIx(fname, hdr1, img, opts);
+			free(img);
+			if (ret != EXIT_SUCCESS)
+				break;
+		}
+		ecat7FreeFrames(&ef);
+		return ret;
+	}
+	unsigned char *img = ecat7LoadFrames(&ef, 0, ef.numVol);
+	ecat7FreeFrames(&ef);
+	if (!img)
+		return EXIT_FAILURE;
 	ret = nii_saveNIIx(niiFilename, hdr, img, opts);
 	free(img);
 	return ret;
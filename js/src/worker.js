@@ -26,52 +26,31 @@ self.onunhandledrejection = (event) => {
   self.postMessage({ type: 'error', message: event.reason ? event.reason.message : 'Unhandled rejection', error: event.reason ? event.reason.stack : null });
 };
 
-// copy the files to the emscripten filesystem
-const copyFilesToFS = async (fileList, inDir, outDir) => {
+// mount the files in the emscripten filesystem.
+// WORKERFS reads each File lazily (FileReaderSync on slices) when dcm2niix asks for bytes,
+// so the dataset is never copied into the WASM heap. Requires emcc -lworkerfs.js.
+const mountFilesToFS = (fileList, inDir, outDir) => {
   // create a directory for dcm2niix to use as its input
   mod.FS.mkdir(inDir);
 
   // create a directory for dcm2niix to use as its output
   mod.FS.mkdir(outDir);
 
-  // an array to hold all the promises for copying files
-  const promises = [];
+  const blobs = [];
   for (let fileItem of fileList) {
     const file = fileItem.file;
     // Note: Safari strips webkitRelativePath in the worker,
     // so we use the name property of the file object instead.
     const webkitRelativePath = fileItem.webkitRelativePath || file.name;
-    const promise = new Promise((resolve, reject) => {
-      const reader = new FileReader();
-      reader.onload = (e) => {
-        try {
-          const data = new Uint8Array(e.target.result);
-          // webkitRelativePath has the file directory and filename separated by '/',
-          // such as 'some_dir/some_file.dcm'.
-          // We need to replace the '/' with '_' to create a valid name for the WASM filesystem
-          // since some_dir does not exist at out mount point. That directory stub, 
-          // doesn't provide any useful information to dcm2niix anyway. 
-          const fileName = `${webkitRelativePath.split('/').join('_')}`;
-          mod.FS.createDataFile(inDir, fileName, data, true, true);
-          resolve(); // Resolve the promise when the file is successfully written
-        } catch (error) {
-          console.error(error);
-          reject(error); // Reject the promise if there's an error
-        }
-      };
-      reader.onerror = () => {
-        console.error(reader.error);
-        reject(reader.error); // Reject the promise if there's an error reading the file
-      };
-      reader.readAsArrayBuffer(file);
-    });
-
-    promises.push(promise);
+    // webkitRelativePath has the file directory and filename separated by '/',
+    // such as 'some_dir/some_file.dcm'.
+    // We need to replace the '/' with '_' to create a valid name for the WASM filesystem
+    // since some_dir does not exist at out mount point. That directory stub, 
+    // doesn't provide any useful information to dcm2niix anyway. 
+    const fileName = `${webkitRelativePath.split('/').join('_')}`;
+    blobs.push({ name: fileName, data: file });
   }
-
-  // return a promise that resolves when all files are written
-  return Promise.all(promises);
-
+  mod.FS.mount(mod.FS.filesystems.WORKERFS, { blobs: blobs }, inDir);
 }
 
 const typeFromExtension = (fileName) => {
@@ -121,13 +100,15 @@ const handleMessage = async (e) => {
     }
 
 
-    // copy the files to the emscripten filesystem
-    await copyFilesToFS(fileList, inDir, outDir);
+    // mount the files in the emscripten filesystem (read on demand, not copied)
+    mountFilesToFS(fileList, inDir, outDir);
    
     // then add the input directory at the end of the args array
     args.push(inDir);
     // call the main function of the WASM module with the args
     const exitCode = mod.callMain(args);
+    // release the input files
+    mod.FS.unmount(inDir);
 
     // read all files from outDir and return them
     const files = mod.FS.readdir(outDir);
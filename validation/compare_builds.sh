@@ -0,0 +1,47 @@
+#!/bin/bash
+# Byte-exact comparison of a reference and a new dcm2niix build
+#  usage: ./compare_builds.sh <reference dcm2niix> <new dcm2niix> <DICOM folder> [dcm2niix options]
+#  both builds convert the folder with the same options, every output file must be identical
+#  BIDS sidecars are compared without their "ConversionSoftwareVersion" line
+ref=$1
+new=$2
+in=$3
+if [ ! -x "$ref" ] || [ ! -x "$new" ] || [ ! -d "$in" ]; then
+	echo "usage: $0 <reference dcm2niix> <new dcm2niix> <DICOM folder> [dcm2niix options]"
+	exit 2
+fi
+shift 3
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/ref" "$tmp/new"
+"$ref" "$@" -f %s_%p_%t -o "$tmp/ref" "$in" > "$tmp/ref.log" 2>&1
+"$new" "$@" -f %s_%p_%t -o "$tmp/new" "$in" > "$tmp/new.log" 2>&1
+n=0
+nbad=0
+for f in "$tmp"/ref/*; do
+	[ -e "$f" ] || continue
+	name=$(basename "$f")
+	n=$((n + 1))
+	g="$tmp/new/$name"
+	if [ ! -e "$g" ]; then
+		echo "missing: $name"
+		nbad=$((nbad + 1))
+	elif [ "${name##*.}" = "json" ]; then
+		if ! diff -q <(grep -v ConversionSoftwareVersion "$f") <(grep -v ConversionSoftwareVersion "$g") > /dev/null; then
+			echo "differs: $name"
+			nbad=$((nbad + 1))
+		fi
+	elif ! cmp -s "$f" "$g"; then
+		echo "differs: $name"
+		nbad=$((nbad + 1))
+	fi
+done
+for g in "$tmp"/new/*; do
+	[ -e "$g" ] || continue
+	if [ ! -e "$tmp/ref/$(basename "$g")" ]; then
+		echo "extra: $(basename "$g")"
+		nbad=$((nbad + 1))
+	fi
+done
+echo "$in: $((n - nbad))/$n files identical"
+[ $n -gt 0 ] && [ $nbad -eq 0 ]
@@ -0,0 +1,66 @@
+// Exercise the FreeSurfer (USING_DCM2NIIXFSWRAPPER) interface, built by fs_wrapper.sh with AddressSanitizer
+//  usage: fs_wrapper <DICOM folder> <vector|callback> [vector-first]
+//  lists the series (dump mode), then converts the first one: split series (echoes, image types)
+//  must each arrive with their own dicomfile and no DTI data unless they are diffusion images
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "nii_dicom_batch.h"
+
+static int nBad = 0;
+static std::vector<MRIFSSERIES> kept;
+
+static void checkSeries(MRIFSSTRUCT *s) {
+	printf(" %s%s %dx%dx%dx%d dti %d\n", (s->dicomfile == NULL) ? "(null)" : s->dicomfile, s->namePostFixes, s->hdr0.dim[1], s->hdr0.dim[2], s->hdr0.dim[3], s->hdr0.dim[4], s->numDti);
+	if ((s->dicomfile == NULL) || (s->imgM == NULL) || ((s->tdti == NULL) != (s->numDti == 0)))
+		nBad++;
+}
+
+static void onSeries(MRIFSSERIES series, void *user) {
+	int *n = (int *)user;
+	checkSeries(series.mrifs);
+	if ((*n)++ % 2)
+		kept.push_back(std::move(series)); // keep some series until exit, release the others now
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		printf("usage: %s <DICOM folder> <vector|callback> [vector-first]\n", argv[0]);
+		return 2;
+	}
+	bool isCallback = (strcmp(argv[2], "callback") == 0);
+	bool isVectorFirst = (argc > 3);
+	struct TDCMopts opts;
+	memset(&opts, 0, sizeof(opts));
+	setDefaultOpts(&opts, NULL);
+	opts.isGz = false;
+	snprintf(opts.indir, sizeof(opts.indir), "%s", argv[1]);
+	opts.isDumpNotConvert = true;
+	nii_loadDir(&opts);
+	std::vector<MRIFSSTRUCT> *v = nii_getMrifsStructVector();
+	if (v->size() < 1) {
+		printf("no series found\n");
+		return 1;
+	}
+	opts.seriesNumber[0] = (double)(*v)[0].tdicomData.seriesUidCrc;
+	opts.numSeries = 1;
+	nii_clrMrifsStructVector();
+	opts.isDumpNotConvert = false;
+	int n = 0;
+	if (isCallback)
+		nii_setMrifsSeriesCallback(onSeries, &n);
+	nii_loadDir(&opts);
+	for (size_t i = 0; i < v->size(); i++)
+		checkSeries(&(*v)[i]);
+	n += (int)v->size();
+	if (isVectorFirst) {
+		nii_clrMrifsStructVector();
+		nii_clrMrifsStruct();
+	} else {
+		nii_clrMrifsStruct();
+		nii_clrMrifsStructVector();
+	}
+	kept.clear();
+	printf("%s: %d series, %d bad\n", argv[2], n, nBad);
+	return ((n < 1) || (nBad > 0)) ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Build the FreeSurfer wrapper interface with AddressSanitizer and check how it hands over series
+#  usage: ./fs_wrapper.sh <DICOM folder>
+#  the first series of the folder is converted with series collected in the vector and with a callback,
+#  each followed by both orders of nii_clrMrifsStruct()/nii_clrMrifsStructVector()
+#  use a file that is split into several series, e.g. the output of make_multiecho.py
+in=$1
+if [ ! -d "$in" ]; then
+	echo "usage: $0 <DICOM folder>"
+	exit 2
+fi
+src=$(cd "$(dirname "$0")/../console" && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+flags="-DUSING_DCM2NIIXFSWRAPPER -DmyDisableOpenJPEG -DmyDisableJasper -fsanitize=address -g -std=c++14 -I$src"
+for f in nii_dicom jpg_0XC3 ujpeg nifti1_io_core nii_foreign nii_ortho nii_dicom_batch; do
+	${CXX:-c++} $flags -c "$src/$f.cpp" -o "$tmp/$f.o" 2> "$tmp/build.log" || { cat "$tmp/build.log"; exit 1; }
+done
+${CXX:-c++} $flags "$(dirname "$0")/fs_wrapper.cpp" "$tmp"/*.o -o "$tmp/fs_wrapper" -lz || exit 1
+nbad=0
+for mode in vector callback; do
+	for order in "" vector-first; do
+		if ! "$tmp/fs_wrapper" "$in" $mode $order > "$tmp/run.log" 2>&1; then
+			nbad=$((nbad + 1))
+			echo "failed: $mode $order"
+			grep -A12 "Sanitizer\|bad$" "$tmp/run.log"
+		else
+			tail -n 1 "$tmp/run.log"
+		fi
+	done
+done
+[ $nbad -eq 0 ] && echo "all runs passed"
+exit $((nbad > 0))
@@ -0,0 +1,56 @@
+#!/bin/bash
+# Round-trip check and timing of the internal gz backends ("-z i --gz-backend")
+#  usage: ./gz_backends.sh <dcm2niix> <DICOM folder> [backend ...]
+#  every .nii.gz must gunzip to the same bytes as the uncompressed ("-z n") .nii
+#  backends not compiled into <dcm2niix> are reported as skipped
+exe=$1
+in=$2
+if [ ! -x "$exe" ] || [ ! -d "$in" ]; then
+	echo "usage: $0 <dcm2niix> <DICOM folder> [backend ...]"
+	exit 2
+fi
+shift 2
+backends=${*:-zlib libdeflate isal}
+levels=${GZ_LEVELS:-1 6 9}
+TIMEFORMAT=%R
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/nii"
+"$exe" -z n -f %s_%p -o "$tmp/nii" "$in" > /dev/null || exit 1
+nref=$(ls "$tmp/nii"/*.nii 2> /dev/null | wc -l)
+if [ "$nref" -lt 1 ]; then
+	echo "no NIfTI images created from $in"
+	exit 1
+fi
+mb=$(du -cm "$tmp"/nii/*.nii | tail -1 | cut -f1)
+echo "$nref images, $mb MB uncompressed"
+status=0
+for b in $backends; do
+	for l in $levels; do
+		out="$tmp/$b$l"
+		mkdir "$out"
+		sec=$( { time "$exe" -z i --gz-backend "$b" -$l -f %s_%p -o "$out" "$in" > "$out.log" 2>&1; } 2>&1)
+		ret=$(grep -c "^Error" "$out.log")
+		if grep -q "Compiled without $b" "$out.log"; then
+			echo "$b: skipped (not compiled in)"
+			break
+		fi
+		if [ $ret -ne 0 ]; then
+			echo "$b -$l: FAIL $(grep -m1 "^Error" "$out.log")"
+			status=1
+			continue
+		fi
+		nbad=0
+		for f in "$tmp"/nii/*.nii; do
+			gz="$out/$(basename "$f").gz"
+			if ! gzip -t "$gz" 2> /dev/null || ! gzip -dc "$gz" | cmp -s - "$f"; then
+				echo "$b -$l: FAIL $(basename "$gz")"
+				nbad=$((nbad + 1))
+			fi
+		done
+		[ $nbad -gt 0 ] && status=1
+		gzmb=$(du -ck "$out"/*.nii.gz | tail -1 | cut -f1)
+		echo "$b -$l: $((nref - nbad))/$nref identical, $gzmb KB, $sec s"
+	done
+done
+exit $status
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# Check "--j2k-reduce" against a full resolution conversion of the same JPEG 2000 DICOM folder
+#  usage: ./j2k_reduce.py <dcm2niix> <JPEG 2000 DICOM folder> [reduce, default 1]
+#  requires a build with OpenJPEG. Each reduced image must have ceil(n/2^r) columns and rows, 2^r larger voxels,
+#  and intensities that follow the full resolution image averaged over the same 2^r x 2^r blocks
+import array, glob, os, shutil, struct, subprocess, sys, tempfile
+
+kMinCorrelation = 0.9  # the J2K low-pass band is close to, but not exactly, a block average
+kMaxSlices = 16  # slices compared per image, spread over the volume
+kTypes = {2: 'B', 4: 'h', 8: 'i', 16: 'f', 512: 'H'}
+
+def readNii(fn):
+    b = open(fn, 'rb').read()
+    dim = struct.unpack('<8h', b[40:56])
+    dt = struct.unpack('<h', b[70:72])[0]
+    pixdim = struct.unpack('<8f', b[76:108])
+    off = int(struct.unpack('<f', b[108:112])[0])
+    if dt not in kTypes:
+        sys.exit('%s: unsupported datatype %d' % (fn, dt))
+    img = array.array(kTypes[dt])
+    img.frombytes(b[off:off + img.itemsize * dim[1] * dim[2] * max(dim[3], 1) * max(dim[4], 1)])
+    if sys.byteorder != 'little':
+        img.byteswap()
+    return dim, pixdim, img
+
+def correlation(a, b):
+    n = len(a)
+    ma, mb = sum(a) / n, sum(b) / n
+    sab = sum((x - ma) * (y - mb) for x, y in zip(a, b))
+    saa = sum((x - ma) ** 2 for x in a)
+    sbb = sum((y - mb) ** 2 for y in b)
+    if saa == 0 or sbb == 0:
+        return 1.0 if saa == sbb else 0.0
+    return sab / (saa * sbb) ** 0.5
+
+def check(full, reduced, r):
+    dim, pixdim, img = readNii(full)
+    rdim, rpixdim, rimg = readNii(reduced)
+    f = 1 << r
+    nx, ny, nz = dim[1], dim[2], max(dim[3], 1) * max(dim[4], 1)
+    rx, ry = (nx + f - 1) // f, (ny + f - 1) // f
+    if rdim == dim and len(rimg) == len(img):
+        return 'skip'  # not JPEG 2000, e.g. an uncompressed series in the same folder
+    if (rdim[1], rdim[2]) != (rx, ry) or rdim[3:5] != dim[3:5]:
+        return 'dimensions %s, expected %dx%dx%s' % ('x'.join(map(str, rdim[1:5])), rx, ry, 'x'.join(map(str, dim[3:5])))
+    for i in (1, 2):
+        if abs(rpixdim[i] - pixdim[i] * f) > 1e-3 * pixdim[i] * f:
+            return 'voxel size %g, expected %g' % (rpixdim[i], pixdim[i] * f)
+    a, b = [], []
+    for z in sorted(set(int(k * nz / kMaxSlices) for k in range(kMaxSlices)) if nz > kMaxSlices else range(nz)):
+        for y in range(ry):
+            for x in range(rx):
+                vals = [img[(z * ny + yy) * nx + xx] for yy in range(y * f, min((y + 1) * f, ny)) for xx in range(x * f, min((x + 1) * f, nx))]
+                a.append(sum(vals) / len(vals))
+                b.append(rimg[(z * ry + y) * rx + x])
+    c = correlation(a, b)
+    if c < kMinCorrelation:
+        return 'correlation with block means %.3f' % c
+    return None
+
+if len(sys.argv) < 3:
+    sys.exit('usage: %s <dcm2niix> <JPEG 2000 DICOM folder> [reduce, default 1]' % sys.argv[0])
+exe, indir = sys.argv[1], sys.argv[2]
+r = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+tmp = tempfile.mkdtemp()
+try:
+    for name, extra in (('full', []), ('reduced', ['--j2k-reduce', str(r)])):
+        os.mkdir(os.path.join(tmp, name))
+        log = subprocess.run([exe, '-z', 'n', '-f', '%s_%p'] + extra + ['-o', os.path.join(tmp, name), indir], capture_output=True, text=True).stdout
+        if 'compiled without OpenJPEG' in log:
+            sys.exit('%s was compiled without OpenJPEG' % exe)
+    nBad, n, nSkip = 0, 0, 0
+    for full in sorted(glob.glob(os.path.join(tmp, 'full', '*.nii'))):
+        n += 1
+        name = os.path.basename(full)
+        reduced = os.path.join(tmp, 'reduced', name)
+        err = check(full, reduced, r) if os.path.exists(reduced) else 'missing'
+        if err == 'skip':
+            nSkip += 1
+            n -= 1
+        elif err:
+            nBad += 1
+            print('%s: %s' % (name, err))
+    print('%s: %d/%d images match at reduce %d (%d not reduced)' % (indir, n - nBad, n, r, nSkip))
+    sys.exit(0 if (n > 0 and nBad == 0) else 1)
+finally:
+    shutil.rmtree(tmp)
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Write lossless JPEG 2000 DICOM series, each with an uncompressed twin holding the same pixels
+#  usage: ./make_j2k.py <output folder> [dcm2niix [dcm2niix options]]
+#  requires Pillow built with OpenJPEG. Given a dcm2niix built with OpenJPEG, the folder is converted
+#  (e.g. with "--threads 4,1" or "--threads 4,4") and every JPEG 2000 image must match its twin voxel for voxel
+#  n.b. Pillow's tiled 16-bit encoder is not lossless, so the codestreams are untiled
+import io, math, os, shutil, struct, subprocess, sys, tempfile
+from PIL import Image
+
+def el(g, e, vr, val):
+    b = val.encode() if isinstance(val, str) else val
+    if len(b) % 2:
+        b += b'\0' if vr in ('UI', 'OB', 'OW') else b' '
+    if vr in ('OB', 'OW'):
+        return struct.pack('<HH2sHI', g, e, vr.encode(), 0, len(b)) + b
+    return struct.pack('<HH2sH', g, e, vr.encode(), len(b)) + b
+
+def write(fn, uid, series, inst, rows, cols, samples, pix, j2k):
+    ts = '1.2.840.10008.1.2.4.90' if j2k else '1.2.840.10008.1.2.1'
+    bits = 8 if samples == 3 else 16
+    meta = el(2, 1, 'OB', b'\0\1') + el(2, 2, 'UI', '1.2.840.10008.5.1.4.1.1.4') + el(2, 3, 'UI', '%s.%d' % (uid, inst)) + el(2, 0x10, 'UI', ts)
+    d = el(8, 8, 'CS', 'ORIGINAL\\PRIMARY') + el(8, 0x18, 'UI', '%s.%d' % (uid, inst)) + el(8, 0x20, 'DA', '20200101')
+    d += el(8, 0x30, 'TM', '120000') + el(8, 0x60, 'CS', 'MR') + el(8, 0x70, 'LO', 'SIEMENS') + el(8, 0x103E, 'LO', 'j2k' if j2k else 'raw')
+    d += el(0x10, 0x10, 'PN', 'Anon') + el(0x18, 0x50, 'DS', '3') + el(0x20, 0xD, 'UI', '1.2.3.4') + el(0x20, 0xE, 'UI', uid)
+    d += el(0x20, 0x11, 'IS', str(series)) + el(0x20, 0x13, 'IS', str(inst))
+    d += el(0x20, 0x32, 'DS', '-40\\-50\\%d' % (3 * inst)) + el(0x20, 0x37, 'DS', '1\\0\\0\\0\\1\\0')
+    d += el(0x28, 2, 'US', struct.pack('<H', samples)) + el(0x28, 4, 'CS', 'RGB' if samples == 3 else 'MONOCHROME2')
+    if samples == 3:
+        d += el(0x28, 6, 'US', struct.pack('<H', 0))
+    d += el(0x28, 0x10, 'US', struct.pack('<H', rows)) + el(0x28, 0x11, 'US', struct.pack('<H', cols))
+    d += el(0x28, 0x30, 'DS', '1\\1') + el(0x28, 0x100, 'US', struct.pack('<H', bits))
+    d += el(0x28, 0x101, 'US', struct.pack('<H', bits)) + el(0x28, 0x102, 'US', struct.pack('<H', bits - 1))
+    d += el(0x28, 0x103, 'US', struct.pack('<H', 0))
+    if j2k:
+        bio = io.BytesIO()
+        Image.frombytes('RGB' if samples == 3 else 'I;16', (cols, rows), pix).save(bio, 'JPEG2000', no_jp2=True, irreversible=False)
+        cs = bio.getvalue() + (b'\0' if len(bio.getvalue()) % 2 else b'')
+        d += struct.pack('<HH2sHI', 0x7FE0, 0x10, b'OB', 0, 0xFFFFFFFF) + struct.pack('<HHI', 0xFFFE, 0xE000, 0)
+        d += struct.pack('<HHI', 0xFFFE, 0xE000, len(cs)) + cs + struct.pack('<HHI', 0xFFFE, 0xE0DD, 0)
+    else:
+        d += el(0x7FE0, 0x10, 'OB' if samples == 3 else 'OW', pix)
+    open(fn, 'wb').write(b'\0' * 128 + b'DICM' + el(2, 0, 'UL', struct.pack('<I', len(meta))) + meta + d)
+
+if len(sys.argv) < 2:
+    sys.exit('usage: %s <output folder> [dcm2niix [dcm2niix options]]' % sys.argv[0])
+os.makedirs(sys.argv[1], exist_ok=True)
+images = ((1, 240, 256, 1), (3, 64, 48, 3))  # smooth 16-bit gray, 8-bit RGB
+for series, rows, cols, samples in images:
+    for inst in range(1, 7):
+        if samples == 3:
+            pix = bytes(((x * 3 + inst) % 256, (y * 2) % 256, (x ^ y) % 256)[c] for y in range(rows) for x in range(cols) for c in range(3))
+        else:
+            v = [int(1000 + 800 * math.sin(x / 17.0 + inst) * math.cos(y / 23.0) + (x * y + inst) % 13) for y in range(rows) for x in range(cols)]
+            pix = struct.pack('<%dH' % len(v), *v)
+        for j2k in (0, 1):
+            write(os.path.join(sys.argv[1], 's%d_%s%d.dcm' % (series + j2k, 'j2k' if j2k else 'raw', inst)), '1.2.826.0.2.%d' % (series + j2k), series + j2k, inst, rows, cols, samples, pix, j2k)
+if len(sys.argv) < 3:
+    sys.exit(0)
+tmp = tempfile.mkdtemp()
+nbad = 0
+try:
+    subprocess.run([sys.argv[2]] + sys.argv[3:] + ['-f', '%s', '-o', tmp, sys.argv[1]], stdout=subprocess.DEVNULL)
+    for series, rows, cols, samples in images:
+        fn = [os.path.join(tmp, '%d.nii' % s) for s in (series, series + 1)]
+        if not os.path.exists(fn[1]):
+            nbad += 1
+            print('series %d: JPEG 2000 not converted (build without OpenJPEG?)' % (series + 1))
+        elif open(fn[0], 'rb').read()[352:] != open(fn[1], 'rb').read()[352:]:
+            nbad += 1
+            print('series %d: JPEG 2000 voxels differ from the uncompressed twin' % (series + 1))
+    print('%d/%d JPEG 2000 series identical to their uncompressed twins' % (len(images) - nbad, len(images)))
+finally:
+    shutil.rmtree(tmp)
+sys.exit(1 if nbad else 0)
@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# Write a Philips enhanced (multi-frame) DICOM with three echoes for fs_wrapper.sh
+#  usage: ./make_multiecho.py <output folder>
+#  the TE of each frame varies, so the single file is converted as three series (_e1, _e2, _e3)
+import os, random, struct, sys
+
+def el(g, e, vr, val):
+    b = val.encode() if isinstance(val, str) else val
+    if len(b) % 2:
+        b += b'\0' if vr in ('UI', 'OB', 'OW') else b' '
+    if vr in ('OB', 'OW', 'SQ'):
+        return struct.pack('<HH2sHI', g, e, vr.encode(), 0, len(b)) + b
+    return struct.pack('<HH2sH', g, e, vr.encode(), len(b)) + b
+
+def item(b):
+    return struct.pack('<HHI', 0xFFFE, 0xE000, len(b)) + b
+
+if len(sys.argv) != 2:
+    sys.exit('usage: %s <output folder>' % sys.argv[0])
+rows, cols, slices, vols, echoes = 32, 32, 6, 6, 3
+uid = '1.2.826.0.2.1'
+frames = b''
+for v in range(vols):
+    for s in range(slices):
+        fc = el(0x20, 0x9057, 'UL', struct.pack('<I', s + 1)) + el(0x20, 0x9157, 'UL', struct.pack('<II', s + 1, v + 1))
+        pos = el(0x20, 0x32, 'DS', '-16\\-14\\%d' % (3 * s))
+        frames += item(el(0x18, 0x81, 'DS', str(10 * (1 + v % echoes))) + el(0x20, 0x9111, 'SQ', item(fc)) + el(0x20, 0x9113, 'SQ', item(pos)))
+dims = item(el(0x20, 0x9165, 'AT', struct.pack('<HH', 0x20, 0x9057))) + item(el(0x20, 0x9165, 'AT', struct.pack('<HH', 0x20, 0x9128)))
+r = random.Random(1)
+pix = struct.pack('<%dH' % (rows * cols * slices * vols), *[r.randrange(4000) for _ in range(rows * cols * slices * vols)])
+meta = el(2, 1, 'OB', b'\0\1') + el(2, 2, 'UI', '1.2.840.10008.5.1.4.1.1.4.1') + el(2, 3, 'UI', uid + '.1') + el(2, 0x10, 'UI', '1.2.840.10008.1.2.1')
+d = el(8, 8, 'CS', 'ORIGINAL\\PRIMARY') + el(8, 0x18, 'UI', uid + '.1') + el(8, 0x20, 'DA', '20200101')
+d += el(8, 0x30, 'TM', '120000') + el(8, 0x60, 'CS', 'MR') + el(8, 0x70, 'LO', 'Philips Medical Systems') + el(8, 0x103E, 'LO', 'multiecho')
+d += el(0x10, 0x10, 'PN', 'Anon') + el(0x18, 0x50, 'DS', '3') + el(0x18, 0x80, 'DS', '2000') + el(0x18, 0x81, 'DS', '10')
+d += el(0x20, 0xD, 'UI', '1.2.3.4') + el(0x20, 0xE, 'UI', uid) + el(0x20, 0x11, 'IS', '1') + el(0x20, 0x13, 'IS', '1')
+d += el(0x20, 0x32, 'DS', '-16\\-14\\0') + el(0x20, 0x37, 'DS', '1\\0\\0\\0\\1\\0') + el(0x20, 0x9222, 'SQ', dims)
+d += el(0x28, 2, 'US', struct.pack('<H', 1)) + el(0x28, 4, 'CS', 'MONOCHROME2') + el(0x28, 8, 'IS', str(slices * vols))
+d += el(0x28, 0x10, 'US', struct.pack('<H', rows)) + el(0x28, 0x11, 'US', struct.pack('<H', cols))
+d += el(0x28, 0x30, 'DS', '1\\1') + el(0x28, 0x100, 'US', struct.pack('<H', 16)) + el(0x28, 0x101, 'US', struct.pack('<H', 16))
+d += el(0x28, 0x102, 'US', struct.pack('<H', 15)) + el(0x28, 0x103, 'US', struct.pack('<H', 0))
+d += el(0x5200, 0x9230, 'SQ', frames) + el(0x7FE0, 0x10, 'OW', pix)
+os.makedirs(sys.argv[1], exist_ok=True)
+open(os.path.join(sys.argv[1], 'multiecho.dcm'), 'wb').write(b'\0' * 128 + b'DICM' + el(2, 0, 'UL', struct.pack('<I', len(meta))) + meta + d)
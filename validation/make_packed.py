@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# Write DICOM series with packed pixel data (BitsAllocated 1 and 12) for compare_builds.sh
+#  usage: ./make_packed.py <output folder>
+#  real packed data (DICOM SEG objects, legacy 12-bit archives) is rare, so these series use random pixels
+#  and awkward sizes: odd voxel counts, rows that end mid-byte and images larger than the unpack chunk
+import os, random, struct, sys
+
+def el(g, e, vr, val):
+    b = val.encode() if isinstance(val, str) else val
+    if len(b) % 2:
+        b += b'\0' if vr in ('UI', 'OB', 'OW') else b' '
+    if vr in ('OB', 'OW'):
+        return struct.pack('<HH2sHI', g, e, vr.encode(), 0, len(b)) + b
+    return struct.pack('<HH2sH', g, e, vr.encode(), len(b)) + b
+
+def write(fn, uid, series, inst, rows, cols, bits, pix):
+    meta = el(2, 1, 'OB', b'\0\1') + el(2, 2, 'UI', '1.2.840.10008.5.1.4.1.1.4') + el(2, 3, 'UI', '%s.%d' % (uid, inst)) + el(2, 0x10, 'UI', '1.2.840.10008.1.2.1')
+    d = el(8, 8, 'CS', 'ORIGINAL\\PRIMARY') + el(8, 0x18, 'UI', '%s.%d' % (uid, inst)) + el(8, 0x20, 'DA', '20200101')
+    d += el(8, 0x30, 'TM', '120000') + el(8, 0x60, 'CS', 'MR') + el(8, 0x70, 'LO', 'SIEMENS') + el(8, 0x103E, 'LO', 'packed%d' % bits)
+    d += el(0x10, 0x10, 'PN', 'Anon') + el(0x18, 0x50, 'DS', '3') + el(0x20, 0xD, 'UI', '1.2.3.4') + el(0x20, 0xE, 'UI', uid)
+    d += el(0x20, 0x11, 'IS', str(series)) + el(0x20, 0x13, 'IS', str(inst))
+    d += el(0x20, 0x32, 'DS', '-40\\-50\\%d' % (3 * inst)) + el(0x20, 0x37, 'DS', '1\\0\\0\\0\\1\\0')
+    d += el(0x28, 2, 'US', struct.pack('<H', 1)) + el(0x28, 4, 'CS', 'MONOCHROME2')
+    d += el(0x28, 0x10, 'US', struct.pack('<H', rows)) + el(0x28, 0x11, 'US', struct.pack('<H', cols))
+    d += el(0x28, 0x30, 'DS', '1\\1') + el(0x28, 0x100, 'US', struct.pack('<H', bits))
+    d += el(0x28, 0x101, 'US', struct.pack('<H', bits)) + el(0x28, 0x102, 'US', struct.pack('<H', bits - 1))
+    d += el(0x28, 0x103, 'US', struct.pack('<H', 0)) + el(0x7FE0, 0x10, 'OB' if bits == 1 else 'OW', pix)
+    open(fn, 'wb').write(b'\0' * 128 + b'DICM' + el(2, 0, 'UL', struct.pack('<I', len(meta))) + meta + d)
+
+if len(sys.argv) != 2:
+    sys.exit('usage: %s <output folder>' % sys.argv[0])
+r = random.Random(1)
+series = 0
+for bits in (1, 12):
+    for rows, cols in ((7, 5), (13, 11), (33, 17), (64, 64), (511, 3), (512, 512)):
+        series += 1
+        out = os.path.join(sys.argv[1], 'b%d_%dx%d' % (bits, rows, cols))
+        os.makedirs(out, exist_ok=True)
+        nvox = rows * cols
+        nbytes = (nvox + 7) // 8 if bits == 1 else (nvox * 3 + 1) // 2
+        uid = '1.2.826.0.1.%d.%d' % (bits, series)
+        for inst in range(1, 4):
+            write(os.path.join(out, 'im%d.dcm' % inst), uid, series, inst, rows, cols, bits, bytes(r.randrange(256) for _ in range(nbytes)))